@@ -65,7 +65,7 @@ echo Compilation succeeded.
 :: Check if executable was created
 if exist "%OUTPUT_EXE%" (
     echo Running %OUTPUT_EXE%...
-    "%OUTPUT_EXE%"
+    "%OUTPUT_EXE%" %*
     set "RUN_EXIT=!ERRORLEVEL!"
     
     if not "!RUN_EXIT!"=="0" (
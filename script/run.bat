@@ -9,7 +9,7 @@ cd /d "%SRC_DIR%" || exit /b 1
 
 if exist main.exe (
     echo Running main.exe...
-    main.exe
+    main.exe %*
 ) else (
     echo main.exe not found. Build it first with build_run.bat
     pause
@@ -5,18 +5,59 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 #include "color.h"
 #include "image.h"
+#include "imageEncoder.h"
 #include <cstdlib> // For C++ programs
 // OR
 #include <stdlib.h> // For C programs
 
+// what saving an image cost: encoding into memory and writing the file
+struct encodeReport
+{
+    imageFormat format = imageFormat::ppm;
+    std::size_t bytes = 0;
+    double encodeMs = 0;
+    double writeMs = 0;
+
+    friend std::ostream &operator<<(std::ostream &os, const encodeReport &r)
+    {
+        os << "encode: " << r.encodeMs << " ms | write: " << r.writeMs << " ms";
+        if (r.bytes)
+            os << " | bytes: " << r.bytes;
+        return os;
+    }
+};
+
 class ImageRenderer
 {
+private:
+    // one P3 line per pixel, "r g b"; text is a scratch buffer reused across rows
+    static void writeRowP3(std::ostream &out, rowSpan<const color> row, std::vector<char> &text)
+    {
+        text.resize(row.size() * 12); // "255 255 255\n" at most
+        char *p = text.data();
+        for (const color &c : row)
+        {
+            const rgb8 px = toRGB8(c);
+            p = std::to_chars(p, p + 3, px.r).ptr;
+            *p++ = ' ';
+            p = std::to_chars(p, p + 3, px.g).ptr;
+            *p++ = ' ';
+            p = std::to_chars(p, p + 3, px.b).ptr;
+            *p++ = '\n';
+        }
+        out.write(text.data(), p - text.data());
+    }
+
 public:
     static std::vector<std::vector<color>> readPPM(const std::string &filename, int &width, int &height)
     {
-        std::ifstream file(filename);
+        std::ifstream file(filename, std::ios::binary);
         if (!file)
         {
             throw std::runtime_error("Could not open file");
@@ -25,8 +66,8 @@ public:
         // Read and validate the PPM format
         std::string format;
         file >> format;
-        if (format != "P3")
-        { // Only handling P3 (ASCII) format
+        if (format != "P3" && format != "P6")
+        { // ASCII (P3) and binary (P6) only
             throw std::runtime_error("Unsupported PPM format");
         }
 
@@ -38,6 +79,28 @@ public:
         // Initialize a 2D vector for the image
         std::vector<std::vector<color>> image(height, std::vector<color>(width));
 
+        if (format == "P6")
+        {
+            if (maxColor > 255)
+            {
+                throw std::runtime_error("Unsupported PPM format");
+            }
+            file.get(); // single whitespace before the raster
+            std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+            for (int i = 0; i < height; ++i)
+            {
+                if (!file.read(reinterpret_cast<char *>(row.data()), static_cast<std::streamsize>(row.size())))
+                {
+                    throw std::runtime_error("Invalid PPM pixel data");
+                }
+                for (int j = 0; j < width; ++j)
+                {
+                    image[i][j] = color(row[j * 3], row[j * 3 + 1], row[j * 3 + 2]);
+                }
+            }
+            return image;
+        }
+
         // Read pixel data
         int r, g, b;
         for (int i = 0; i < height; ++i)
@@ -55,93 +118,83 @@ public:
         return image;
     }
 
-    static void renderToFile(const image &img, const std::string filePath, bool open_image = true)
+    // Launching a viewer on the saved file is a desktop convenience; render nodes turn it off
+    static bool &viewerEnabled()
     {
-        // Open the file for writing
-        std::ofstream outFile(filePath);
-        cerr << "filePath: " << filePath << endl;
-        if (!outFile)
-        {
-            std::cerr << "Error: Cannot open file " << filePath << " for writing.\n";
-            return;
-        }
-
-        // Write the PPM header
-        outFile << "P3\n"
-                << img.getwidth() << ' ' << img.getheight() << "\n255\n";
-
-        // Render the color data stored in the Image object
-        for (int i = img.getheight() - 1; i >= 0; --i)
-        { // Outer loop: height (rows)
-            // std::clog << "\rScanlines remaining: " << (img.getheight() - i) << ' ' << std::flush;
-            for (int j = 0; j < (int)img.getwidth(); ++j)
-            {                                // Inner loop: width (columns)
-                color color = img.get(i, j); // Access color data using width (j) and height (i)
-                int r = static_cast<int>(color.r());
-                int g = static_cast<int>(color.g());
-                int b = static_cast<int>(color.b());
-                outFile << r << ' ' << g << ' ' << b << '\n';
-            }
-        }
+        static bool enabled = true;
+        return enabled;
+    }
+    static void setViewerEnabled(bool enabled) { viewerEnabled() = enabled; }
 
-        outFile.close();
-        std::clog << "\rDone. Image saved to " << filePath << "                 \n";
+    // Saves the image in the format of the file extension (.ppm is binary P6, .png, .qoi, .bmp),
+    // bottom row first. The file is only opened in a viewer when open_image is set and the viewer is enabled.
+    static encodeReport renderToFile(const image &img, const std::string filePath, bool open_image = true)
+    {
+        encodeReport report;
+        cerr << "filePath: " << filePath << endl;
+        report.format = imageEncoder::formatFromPath(filePath);
 
-        // File conversion using ImageMagick
-        std::string pngFile = filePath;
-        size_t pos = pngFile.find_last_of('.');
-        if (pos != std::string::npos)
+        if (report.format == imageFormat::bmp)
         {
-            pngFile.replace(pos, pngFile.length() - pos, ".png");
+            auto start = std::chrono::high_resolution_clock::now();
+            WriteBMP(img, filePath);
+            report.writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
         }
         else
         {
-            pngFile += ".png";
-        }
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::uint8_t> bytes;
+            switch (report.format)
+            {
+            case imageFormat::png:
+                imageEncoder::encodePNG(img, bytes, true);
+                break;
+            case imageFormat::qoi:
+                imageEncoder::encodeQOI(img, bytes, true);
+                break;
+            default:
+                imageEncoder::encodeP6(img, bytes, true);
+                break;
+            }
+            auto encoded = std::chrono::high_resolution_clock::now();
 
-        // Convert PPM to PNG
-        std::string convertCommand = "magick " + filePath + " " + pngFile;
-        std::cout << "convertCommand: " << convertCommand << std::endl;
-        int convertResult = system(convertCommand.c_str());
-        if (convertResult != 0)
-        {
-            std::cerr << "Error: Failed to convert " << filePath << " to " << pngFile << ".\n";
-            return;
-        }
+            std::ofstream outFile(filePath, std::ios::binary);
+            if (!outFile)
+            {
+                std::cerr << "Error: Cannot open file " << filePath << " for writing.\n";
+                return report;
+            }
+            outFile.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            outFile.close();
 
-        std::cout << "Conversion successful: " << filePath << " -> " << pngFile << "\n";
+            report.bytes = bytes.size();
+            report.encodeMs = std::chrono::duration<double, std::milli>(encoded - start).count();
+            report.writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encoded).count();
+        }
+        std::clog << "\rDone. Image saved to " << filePath << " | " << report << "\n";
 
-// Open the PNG file
+        if (open_image && viewerEnabled())
+        {
 #ifdef _WIN32
-        std::string openCommand = "start " + pngFile;
+            std::string openCommand = "start " + filePath;
 #elif __linux__
-        std::string openCommand = "xdg-open " + pngFile;
+            std::string openCommand = "xdg-open " + filePath;
 #elif __APPLE__
-        std::string openCommand = "open " + pngFile;
+            std::string openCommand = "open " + filePath;
 #else
-        std::cerr << "Error: Opening images is not supported on this platform.\n";
-        return;
+            std::cerr << "Error: Opening images is not supported on this platform.\n";
+            return report;
 #endif
-        if (open_image == 1)
-        {
             int openResult = system(openCommand.c_str());
             if (openResult != 0)
             {
-                std::cerr << "Error: Failed to open " << pngFile << ".\n";
-            }
-
-#ifdef _WIN32
-            std::string deleteCommand = "del " + filePath;
-#else
-            std::string deleteCommand = "rm " + filePath;
-#endif
-            int deleteResult = system(deleteCommand.c_str());
-            if (deleteResult != 0)
-            {
-                std::cerr << "Error: Failed to delete " << filePath << ".\n";
+                std::cerr << "Error: Failed to open " << filePath << ".\n";
             }
         }
+        return report;
     }
+
+    // Writes the image as ASCII P3, top row first (kept for text diffs)
     static void renderToFilePPM(const image &img, const std::string filePath)
     {
         // Open the file for writing
@@ -158,17 +211,10 @@ public:
                 << img.getwidth() << ' ' << img.getheight() << "\n255\n";
 
         // Render the color data stored in the Image object
+        std::vector<char> text;
         for (unsigned int i = 0; i < img.getheight(); ++i)
-        { // Outer loop: height (rows)
-            // std::clog << "\rScanlines remaining: " << (img.getheight() - i) << ' ' << std::flush;
-            for (unsigned int j = 0; j < img.getwidth(); ++j)
-            {                                // Inner loop: width (columns)
-                color color = img.get(i, j); // Access color data using width (j) and height (i)
-                int r = static_cast<int>(color.r());
-                int g = static_cast<int>(color.g());
-                int b = static_cast<int>(color.b());
-                outFile << r << ' ' << g << ' ' << b << '\n';
-            }
+        {
+            writeRowP3(outFile, img.row(i), text);
         }
 
         outFile.close();
@@ -228,21 +274,19 @@ public:
         file.write(reinterpret_cast<char *>(&res), 4); // Colors used
         file.write(reinterpret_cast<char *>(&res), 4); // Important colors
 
-        // Pixel data (top-down)
+        // Pixel data (top-down), one padded BGR row at a time
+        std::vector<char> rowBytes(rowSize + padding, 0);
         for (int y = 0; y < height; y++)
         {
-            for (int x = 0; x < width; x++)
+            char *out = rowBytes.data();
+            for (const color &c : img.row(y))
             {
-                color c = img.get(y, x);
-                uint8_t r = static_cast<uint8_t>(c.r());
-                uint8_t g = static_cast<uint8_t>(c.g());
-                uint8_t b = static_cast<uint8_t>(c.b());
-                file.put(b);
-                file.put(g);
-                file.put(r);
+                const rgb8 p = toRGB8(c);
+                *out++ = static_cast<char>(p.b);
+                *out++ = static_cast<char>(p.g);
+                *out++ = static_cast<char>(p.r);
             }
-            for (int i = 0; i < padding; i++)
-                file.put(0);
+            file.write(rowBytes.data(), rowBytes.size());
         }
 
         file.close();
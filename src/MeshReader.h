@@ -6,8 +6,14 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
 
 #include "point.h"
+#include "mappedFile.h"
+#include "threadPool.h"
 
 using namespace std;
 
@@ -29,12 +35,14 @@ struct ObjectData
 {
     int type = 0;
     Vec3 location, scale{1, 1, 1}, rotation;
+    string path; // mesh file of a meshFile object, as written in the scene
 };
 
 class MeshReader
 {
 public:
-    vector<vector<string>> verticesString;
+    // triangle corners of the last mesh read, 3 consecutive points per triangle in file order
+    vector<point> corners;
 
     CameraData sceneCamera;
     bool hasCamera = false;
@@ -43,29 +51,11 @@ public:
     MeshReader(string filename)
     {
         if (!filename.empty())
-            loadMesh(filename, &verticesString);
+            loadMesh(filename);
     }
 
     MeshReader() {}
 
-    point parseTuple(const string &s)
-    {
-        string clean;
-        for (char c : s)
-            if (c != '(' && c != ')')
-                clean += c;
-        stringstream ss(clean);
-        string tok;
-        double x, y, z;
-        getline(ss, tok, ',');
-        x = stod(tok);
-        getline(ss, tok, ',');
-        y = stod(tok);
-        getline(ss, tok, ',');
-        z = stod(tok);
-        return point(x, y, z);
-    }
-
     static Vec3 parseVec3(const string &s)
     {
         Vec3 v;
@@ -144,13 +134,21 @@ public:
 
                 hasCamera = true;
             }
-            else if (parts[0] == "OBJECT" && parts.size() == 5)
+            else if (parts[0] == "OBJECT" && (parts.size() == 5 || parts.size() == 6))
             {
                 ObjectData od;
                 od.type = stoi(parts[1]);
                 od.location = parseVec3(parts[2]);
                 od.scale = parseVec3(parts[3]);
                 od.rotation = parseVec3(parts[4]);
+                // OBJECT;8;(location);(scale);(rotation);path/to/mesh.obj
+                if (parts.size() == 6)
+                {
+                    const size_t first = parts[5].find_first_not_of(" \t\r");
+                    const size_t last = parts[5].find_last_not_of(" \t\r");
+                    if (first != string::npos)
+                        od.path = parts[5].substr(first, last - first + 1);
+                }
                 sceneObjects.push_back(od);
             }
             else
@@ -189,49 +187,193 @@ public:
             sceneCamera.fov, sceneCamera.nearClip, sceneCamera.farClip);
     }
 
-    bool loadMesh(const std::string &filename, std::vector<std::vector<string>> *vertices)
+    /**
+     * Reads a "(x,y,z);(x,y,z);(x,y,z)" mesh into corners.
+     * The file is mapped in one block and cut into chunks at line boundaries. Each chunk is
+     * parsed with from_chars into a corner list of its own, without copying a line or a token,
+     * and the lists are appended to corners in file order. The chunks run on pool when one is
+     * given, one after the other on the calling thread otherwise. Blank lines are skipped and
+     * every line contributes its complete triangles (a trailing 1 or 2 points is ignored, like
+     * convertMesh did). Returns false when the file can't be opened; a malformed line throws
+     * std::runtime_error naming the file and the line number.
+     */
+    bool loadMesh(const std::string &filename, threadPool *pool = nullptr)
     {
-        std::ifstream file(filename);
-        if (!file.is_open())
+        corners.clear();
+        mappedFile file;
+        try
+        {
+            file = mappedFile(filename);
+        }
+        catch (const std::runtime_error &)
         {
             cerr << "failed to open the file !" << endl;
             return false;
         }
-        std::string line;
-        while (std::getline(file, line))
+
+        const char *begin = reinterpret_cast<const char *>(file.data());
+        const char *end = begin + file.size();
+
+        // chunk boundaries, each one just after a '\n'
+        const size_t chunkCount = std::max<size_t>(1, file.size() / kChunkBytes);
+        vector<const char *> cuts{begin};
+        for (size_t c = 1; c < chunkCount; ++c)
         {
-            std::vector<std::string> vertex;
-            size_t pos = 0;
-            while ((pos = line.find(';')) != std::string::npos)
-            {
-                vertex.push_back(line.substr(0, pos));
-                line.erase(0, pos + 1);
-            }
-            vertex.push_back(line);
-            vertices->push_back(vertex);
+            const char *cut = std::max(cuts.back(), begin + c * file.size() / chunkCount);
+            cut = static_cast<const char *>(std::memchr(cut, '\n', end - cut));
+            if (!cut)
+                break;
+            cuts.push_back(cut + 1);
+        }
+        cuts.push_back(end);
+
+        vector<meshChunk> chunks(cuts.size() - 1);
+        auto parseChunk = [&](size_t c, size_t)
+        { parseLines(cuts[c], cuts[c + 1], chunks[c]); };
+        if (pool && chunks.size() > 1)
+        {
+            pool->parallelFor(chunks.size(), parseChunk);
+        }
+        else
+        {
+            for (size_t c = 0; c < chunks.size(); ++c)
+                parseChunk(c, 0);
+        }
+
+        // the first failing chunk in file order, its line number is offset by the lines before it
+        size_t lineBase = 0;
+        size_t total = 0;
+        for (const meshChunk &chunk : chunks)
+        {
+            if (!chunk.error.empty())
+                throw std::runtime_error("MeshReader: " + filename + ":" + to_string(lineBase + chunk.errorLine) + ": " + chunk.error);
+            lineBase += chunk.lines;
+            total += chunk.corners.size();
+        }
+
+        corners.reserve(total);
+        for (meshChunk &chunk : chunks)
+        {
+            corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+            vector<point>().swap(chunk.corners);
         }
-        file.close();
         return true;
     }
 
+    // triangles of the last mesh read, one group of 3 points per triangle
     bool convertMesh(vector<vector<point>> *vertices)
     {
-        if (verticesString.size() == 0)
+        if (corners.size() == 0)
         {
             cerr << "failed to open the file !" << endl;
             return false;
         }
-        for (size_t i = 0; i < verticesString.size(); i++)
+        vertices->reserve(vertices->size() + corners.size() / 3);
+        for (size_t i = 0; i + 2 < corners.size(); i += 3)
+            vertices->push_back({corners[i], corners[i + 1], corners[i + 2]});
+        return true;
+    }
+
+private:
+    // files are cut into chunks of about this size for the parallel parse
+    static constexpr size_t kChunkBytes = size_t(1) << 20;
+
+    struct meshChunk
+    {
+        vector<point> corners;
+        size_t lines = 0;     // lines started in the chunk
+        size_t errorLine = 0; // 1 based, within the chunk
+        string error;
+    };
+
+    static const char *skipBlanks(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        return p;
+    }
+
+    // "(x,y,z)" with optional blanks; returns the character after ')' or nullptr and the reason
+    static const char *parsePoint(const char *p, const char *end, point &out, const char *&error)
+    {
+        double c[3];
+        p = skipBlanks(p, end);
+        if (p == end || *p != '(')
         {
-            vector<point> v;
-            for (size_t j = 0; j < verticesString[i].size(); j++)
-                v.push_back(parseTuple(verticesString[i][j]));
-            vertices->push_back(v);
+            error = "expected '('";
+            return nullptr;
+        }
+        ++p;
+        for (int k = 0; k < 3; ++k)
+        {
+            p = skipBlanks(p, end);
+            if (p < end && *p == '+')
+                ++p;
+            auto [next, ec] = std::from_chars(p, end, c[k]);
+            if (ec != std::errc())
+            {
+                error = "expected a number";
+                return nullptr;
+            }
+            p = skipBlanks(next, end);
+            const char expected = k < 2 ? ',' : ')';
+            if (p == end || *p != expected)
+            {
+                error = k < 2 ? "expected ','" : "expected ')'";
+                return nullptr;
+            }
+            ++p;
+        }
+        out = point(c[0], c[1], c[2]);
+        return p;
+    }
+
+    // parses the whole lines of [p, end) into chunk, stops at the first malformed line
+    static void parseLines(const char *p, const char *end, meshChunk &chunk)
+    {
+        chunk.corners.reserve(static_cast<size_t>(end - p) / 24);
+        while (p < end)
+        {
+            const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if (!eol)
+                eol = end;
+            const char *last = eol;
+            if (last > p && last[-1] == '\r')
+                --last;
+            chunk.lines++;
+
+            const size_t lineStart = chunk.corners.size();
+            const char *q = skipBlanks(p, last);
+            while (q < last)
+            {
+                point v;
+                const char *error = nullptr;
+                q = parsePoint(q, last, v, error);
+                if (!q)
+                {
+                    chunk.errorLine = chunk.lines;
+                    chunk.error = error;
+                    return;
+                }
+                chunk.corners.push_back(v);
+                q = skipBlanks(q, last);
+                if (q < last)
+                {
+                    if (*q != ';')
+                    {
+                        chunk.errorLine = chunk.lines;
+                        chunk.error = "expected ';'";
+                        return;
+                    }
+                    q = skipBlanks(q + 1, last);
+                }
+            }
+            // incomplete triangle at the end of the line
+            chunk.corners.resize(chunk.corners.size() - (chunk.corners.size() - lineStart) % 3);
+            p = eol + 1;
         }
-        return verticesString.size() == vertices->size();
     }
 
-private:
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
 };
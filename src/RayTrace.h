@@ -1,6 +1,6 @@
 /**
  * @file RayTrace.h
- * @brief Defines the a point class for point operations.
+ * @brief Defines the RayTrace class, the multi-bounce path of one camera ray.
  */
 #ifndef RAYTRACE_H
 #define RAYTRACE_H
@@ -8,121 +8,144 @@
 #include "ray.h"
 #include "Hit.h"
 #include "object.h"
+#include "sceneView.h"
+#include "rayCaster.h"
+#include "traceStats.h"
+#include "triangleIntersection.h"
 #include "gmath.h"
-#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 #include <string>
 
 using namespace std;
 
+/**
+ * @class RayTrace
+ * @brief Follows a ray from hit to hit: each bounce takes the nearest hit over the whole scene
+ * (through the top-level hierarchy and the object grids / BVHs) and reflects about its normal.
+ * The path is folded into a fixed-size state as it is walked (running color, light reached,
+ * number of hits, last hit), so tracing allocates nothing.
+ */
 class RayTrace
 {
 public:
-    vector<Hit> Path;
+    static constexpr size_t kMaxBounce = 100;
+
     ray SourceRay;
+
     // constructor
-    RayTrace(const ray r)
-    {
-        SourceRay = r;
-    }
-    // trace the path and keeps track
-    void trace(const size_t Bounce, const vector<object> *objects)
-    {
+    RayTrace(const ray &r) : SourceRay(r) {}
 
-        if (Bounce == 0 || Bounce > 100)
+    // traces up to Bounce hits, stops early on a miss or once a light is reached
+    void trace(const size_t Bounce, const sceneView &scene, const rayCaster &caster, traceStats &counters)
+    {
+        if (Bounce == 0 || Bounce > kMaxBounce)
         {
-            std::string temp = std::to_string(Bounce) + " Bounce value invalid";
-            throw temp;
+            throw std::invalid_argument("RayTrace::trace(): " + std::to_string(Bounce) + " Bounce value invalid");
         }
 
         ray currentRay = SourceRay;
-
         for (size_t i = 0; i < Bounce; i++)
         {
-            for (size_t j = 0; j < objects->size(); j++)
-            {
-
-                Hit currentHit = handleIntersection(objects->at(j), currentRay);
-                // cout << currentHit.colorValue;
-                // cout << currentHit << endl;
-                if (!currentHit.null)
-                {
-                    Path.push_back(currentHit);
-                    currentRay = ray(currentHit.hitPoint, currentHit.outgoing);
-                    if (currentHit.ReachedLight)
-                    {
-                        // cout << currentHit << endl;
-
-                        break;
-                    }
-                }
-            }
+            double dist = std::numeric_limits<double>::infinity();
+            size_t tri = 0;
+            const objectView *hitObject = caster.intersectScene(currentRay, scene, dist, tri, counters);
+            if (!hitObject)
+                break;
+
+            const Hit currentHit = hitAt(*hitObject, currentRay, tri, dist);
+            if (currentHit.null)
+                break;
+
+            record(currentHit);
+            if (currentHit.ReachedLight)
+                break;
+
+            currentRay = ray(leaveSurface(currentHit), currentHit.outgoing);
         }
+    }
+
+    // same with its own ray caster and counters
+    void trace(const size_t Bounce, const sceneView &objects, triangleTest mode = triangleTest::mollerTrumbore)
+    {
+        rayCaster caster;
+        caster.mode = mode;
+        traceStats counters;
+        trace(Bounce, objects, caster, counters);
+    }
 
-        // cout << "________________" << endl;
+    // nearest hit of r on one object, null when it misses
+    Hit handleIntersection(const objectView &obj, const ray &r1, triangleTest mode = triangleTest::mollerTrumbore)
+    {
+        rayCaster caster;
+        caster.mode = mode;
+        traceStats counters;
+        double dist = std::numeric_limits<double>::infinity();
+        size_t tri = 0;
+        if (!caster.intersectObject(r1, obj, dist, tri, counters))
+            return Hit();
+        return hitAt(obj, r1, tri, dist);
     }
 
-    Hit handleIntersection(const object obj, const ray r1)
+    // color of the path, black when it never reached a light
+    color getPixelValue() const
     {
-        Hit finalHit = Hit();
-        double dis = 1.0e18;
-        // bool triggered = false;
-        //  Iterate through the color map vertices
-        for (auto const &x : obj.colorMap)
-        {
-            // Get the vertices as an array
-            array<point, 3> arr = {x.first[0], x.first[1], x.first[2]};
-
-            // Check if the ray intersects with the current triangle
-            Hit *val = gmath::intersect3dHit(r1, arr.data());
-            if (val != nullptr)
-            {
-                // Set the pixel in the image
-                double leng = gmath::distance(r1.getOrigine(), val->hitPoint);
-
-                // Check if the distance exceeds or equals the specified length
-                if (dis >= leng)
-                {
-                    // Clamp the distance to the maximum length
-                    dis = leng;
-
-                    // Temporary variables for holding the color
-                    val->null = false;
-                    if (obj.isEmisive)
-                    {
-                        val->ReachedLight = true;
-                    }
-                    finalHit = Hit(val);
-                    finalHit.colorValue = x.second;
-                    // cout << finalHit.colorValue;
-                }
-            }
-            delete val;
-        }
-        // cout << finalHit.colorValue;
+        return reachedLight ? accumulated : color(0, 0, 0);
+    }
+
+    // number of hits of the last trace
+    size_t pathLength() const { return length; }
 
-        return finalHit;
+    // last hit of the path, null when the source ray missed everything
+    const Hit &lastHit() const { return last; }
+
+private:
+    color accumulated = color(255, 255, 255);
+    bool reachedLight = false;
+    size_t length = 0;
+    Hit last;
+
+    void record(const Hit &h)
+    {
+        accumulated = (accumulated + h.colorValue) / 1.5;
+        reachedLight = reachedLight || h.ReachedLight;
+        ++length;
+        last = h;
     }
 
-    color getPixelValue()
+    // The bounce off triangle tri of obj, dist along the unit direction of r. The normal of an
+    // instance is brought back to world space, a degenerate triangle gives a null hit.
+    static Hit hitAt(const objectView &obj, const ray &r, size_t tri, double dist)
     {
-        bool light;
-        color temp = color(255, 255, 255);
-        for (auto const &x : Path)
-        {
-            if (x.null)
-            {
-                continue;
-            }
-
-            temp = (temp + x.colorValue) / 1.5;
-            if (x.ReachedLight)
-            {
-                light = true;
-            }
-        }
+        const vec3 d = r.getDirection();
+        const point hitPoint = r.getOrigine() + gmath::normalize(d) * dist;
+
+        const triangleRecord &rec = obj.mesh->records[tri];
+        vec3 n = gmath::cross(rec.e1, rec.e2);
+        if (obj.toObject)
+            n = obj.toObject->applyNormalTransposed(n);
+        if (gmath::magnitude(n) == 0)
+            return Hit();
+        n = gmath::normalize(n);
+
+        const vec3 outgoing = gmath::reflect(d, n);
+        Hit h(hitPoint, n, gmath::angleBetweenDegree(d, outgoing), d, outgoing);
+        h.ReachedLight = obj.emissive;
+        h.colorValue = obj.triangleColor(tri);
+        return h;
+    }
 
-        return (light) ? temp : color(0, 0, 0);
+    // origin of the reflected ray, pushed off the surface on the side it leaves by so it does
+    // not hit the triangle it starts from again (scaled with the magnitude of the coordinates)
+    static point leaveSurface(const Hit &h)
+    {
+        const point &p = h.hitPoint;
+        const double scale = std::max({std::fabs(p.get_x()), std::fabs(p.get_y()), std::fabs(p.get_z())});
+        const double side = gmath::dot(h.outgoing, h.normal) >= 0 ? 1.0 : -1.0;
+        return p + h.normal * (side * 1e-5 * (1.0 + scale));
     }
 };
 
-#endif // POINT_H
\ No newline at end of file
+#endif // RAYTRACE_H
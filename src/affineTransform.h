@@ -0,0 +1,113 @@
+/**
+ * @file affineTransform.h
+ * @brief Defines the affineTransform class, a 3x3 linear part plus a translation, used to place instanced meshes.
+ */
+#ifndef AFFINETRANSFORM_H
+#define AFFINETRANSFORM_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "point.h"
+#include "vec3.h"
+#include "gmath.h"
+#include "quaternion.h"
+
+/**
+ * @class affineTransform
+ * @brief p -> linear * p + translation.
+ * placement() reproduces what the object loaders bake into the vertices (scale, offset,
+ * then a rotation about the world origin), so an instance renders where a baked copy would.
+ */
+class affineTransform
+{
+public:
+    double linear[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    double translation[3] = {0, 0, 0};
+
+    affineTransform() = default;
+
+    static affineTransform identity() { return affineTransform(); }
+
+    // quaternion::rotate(p * scaling + offset, angle, axis), the rotation skipped like the loaders do
+    static affineTransform placement(double scaling, const point &offset, const vec3 &axis = vec3(0, 0, 0), double angle = 0)
+    {
+        affineTransform m;
+        const bool rotate = !(angle == 0 || axis == vec3::zero() || (gmath::magnitude(axis) < 1e-6));
+        const point basis[3] = {point(1, 0, 0), point(0, 1, 0), point(0, 0, 1)};
+        for (int c = 0; c < 3; ++c)
+        {
+            const point column = rotate ? quaternion::rotate(basis[c], angle, axis) : basis[c];
+            m.linear[0][c] = column.x() * scaling;
+            m.linear[1][c] = column.y() * scaling;
+            m.linear[2][c] = column.z() * scaling;
+        }
+        const point moved = rotate ? quaternion::rotate(offset, angle, axis) : offset;
+        m.translation[0] = moved.x();
+        m.translation[1] = moved.y();
+        m.translation[2] = moved.z();
+        return m;
+    }
+
+    point apply(const point &p) const
+    {
+        const double x = p.x(), y = p.y(), z = p.z();
+        return point(linear[0][0] * x + linear[0][1] * y + linear[0][2] * z + translation[0],
+                     linear[1][0] * x + linear[1][1] * y + linear[1][2] * z + translation[1],
+                     linear[2][0] * x + linear[2][1] * y + linear[2][2] * z + translation[2]);
+    }
+
+    // directions ignore the translation
+    vec3 applyVector(const vec3 &v) const
+    {
+        const double x = v.x(), y = v.y(), z = v.z();
+        return vec3(linear[0][0] * x + linear[0][1] * y + linear[0][2] * z,
+                    linear[1][0] * x + linear[1][1] * y + linear[1][2] * z,
+                    linear[2][0] * x + linear[2][1] * y + linear[2][2] * z);
+    }
+
+    // normals go through the transpose of the inverse; call it on the inverse transform
+    vec3 applyNormalTransposed(const vec3 &n) const
+    {
+        const double x = n.x(), y = n.y(), z = n.z();
+        return vec3(linear[0][0] * x + linear[1][0] * y + linear[2][0] * z,
+                    linear[0][1] * x + linear[1][1] * y + linear[2][1] * z,
+                    linear[0][2] * x + linear[1][2] * y + linear[2][2] * z);
+    }
+
+    // largest factor a length can grow by, bounds the radius of a transformed sphere
+    double maxScale() const
+    {
+        double s = 0;
+        for (int c = 0; c < 3; ++c)
+            s = std::max(s, std::sqrt(linear[0][c] * linear[0][c] + linear[1][c] * linear[1][c] + linear[2][c] * linear[2][c]));
+        return s;
+    }
+
+    affineTransform inverse() const
+    {
+        const double(&a)[3][3] = linear;
+        const double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+                           a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+                           a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+        if (std::abs(det) < 1e-300)
+            throw std::invalid_argument("affineTransform::inverse(): singular transform");
+
+        affineTransform inv;
+        const double k = 1.0 / det;
+        inv.linear[0][0] = (a[1][1] * a[2][2] - a[1][2] * a[2][1]) * k;
+        inv.linear[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * k;
+        inv.linear[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * k;
+        inv.linear[1][0] = (a[1][2] * a[2][0] - a[1][0] * a[2][2]) * k;
+        inv.linear[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * k;
+        inv.linear[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * k;
+        inv.linear[2][0] = (a[1][0] * a[2][1] - a[1][1] * a[2][0]) * k;
+        inv.linear[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * k;
+        inv.linear[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * k;
+        for (int r = 0; r < 3; ++r)
+            inv.translation[r] = -(inv.linear[r][0] * translation[0] + inv.linear[r][1] * translation[1] + inv.linear[r][2] * translation[2]);
+        return inv;
+    }
+};
+
+#endif // AFFINETRANSFORM_H
@@ -0,0 +1,97 @@
+/**
+ * @file allocCounter.h
+ * @brief Replaces the global operator new/delete to count heap allocations, used by the render benchmarks.
+ * Must be included by a single translation unit (main.cpp).
+ */
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace allocCounter
+{
+    inline std::atomic<std::size_t> allocations{0};
+    inline std::atomic<std::size_t> bytes{0};
+
+    // allocations and bytes requested since the program started
+    struct snapshot
+    {
+        std::size_t allocations;
+        std::size_t bytes;
+    };
+
+    inline snapshot now()
+    {
+        return {allocations.load(std::memory_order_relaxed), bytes.load(std::memory_order_relaxed)};
+    }
+}
+
+// GCC pairs the replaced operator new with the free() below once both are inlined and reports a false mismatch
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size)
+{
+    allocCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    allocCounter::bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+// over-aligned allocations (framebuffer pixels) go through the aligned forms
+void *operator new(std::size_t size, std::align_val_t align)
+{
+    allocCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    allocCounter::bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::size_t a = static_cast<std::size_t>(align);
+#ifdef _WIN32
+    if (void *p = _aligned_malloc(size == 0 ? 1 : size, a))
+        return p;
+#else
+    if (void *p = std::aligned_alloc(a, ((size == 0 ? 1 : size) + a - 1) / a * a))
+        return p;
+#endif
+    throw std::bad_alloc();
+}
+
+inline void alignedFree(void *p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // ALLOCCOUNTER_H
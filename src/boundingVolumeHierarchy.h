@@ -0,0 +1,974 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include "point.h"
+#include "ray.h"
+#include "gmath.h"
+#include "traceStats.h"
+#include "triangleMesh.h"
+#include "triangleIntersection.h"
+#include "cpuFeatures.h"
+#include "threadPool.h"
+
+// ---------------------------------------------------------------------
+// BVHNode: one axis-aligned box of the hierarchy.
+//
+//   inner node : count == 0, children are m_nodes[leftFirst] and m_nodes[leftFirst + 1]
+//   leaf       : count  > 0, triangle ids are m_triangleIds[leftFirst .. leftFirst + count)
+//
+// Children are always allocated as a pair so only the left index is stored.
+// ---------------------------------------------------------------------
+struct BVHNode
+{
+    point boundsMin;
+    point boundsMax;
+    std::uint32_t leftFirst = 0;
+    std::uint32_t count = 0;
+
+    bool IsLeaf() const { return count > 0; }
+};
+
+class boundingVolumeHierarchy
+{
+public:
+    static constexpr std::size_t kBins = 16;     // SAH candidate planes per axis
+    static constexpr std::size_t kMaxDepth = 60; // keeps the traversal stack bounded
+
+    // parallel build: meshes below kParallelBuild triangles are built serially, the subtrees
+    // handed to the workers hold at least kParallelGrain triangles
+    static constexpr std::size_t kParallelBuild = 1 << 14;
+    static constexpr std::size_t kParallelGrain = 1 << 12;
+
+    // Builds the hierarchy over the triangles of a mesh. Only triangle ids are stored, the
+    // same mesh has to be passed back to Intersect.
+    // With a pool a large mesh is built on its workers: the top splits bin their triangles in
+    // parallel chunks, then every subtree below them is built as its own task. The splits are
+    // the ones of the serial build, so is the tree; only the order of the nodes differs.
+    boundingVolumeHierarchy(const triangleMesh &mesh, std::size_t maxLeafSize = 4, threadPool *pool = nullptr)
+        : m_maxLeafSize(std::max<std::size_t>(maxLeafSize, 1))
+    {
+        if (mesh.empty())
+            throw std::invalid_argument("boundingVolumeHierarchy: no triangles to build from.");
+
+        Build(mesh, pool);
+    }
+
+    // Reuses a tree built over the same triangles elsewhere (the object-space tree stored in a
+    // mesh cache) and refits every box to the positions of this mesh. Valid for any transform of
+    // the positions; the split quality is the one of the original tree.
+    boundingVolumeHierarchy(const triangleMesh &mesh, std::vector<BVHNode> nodes, std::vector<std::uint32_t> triangleIds,
+                            std::size_t maxLeafSize)
+        : m_triangleIds(std::move(triangleIds)), m_nodes(std::move(nodes)), m_maxLeafSize(std::max<std::size_t>(maxLeafSize, 1))
+    {
+        if (m_nodes.empty() || m_triangleIds.size() != mesh.triangleCount())
+            throw std::invalid_argument("boundingVolumeHierarchy: the tree doesn't match the mesh.");
+        Validate();
+        Refit(mesh);
+    }
+
+    std::size_t NodeCount() const { return m_nodes.size(); }
+    std::size_t TriangleCount() const { return m_triangleIds.size(); }
+    std::size_t MaxLeafSize() const { return m_maxLeafSize; }
+    const std::vector<BVHNode> &Nodes() const { return m_nodes; }
+    const std::vector<std::uint32_t> &TriangleIds() const { return m_triangleIds; }
+
+    // heap bytes held by the tree (the mesh is not counted)
+    std::size_t MemoryBytes() const
+    {
+        return m_nodes.capacity() * sizeof(BVHNode) + m_triangleIds.capacity() * sizeof(std::uint32_t);
+    }
+
+    // Recomputes the boxes bottom-up from the current positions of the mesh, the tree is kept.
+    // Children are always stored after their parent, so one reverse sweep is enough.
+    void Refit(const triangleMesh &mesh)
+    {
+        for (std::size_t k = m_nodes.size(); k-- > 0;)
+        {
+            BVHNode &node = m_nodes[k];
+            Bounds b;
+            if (node.IsLeaf())
+            {
+                if (static_cast<std::size_t>(node.leftFirst) + node.count > m_triangleIds.size())
+                    throw std::invalid_argument("boundingVolumeHierarchy: leaf range outside the triangle ids.");
+                for (std::uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+                {
+                    if (m_triangleIds[i] >= mesh.triangleCount())
+                        throw std::invalid_argument("boundingVolumeHierarchy: triangle id outside the mesh.");
+                    for (std::size_t c = 0; c < 3; ++c)
+                        b.Grow(mesh.vertex(m_triangleIds[i], c));
+                }
+            }
+            else
+            {
+                if (node.leftFirst <= k || static_cast<std::size_t>(node.leftFirst) + 1 >= m_nodes.size())
+                    throw std::invalid_argument("boundingVolumeHierarchy: child stored before its parent.");
+                for (std::uint32_t child = node.leftFirst; child <= node.leftFirst + 1; ++child)
+                {
+                    b.Grow(m_nodes[child].boundsMin);
+                    b.Grow(m_nodes[child].boundsMax);
+                }
+            }
+            node.boundsMin = point(b.lo[0], b.lo[1], b.lo[2]);
+            node.boundsMax = point(b.hi[0], b.hi[1], b.hi[2]);
+        }
+    }
+
+    // Checks a tree that wasn't built here (read from a cache) before anything walks it: every node
+    // is reached exactly once from the root, no path is deeper than kMaxDepth (the traversal stacks
+    // are sized for it), and the leaves cover the triangle ids once each, which are a permutation
+    // of the mesh triangles.
+    void Validate() const
+    {
+        std::vector<char> reached(m_nodes.size(), 0);
+        std::vector<char> idUsed(m_triangleIds.size(), 0);
+        std::vector<char> slotUsed(m_triangleIds.size(), 0);
+        std::vector<std::pair<std::uint32_t, std::size_t>> pending; // node, depth
+        pending.emplace_back(0, 0);
+        while (!pending.empty())
+        {
+            const auto [k, depth] = pending.back();
+            pending.pop_back();
+
+            if (k >= m_nodes.size())
+                throw std::invalid_argument("boundingVolumeHierarchy: node index outside the tree.");
+            if (depth > kMaxDepth)
+                throw std::invalid_argument("boundingVolumeHierarchy: tree deeper than kMaxDepth.");
+            if (reached[k])
+                throw std::invalid_argument("boundingVolumeHierarchy: node reached from two parents.");
+            reached[k] = 1;
+
+            const BVHNode &node = m_nodes[k];
+            if (node.IsLeaf())
+            {
+                if (static_cast<std::size_t>(node.leftFirst) + node.count > m_triangleIds.size())
+                    throw std::invalid_argument("boundingVolumeHierarchy: leaf range outside the triangle ids.");
+                for (std::uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+                {
+                    if (slotUsed[i])
+                        throw std::invalid_argument("boundingVolumeHierarchy: leaf ranges overlap.");
+                    slotUsed[i] = 1;
+                    const std::uint32_t id = m_triangleIds[i];
+                    if (id >= idUsed.size())
+                        throw std::invalid_argument("boundingVolumeHierarchy: triangle id outside the mesh.");
+                    if (idUsed[id])
+                        throw std::invalid_argument("boundingVolumeHierarchy: triangle id used twice.");
+                    idUsed[id] = 1;
+                }
+            }
+            else
+            {
+                if (static_cast<std::size_t>(node.leftFirst) + 1 >= m_nodes.size())
+                    throw std::invalid_argument("boundingVolumeHierarchy: child index outside the tree.");
+                pending.emplace_back(node.leftFirst, depth + 1);
+                pending.emplace_back(node.leftFirst + 1, depth + 1);
+            }
+        }
+
+        if (std::find(reached.begin(), reached.end(), 0) != reached.end())
+            throw std::invalid_argument("boundingVolumeHierarchy: node not reached from the root.");
+        if (std::find(slotUsed.begin(), slotUsed.end(), 0) != slotUsed.end())
+            throw std::invalid_argument("boundingVolumeHierarchy: leaves don't cover every triangle.");
+    }
+
+    // Nearest hit closer than bestDist. On success bestDist and outTriangle (a mesh triangle id) are updated.
+    // Children are visited near to far and any node whose entry distance is beyond the
+    // current nearest hit is skipped, so the walk stops as soon as nothing closer can remain.
+    bool Intersect(const triangleMesh &mesh, const rayQuery &query, double &bestDist, std::size_t &outTriangle,
+                   traceStats *stats = nullptr) const
+    {
+        const double inv[3] = {SafeInverse(query.direction[0]), SafeInverse(query.direction[1]), SafeInverse(query.direction[2])};
+
+        if (stats)
+            stats->rays++;
+
+        if (EntryDistance(m_nodes[0], query.origin, inv, bestDist) == kMiss)
+            return false;
+
+        return Traverse(mesh, query, inv, 0, bestDist, outTriangle, false, stats);
+    }
+
+    // Any hit closer than maxDist (shadow and visibility rays). The walk returns at the first
+    // triangle found: no nearest hit to keep, so nothing is re-sorted or pruned against it.
+    // The near child is still entered first, that's where a blocker is most likely.
+    bool Occluded(const triangleMesh &mesh, const rayQuery &query, double maxDist, traceStats *stats = nullptr) const
+    {
+        const double inv[3] = {SafeInverse(query.direction[0]), SafeInverse(query.direction[1]), SafeInverse(query.direction[2])};
+        const double *ros = query.origin;
+
+        if (stats)
+            stats->rays++;
+
+        if (EntryDistance(m_nodes[0], ros, inv, maxDist) == kMiss)
+            return false;
+
+        std::uint32_t stack[kMaxDepth + 4];
+        std::size_t top = 0;
+        std::uint32_t nodeIdx = 0;
+        for (;;)
+        {
+            const BVHNode &node = m_nodes[nodeIdx];
+            if (stats)
+                stats->nodesVisited++;
+
+            if (node.IsLeaf())
+            {
+                for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+                {
+                    if (stats)
+                        stats->triangleTests++;
+                    if (query.occludes(mesh, m_triangleIds[k], maxDist))
+                    {
+                        if (stats)
+                            stats->hits++;
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                std::uint32_t nearIdx = node.leftFirst;
+                std::uint32_t farIdx = node.leftFirst + 1;
+                double nearDist = EntryDistance(m_nodes[nearIdx], ros, inv, maxDist);
+                double farDist = EntryDistance(m_nodes[farIdx], ros, inv, maxDist);
+                if (farDist < nearDist)
+                {
+                    std::swap(nearIdx, farIdx);
+                    std::swap(nearDist, farDist);
+                }
+
+                if (nearDist != kMiss)
+                {
+                    if (farDist != kMiss)
+                        stack[top++] = farIdx;
+                    nodeIdx = nearIdx;
+                    continue;
+                }
+            }
+
+            if (top == 0)
+                return false;
+            nodeIdx = stack[--top];
+        }
+    }
+
+    // Packet version of Intersect for up to kMaxPacket coherent rays (a 2x2 or 4x4 block of
+    // camera rays). The rays walk the tree together: each node is fetched once per packet and
+    // its box is tested against all the rays at once (4 per AVX2 instruction when available).
+    // When only one ray is left in a subtree the packet has diverged and that ray finishes the
+    // subtree on its own. bestDist and outTriangle are per ray; returns the mask of rays that
+    // found a closer hit.
+    std::uint32_t IntersectPacket(const triangleMesh &mesh, const rayQuery *queries, std::size_t count,
+                                  double *bestDist, std::size_t *outTriangle, traceStats *stats = nullptr) const
+    {
+        RayPacket packet;
+        packet.count = std::min(count, kMaxPacket);
+        for (std::size_t r = 0; r < kMaxPacket; ++r)
+        {
+            const bool used = r < packet.count;
+            packet.ox[r] = used ? queries[r].origin[0] : 0.0;
+            packet.oy[r] = used ? queries[r].origin[1] : 0.0;
+            packet.oz[r] = used ? queries[r].origin[2] : 0.0;
+            packet.ix[r] = used ? PacketInverse(queries[r].direction[0]) : 0.0;
+            packet.iy[r] = used ? PacketInverse(queries[r].direction[1]) : 0.0;
+            packet.iz[r] = used ? PacketInverse(queries[r].direction[2]) : 0.0;
+            packet.best[r] = used ? bestDist[r] : -1.0; // unused lanes never enter a box
+        }
+
+        if (stats)
+        {
+            stats->rays += packet.count;
+            stats->packets++;
+        }
+
+        const PacketBoxFn boxTest = PacketBoxTest();
+        double minEntry;
+        std::uint32_t mask = boxTest(m_nodes[0], packet, (1u << packet.count) - 1, minEntry);
+        if (mask == 0)
+            return 0;
+
+        std::pair<std::uint32_t, std::uint32_t> stack[kMaxDepth + 4]; // node, rays that entered it
+        std::size_t top = 0;
+        std::uint32_t nodeIdx = 0;
+        std::uint32_t hitMask = 0;
+        triangleHit th;
+
+        for (;;)
+        {
+            const BVHNode &node = m_nodes[nodeIdx];
+
+            if ((mask & (mask - 1)) == 0)
+            {
+                // a single ray left: no point carrying the packet
+                const std::size_t r = cpuFeatures::lowestBit(mask);
+                const double inv[3] = {SafeInverse(queries[r].direction[0]), SafeInverse(queries[r].direction[1]), SafeInverse(queries[r].direction[2])};
+                if (Traverse(mesh, queries[r], inv, nodeIdx, bestDist[r], outTriangle[r], (hitMask >> r) & 1u, stats))
+                {
+                    hitMask |= 1u << r;
+                    packet.best[r] = bestDist[r];
+                }
+            }
+            else if (node.IsLeaf())
+            {
+                if (stats)
+                    stats->nodesVisited++;
+
+                for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+                {
+                    const std::uint32_t tri = m_triangleIds[k];
+                    for (std::uint32_t rays = mask; rays; rays &= rays - 1)
+                    {
+                        const std::size_t r = cpuFeatures::lowestBit(rays);
+                        if (stats)
+                            stats->triangleTests++;
+                        if (!queries[r].intersect(mesh, tri, th) || !Closer(th.t, tri, bestDist[r], outTriangle[r], (hitMask >> r) & 1u))
+                            continue;
+
+                        bestDist[r] = packet.best[r] = th.t;
+                        outTriangle[r] = tri;
+                        hitMask |= 1u << r;
+                        if (stats)
+                            stats->hits++;
+                    }
+                }
+            }
+            else
+            {
+                if (stats)
+                    stats->nodesVisited++;
+
+                std::uint32_t nearIdx = node.leftFirst;
+                std::uint32_t farIdx = node.leftFirst + 1;
+                double nearEntry, farEntry;
+                std::uint32_t nearMask = boxTest(m_nodes[nearIdx], packet, mask, nearEntry);
+                std::uint32_t farMask = boxTest(m_nodes[farIdx], packet, mask, farEntry);
+                if (farEntry < nearEntry)
+                {
+                    std::swap(nearIdx, farIdx);
+                    std::swap(nearMask, farMask);
+                }
+
+                if (nearMask != 0)
+                {
+                    if (farMask != 0)
+                        stack[top++] = {farIdx, farMask};
+                    nodeIdx = nearIdx;
+                    mask = nearMask;
+                    continue;
+                }
+                if (farMask != 0)
+                {
+                    nodeIdx = farIdx;
+                    mask = farMask;
+                    continue;
+                }
+            }
+
+            // pop the next node that some ray can still reach before its current hit
+            bool found = false;
+            while (top > 0)
+            {
+                const auto [idx, rays] = stack[--top];
+                mask = boxTest(m_nodes[idx], packet, rays, minEntry);
+                if (mask != 0)
+                {
+                    nodeIdx = idx;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                break;
+        }
+
+        return hitMask;
+    }
+
+    // largest ray packet IntersectPacket accepts (4x4)
+    static constexpr std::size_t kMaxPacket = 16;
+
+private:
+    static constexpr double kMiss = std::numeric_limits<double>::infinity();
+
+    std::vector<std::uint32_t> m_triangleIds; // leaf order
+    std::vector<BVHNode> m_nodes;
+    std::size_t m_maxLeafSize;
+
+    // build-time only
+    std::vector<point> m_centroids;
+    std::size_t m_subtreeSize = 0; // nodes up to this size are left to the subtree tasks
+
+    struct Bounds
+    {
+        double lo[3] = {kMiss, kMiss, kMiss};
+        double hi[3] = {-kMiss, -kMiss, -kMiss};
+
+        void Grow(const point &p)
+        {
+            const double v[3] = {p.get_x(), p.get_y(), p.get_z()};
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], v[a]);
+                hi[a] = std::max(hi[a], v[a]);
+            }
+        }
+
+        void Grow(const Bounds &b)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], b.lo[a]);
+                hi[a] = std::max(hi[a], b.hi[a]);
+            }
+        }
+
+        double Area() const
+        {
+            if (lo[0] > hi[0])
+                return 0.0;
+            const double ex = hi[0] - lo[0], ey = hi[1] - lo[1], ez = hi[2] - lo[2];
+            return 2.0 * (ex * ey + ey * ez + ez * ex);
+        }
+    };
+
+    std::vector<Bounds> m_triangleBounds; // build-time only, box of every triangle
+
+    // parallel axes are flagged with kMiss and handled as a containment test by EntryDistance
+    static double SafeInverse(double d)
+    {
+        return std::fabs(d) > 1e-12 ? 1.0 / d : kMiss;
+    }
+
+    // Slab test; returns the entry distance or kMiss when the box is missed or lies beyond maxDist.
+    static double EntryDistance(const BVHNode &node, const double ros[3], const double inv[3], double maxDist)
+    {
+        const double lo[3] = {node.boundsMin.get_x(), node.boundsMin.get_y(), node.boundsMin.get_z()};
+        const double hi[3] = {node.boundsMax.get_x(), node.boundsMax.get_y(), node.boundsMax.get_z()};
+
+        double tEnter = 0.0;
+        double tExit = maxDist;
+        for (int a = 0; a < 3; ++a)
+        {
+            if (inv[a] == kMiss)
+            {
+                if (ros[a] < lo[a] || ros[a] > hi[a])
+                    return kMiss;
+                continue;
+            }
+            double t1 = (lo[a] - ros[a]) * inv[a];
+            double t2 = (hi[a] - ros[a]) * inv[a];
+            if (t1 > t2)
+                std::swap(t1, t2);
+            tEnter = std::max(tEnter, t1);
+            tExit = std::min(tExit, t2);
+            if (tEnter > tExit)
+                return kMiss;
+        }
+        return tEnter;
+    }
+
+    // rays of a packet in SoA form for the packet box test
+    struct RayPacket
+    {
+        alignas(32) double ox[kMaxPacket];
+        alignas(32) double oy[kMaxPacket];
+        alignas(32) double oz[kMaxPacket];
+        alignas(32) double ix[kMaxPacket]; // inverse directions, see PacketInverse
+        alignas(32) double iy[kMaxPacket];
+        alignas(32) double iz[kMaxPacket];
+        alignas(32) double best[kMaxPacket]; // current nearest hit, -1 on unused lanes
+        std::size_t count = 0;
+    };
+
+    using PacketBoxFn = std::uint32_t (*)(const BVHNode &, const RayPacket &, std::uint32_t, double &);
+
+    // A parallel axis gets a huge finite inverse instead of kMiss: the slab distances become
+    // +-huge (or 0 on the boundary), which is the same containment test as EntryDistance
+    // without the 0 * inf = NaN lanes a vector test can't branch around.
+    static double PacketInverse(double d)
+    {
+        return std::fabs(d) > 1e-12 ? 1.0 / d : 1e300;
+    }
+
+    static PacketBoxFn PacketBoxTest()
+    {
+#ifdef RAYCAST_X86
+        if (cpuFeatures::hasAVX2())
+            return &PacketBoxAVX2;
+#endif
+        return &PacketBoxScalar;
+    }
+
+    // Rays of mask that enter the node before their current hit; minEntry is the nearest entry
+    // among them (kMiss when none). Both versions evaluate the same expressions.
+    static std::uint32_t PacketBoxScalar(const BVHNode &node, const RayPacket &p, std::uint32_t mask, double &minEntry)
+    {
+        const double lo[3] = {node.boundsMin.get_x(), node.boundsMin.get_y(), node.boundsMin.get_z()};
+        const double hi[3] = {node.boundsMax.get_x(), node.boundsMax.get_y(), node.boundsMax.get_z()};
+
+        std::uint32_t result = 0;
+        minEntry = kMiss;
+        for (std::uint32_t rays = mask; rays; rays &= rays - 1)
+        {
+            const int r = cpuFeatures::lowestBit(rays);
+            const double o[3] = {p.ox[r], p.oy[r], p.oz[r]};
+            const double inv[3] = {p.ix[r], p.iy[r], p.iz[r]};
+            double tEnter = 0.0;
+            double tExit = p.best[r];
+            for (int a = 0; a < 3; ++a)
+            {
+                const double t1 = (lo[a] - o[a]) * inv[a];
+                const double t2 = (hi[a] - o[a]) * inv[a];
+                tEnter = std::max(tEnter, std::min(t1, t2));
+                tExit = std::min(tExit, std::max(t1, t2));
+            }
+            if (tEnter <= tExit)
+            {
+                result |= 1u << r;
+                minEntry = std::min(minEntry, tEnter);
+            }
+        }
+        return result;
+    }
+
+#ifdef RAYCAST_X86
+    RAYCAST_TARGET_AVX2
+    static std::uint32_t PacketBoxAVX2(const BVHNode &node, const RayPacket &p, std::uint32_t mask, double &minEntry)
+    {
+        const __m256d loX = _mm256_set1_pd(node.boundsMin.get_x());
+        const __m256d loY = _mm256_set1_pd(node.boundsMin.get_y());
+        const __m256d loZ = _mm256_set1_pd(node.boundsMin.get_z());
+        const __m256d hiX = _mm256_set1_pd(node.boundsMax.get_x());
+        const __m256d hiY = _mm256_set1_pd(node.boundsMax.get_y());
+        const __m256d hiZ = _mm256_set1_pd(node.boundsMax.get_z());
+
+        std::uint32_t result = 0;
+        minEntry = kMiss;
+        alignas(32) double enter[4];
+        for (std::size_t g = 0; g < p.count; g += 4)
+        {
+            const std::uint32_t lanes = (mask >> g) & 0xFu;
+            if (lanes == 0)
+                continue;
+
+            const __m256d ox = _mm256_load_pd(p.ox + g), oy = _mm256_load_pd(p.oy + g), oz = _mm256_load_pd(p.oz + g);
+            const __m256d ix = _mm256_load_pd(p.ix + g), iy = _mm256_load_pd(p.iy + g), iz = _mm256_load_pd(p.iz + g);
+
+            const __m256d x1 = _mm256_mul_pd(_mm256_sub_pd(loX, ox), ix), x2 = _mm256_mul_pd(_mm256_sub_pd(hiX, ox), ix);
+            const __m256d y1 = _mm256_mul_pd(_mm256_sub_pd(loY, oy), iy), y2 = _mm256_mul_pd(_mm256_sub_pd(hiY, oy), iy);
+            const __m256d z1 = _mm256_mul_pd(_mm256_sub_pd(loZ, oz), iz), z2 = _mm256_mul_pd(_mm256_sub_pd(hiZ, oz), iz);
+
+            __m256d tEnter = _mm256_max_pd(_mm256_setzero_pd(), _mm256_min_pd(x1, x2));
+            tEnter = _mm256_max_pd(tEnter, _mm256_min_pd(y1, y2));
+            tEnter = _mm256_max_pd(tEnter, _mm256_min_pd(z1, z2));
+            __m256d tExit = _mm256_min_pd(_mm256_load_pd(p.best + g), _mm256_max_pd(x1, x2));
+            tExit = _mm256_min_pd(tExit, _mm256_max_pd(y1, y2));
+            tExit = _mm256_min_pd(tExit, _mm256_max_pd(z1, z2));
+
+            std::uint32_t bits = static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(tEnter, tExit, _CMP_LE_OQ))) & lanes;
+            if (bits == 0)
+                continue;
+
+            result |= bits << g;
+            _mm256_store_pd(enter, tEnter);
+            for (; bits; bits &= bits - 1)
+                minEntry = std::min(minEntry, enter[cpuFeatures::lowestBit(bits)]);
+        }
+        return result;
+    }
+#endif
+
+    // Hits at the same distance (a ray through a shared edge) go to the lowest triangle id, so the
+    // result doesn't depend on the order the leaves are reached in (single ray vs packet).
+    static bool Closer(double t, std::uint32_t tri, double bestDist, std::size_t bestTriangle, bool hasHit)
+    {
+        return t < bestDist || (hasHit && t == bestDist && tri < bestTriangle);
+    }
+
+    // single ray walk starting at a node the ray is already known to enter
+    // hasHit tells whether outTriangle already holds a hit of this mesh at bestDist
+    bool Traverse(const triangleMesh &mesh, const rayQuery &query, const double inv[3], std::uint32_t startNode,
+                  double &bestDist, std::size_t &outTriangle, bool hasHit, traceStats *stats) const
+    {
+        const double *ros = query.origin;
+        std::pair<std::uint32_t, double> stack[kMaxDepth + 4];
+        std::size_t top = 0;
+        std::uint32_t nodeIdx = startNode;
+        bool hit = false;
+        triangleHit th;
+
+        for (;;)
+        {
+            const BVHNode &node = m_nodes[nodeIdx];
+            if (stats)
+                stats->nodesVisited++;
+
+            if (node.IsLeaf())
+            {
+                for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+                {
+                    if (stats)
+                        stats->triangleTests++;
+
+                    const std::uint32_t tri = m_triangleIds[k];
+                    if (!query.intersect(mesh, tri, th) || !Closer(th.t, tri, bestDist, outTriangle, hasHit || hit))
+                        continue;
+
+                    bestDist = th.t;
+                    outTriangle = tri;
+                    hit = true;
+                    if (stats)
+                        stats->hits++;
+                }
+            }
+            else
+            {
+                std::uint32_t nearIdx = node.leftFirst;
+                std::uint32_t farIdx = node.leftFirst + 1;
+                double nearDist = EntryDistance(m_nodes[nearIdx], ros, inv, bestDist);
+                double farDist = EntryDistance(m_nodes[farIdx], ros, inv, bestDist);
+                if (farDist < nearDist)
+                {
+                    std::swap(nearIdx, farIdx);
+                    std::swap(nearDist, farDist);
+                }
+
+                if (nearDist != kMiss)
+                {
+                    if (farDist != kMiss)
+                        stack[top++] = {farIdx, farDist};
+                    nodeIdx = nearIdx;
+                    continue;
+                }
+            }
+
+            // pop the next node that can still hold something closer than the current hit
+            bool found = false;
+            while (top > 0)
+            {
+                const auto [idx, entry] = stack[--top];
+                if (entry < bestDist)
+                {
+                    nodeIdx = idx;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                break;
+        }
+
+        return hit;
+    }
+
+    // per axis SAH bins of a triangle range, binned on the centroids
+    struct SplitBins
+    {
+        Bounds bins[3][kBins];
+        std::size_t counts[3][kBins] = {};
+
+        void Merge(const SplitBins &other)
+        {
+            for (int a = 0; a < 3; ++a)
+                for (std::size_t b = 0; b < kBins; ++b)
+                {
+                    bins[a][b].Grow(other.bins[a][b]);
+                    counts[a][b] += other.counts[a][b];
+                }
+        }
+    };
+
+    // subtree left to a worker: its root node and the depth it sits at
+    struct PendingSubtree
+    {
+        std::uint32_t node;
+        std::size_t depth;
+    };
+
+    // calls work(begin, end) on contiguous chunks of [0, count) spread over the pool
+    template <typename Work>
+    static void ParallelChunks(threadPool &pool, std::size_t count, Work &&work)
+    {
+        const std::size_t chunks = std::max<std::size_t>(1, std::min(pool.size() * 4, count / kParallelGrain));
+        pool.parallelFor(chunks, [&](std::size_t c, std::size_t)
+                         { work(c * count / chunks, (c + 1) * count / chunks); });
+    }
+
+    void Build(const triangleMesh &mesh, threadPool *pool)
+    {
+        const std::size_t n = mesh.triangleCount();
+        const bool parallel = pool && pool->size() > 1 && n >= kParallelBuild;
+
+        m_centroids.resize(n);
+        m_triangleBounds.resize(n);
+        m_triangleIds.resize(n);
+        auto prepare = [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const auto t = mesh.triangle(i);
+                m_centroids[i] = point((t[0].get_x() + t[1].get_x() + t[2].get_x()) / 3.0,
+                                       (t[0].get_y() + t[1].get_y() + t[2].get_y()) / 3.0,
+                                       (t[0].get_z() + t[1].get_z() + t[2].get_z()) / 3.0);
+                m_triangleBounds[i] = Bounds();
+                for (const point &p : t)
+                    m_triangleBounds[i].Grow(p);
+                m_triangleIds[i] = static_cast<std::uint32_t>(i);
+            }
+        };
+        if (parallel)
+            ParallelChunks(*pool, n, prepare);
+        else
+            prepare(0, n);
+
+        m_nodes.clear();
+        m_nodes.reserve(2 * n);
+        BVHNode root;
+        root.leftFirst = 0;
+        root.count = static_cast<std::uint32_t>(n);
+        m_nodes.push_back(root);
+        UpdateBounds(m_nodes, 0);
+
+        if (!parallel)
+        {
+            Subdivide(m_nodes, 0, 0, nullptr, nullptr);
+        }
+        else
+        {
+            // top of the tree here, with the binning spread over the pool, the rest as one task per subtree
+            m_subtreeSize = std::max(kParallelGrain, n / (pool->size() * 4));
+            std::vector<PendingSubtree> pending;
+            Subdivide(m_nodes, 0, 0, &pending, pool);
+
+            std::vector<std::vector<BVHNode>> subtrees(pending.size());
+            pool->parallelFor(pending.size(), [&](std::size_t k, std::size_t)
+                              {
+                std::vector<BVHNode> &local = subtrees[k];
+                local.reserve(2 * m_nodes[pending[k].node].count);
+                local.push_back(m_nodes[pending[k].node]);
+                Subdivide(local, 0, pending[k].depth, nullptr, nullptr); });
+
+            for (std::size_t k = 0; k < pending.size(); ++k)
+                Graft(pending[k].node, subtrees[k]);
+        }
+
+        m_centroids.clear();
+        m_centroids.shrink_to_fit();
+        m_triangleBounds.clear();
+        m_triangleBounds.shrink_to_fit();
+        m_nodes.shrink_to_fit();
+    }
+
+    // Replaces m_nodes[nodeIdx] by the root of a subtree built in its own array and appends the
+    // rest of it, so children still come after their parent.
+    void Graft(std::uint32_t nodeIdx, const std::vector<BVHNode> &local)
+    {
+        const std::uint32_t base = static_cast<std::uint32_t>(m_nodes.size()) - 1; // local node 1 lands at m_nodes.size()
+        auto place = [&](BVHNode node)
+        {
+            if (!node.IsLeaf())
+                node.leftFirst += base;
+            return node;
+        };
+        m_nodes[nodeIdx] = place(local[0]);
+        for (std::size_t k = 1; k < local.size(); ++k)
+            m_nodes.push_back(place(local[k]));
+    }
+
+    void UpdateBounds(std::vector<BVHNode> &nodes, std::uint32_t nodeIdx) const
+    {
+        BVHNode &node = nodes[nodeIdx];
+        Bounds b;
+        for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+            b.Grow(m_triangleBounds[m_triangleIds[k]]);
+        node.boundsMin = point(b.lo[0], b.lo[1], b.lo[2]);
+        node.boundsMax = point(b.hi[0], b.hi[1], b.hi[2]);
+    }
+
+    // extent of the centroids of the triangle ids [first, last)
+    Bounds CentroidBounds(std::uint32_t first, std::uint32_t last) const
+    {
+        Bounds b;
+        for (std::uint32_t k = first; k < last; ++k)
+            b.Grow(m_centroids[m_triangleIds[k]]);
+        return b;
+    }
+
+    // bins the triangle ids [first, last) on all three axes in one pass, axes where the
+    // centroids don't spread are left empty
+    void BinRange(std::uint32_t first, std::uint32_t last, const Bounds &centroids, SplitBins &out) const
+    {
+        double scale[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            const double extent = centroids.hi[a] - centroids.lo[a];
+            scale[a] = extent < 1e-12 ? 0.0 : static_cast<double>(kBins) / extent;
+        }
+
+        for (std::uint32_t k = first; k < last; ++k)
+        {
+            const std::uint32_t tri = m_triangleIds[k];
+            for (int a = 0; a < 3; ++a)
+            {
+                if (scale[a] == 0.0)
+                    continue;
+                std::size_t b = static_cast<std::size_t>((Axis(m_centroids[tri], a) - centroids.lo[a]) * scale[a]);
+                b = std::min(b, kBins - 1);
+                out.counts[a][b]++;
+                out.bins[a][b].Grow(m_triangleBounds[tri]);
+            }
+        }
+    }
+
+    // Binned SAH: evaluates kBins - 1 planes per axis and returns the cheapest one.
+    // With a pool the binning of a large node is split in chunks and merged, same bins.
+    double FindBestSplit(const BVHNode &node, int &bestAxis, double &bestPlane, threadPool *pool) const
+    {
+        const std::uint32_t first = node.leftFirst;
+        const std::uint32_t last = node.leftFirst + node.count;
+        Bounds centroids;
+        SplitBins split;
+
+        if (pool && node.count >= kParallelBuild)
+        {
+            const std::size_t chunks = std::min(pool->size() * 4, node.count / kParallelGrain);
+            auto chunkBegin = [&](std::size_t c)
+            { return static_cast<std::uint32_t>(first + c * node.count / chunks); };
+
+            std::vector<Bounds> partialCentroids(chunks);
+            pool->parallelFor(chunks, [&](std::size_t c, std::size_t)
+                              { partialCentroids[c] = CentroidBounds(chunkBegin(c), chunkBegin(c + 1)); });
+            for (const Bounds &b : partialCentroids)
+                centroids.Grow(b);
+
+            std::vector<SplitBins> partialBins(chunks);
+            pool->parallelFor(chunks, [&](std::size_t c, std::size_t)
+                              { BinRange(chunkBegin(c), chunkBegin(c + 1), centroids, partialBins[c]); });
+            for (const SplitBins &b : partialBins)
+                split.Merge(b);
+        }
+        else
+        {
+            centroids = CentroidBounds(first, last);
+            BinRange(first, last, centroids, split);
+        }
+
+        double bestCost = kMiss;
+        for (int a = 0; a < 3; ++a)
+        {
+            const double cMin = centroids.lo[a], cMax = centroids.hi[a];
+            if (cMax - cMin < 1e-12)
+                continue;
+
+            const Bounds *bins = split.bins[a];
+            const std::size_t *counts = split.counts[a];
+
+            // sweep: left areas/counts from the front, right ones from the back
+            double leftArea[kBins - 1], rightArea[kBins - 1];
+            std::size_t leftCount[kBins - 1], rightCount[kBins - 1];
+            Bounds leftBox, rightBox;
+            std::size_t leftSum = 0, rightSum = 0;
+            for (std::size_t i = 0; i < kBins - 1; ++i)
+            {
+                leftSum += counts[i];
+                leftCount[i] = leftSum;
+                leftBox.Grow(bins[i]);
+                leftArea[i] = leftBox.Area();
+
+                rightSum += counts[kBins - 1 - i];
+                rightCount[kBins - 2 - i] = rightSum;
+                rightBox.Grow(bins[kBins - 1 - i]);
+                rightArea[kBins - 2 - i] = rightBox.Area();
+            }
+
+            const double binWidth = (cMax - cMin) / static_cast<double>(kBins);
+            for (std::size_t i = 0; i < kBins - 1; ++i)
+            {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                const double cost = static_cast<double>(leftCount[i]) * leftArea[i] +
+                                    static_cast<double>(rightCount[i]) * rightArea[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestPlane = cMin + binWidth * static_cast<double>(i + 1);
+                }
+            }
+        }
+        return bestCost;
+    }
+
+    // Splits nodes[nodeIdx] recursively. With pending set, nodes of at most m_subtreeSize
+    // triangles are not split here but recorded for a worker.
+    void Subdivide(std::vector<BVHNode> &nodes, std::uint32_t nodeIdx, std::size_t depth,
+                   std::vector<PendingSubtree> *pending, threadPool *pool)
+    {
+        BVHNode node = nodes[nodeIdx];
+        if (node.count <= 1 || depth >= kMaxDepth)
+            return;
+        if (pending && node.count <= m_subtreeSize)
+        {
+            pending->push_back({nodeIdx, depth});
+            return;
+        }
+
+        int axis = 0;
+        double plane = 0.0;
+        const double splitCost = FindBestSplit(node, axis, plane, pool);
+
+        Bounds parent;
+        parent.Grow(node.boundsMin);
+        parent.Grow(node.boundsMax);
+        const double leafCost = static_cast<double>(node.count) * parent.Area();
+
+        if (splitCost == kMiss)
+            return; // every centroid in the same spot, nothing to separate
+        if (splitCost >= leafCost && node.count <= m_maxLeafSize)
+            return;
+
+        // partition the triangle range around the plane
+        std::uint32_t i = node.leftFirst;
+        std::uint32_t j = node.leftFirst + node.count;
+        while (i < j)
+        {
+            if (Axis(m_centroids[m_triangleIds[i]], axis) < plane)
+                ++i;
+            else
+                std::swap(m_triangleIds[i], m_triangleIds[--j]);
+        }
+
+        const std::uint32_t leftCount = i - node.leftFirst;
+        if (leftCount == 0 || leftCount == node.count)
+            return;
+
+        const std::uint32_t leftIdx = static_cast<std::uint32_t>(nodes.size());
+        BVHNode left, right;
+        left.leftFirst = node.leftFirst;
+        left.count = leftCount;
+        right.leftFirst = i;
+        right.count = node.count - leftCount;
+        nodes.push_back(left);
+        nodes.push_back(right);
+
+        nodes[nodeIdx].leftFirst = leftIdx;
+        nodes[nodeIdx].count = 0;
+
+        UpdateBounds(nodes, leftIdx);
+        UpdateBounds(nodes, leftIdx + 1);
+        Subdivide(nodes, leftIdx, depth + 1, pending, pool);
+        Subdivide(nodes, leftIdx + 1, depth + 1, pending, pool);
+    }
+
+    static double Axis(const point &p, int a)
+    {
+        return a == 0 ? p.get_x() : (a == 1 ? p.get_y() : p.get_z());
+    }
+};
@@ -9,86 +9,143 @@
 #include <iostream>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
 #include "ray.h"
 #include "object.h"
+#include "sceneView.h"
 #include "point.h"
+#include "traceStats.h"
+#include "triangleIntersection.h"
+#include "rayCaster.h"
+#include "renderProfile.h"
 #include <optional>
 using namespace std;
 
+// pixel rectangle [x0, x1) x [y0, y1) of a camera, x along the width and y along the height
+struct tile
+{
+    unsigned int x0, y0, x1, y1;
+};
+
+/**
+ * @struct rayModel
+ * @brief Compact description of a camera's primary rays: at(i, j) rebuilds the ray of row i,
+ * column j with the same operations the stored grid was filled with, so both modes trace
+ * identical rays. Fractional i, j land between the pixels (the anti-aliasing samples).
+ *
+ * Orthographic: origins on the plane origin + yd * i * step + xd * j * step, all along rd.
+ * Perspective:  each ray is aimed at the matching point of a far plane of step sStep,
+ *               recentered on the center pixel and pushed back by force along rd.
+ */
+struct rayModel
+{
+    point origin;
+    vec3 xd, yd, rd; // unit axes along the width, the height and the view
+    double step = 1;
+    bool perspective = false;
+    double sStep = 1; // far plane spacing
+    vec3 shift;       // far plane recentering
+    double force = 0; // far plane distance along rd
+    vec3 offset;      // moves every origin, set by camera::recenterTo
+
+    rayModel() = default;
+
+    rayModel(unsigned int h, unsigned int w, double step, point origin, vec3 xDir, vec3 yDir, vec3 rayDir,
+             double perspectiveScale, double perspectiveForce)
+        : origin(origin), xd(gmath::normalize(xDir)), yd(gmath::normalize(yDir)), rd(gmath::normalize(rayDir)), step(step),
+          perspective(perspectiveScale > 1.0 && perspectiveForce != 0.0), sStep(step * perspectiveScale), force(perspectiveForce)
+    {
+        // the far plane is moved so both planes share the same center pixel
+        if (perspective)
+            shift = plane(h / 2, w / 2, step) - plane(h / 2, w / 2, sStep);
+    }
+
+    ray at(double i, double j) const
+    {
+        const point p = plane(i, j, step);
+        if (!perspective)
+            return ray(p + offset, rd);
+        point far = plane(i, j, sStep) + shift;
+        far = far + rd * force;
+        return ray(p + offset, gmath::normalize(far - p));
+    }
+
+    point plane(double i, double j, double spacing) const
+    {
+        const point row = origin + yd * (i * spacing);
+        return row + xd * (j * spacing);
+    }
+};
+
+/**
+ * @struct adaptiveSampling
+ * @brief Settings of a camera's adaptive anti-aliasing. After the render with one ray per pixel,
+ * the pixels that differ from a neighbour (another object or none, or a channel gap above
+ * contrast) get 4 jittered samples; the ones whose 4 samples still disagree (several objects,
+ * or a channel variance above variance) get maxSamples. Each refined pixel is the mean of its samples.
+ * Triangles are shaded flat, so a seam between two triangles of one object only shows, and is
+ * only refined, through the color gap.
+ */
+struct adaptiveSampling
+{
+    unsigned int maxSamples = 1; // 1 turns anti-aliasing off, otherwise 4 or 16
+    double contrast = 16;        // channel gap (0-255) with a neighbour that marks an edge
+    double variance = 64;        // channel variance of the first 4 samples that asks for maxSamples
+
+    bool enabled() const { return maxSamples > 1; }
+};
+
 class camera
 {
 private:
+    // stored mode: one ray per pixel, row by row; empty for an analytic camera
     vector<vector<ray>> gridRay;
+    // analytic mode: the rays are generated from the model when traced, nothing per pixel
+    bool analytic = false;
+    rayModel model;
+    // nearest hit of every pixel over successive cameraToImage calls of an analytic camera
+    // (a stored camera keeps it in its rays); allocated by the first call
+    vector<double> depth;
     unsigned int width;
     unsigned int height;
     color defaultColor;
     image img;
-
-    /**
-     * @brief Unified grid builder. Handles both orthographic and perspective.
-     *
-     * Orthographic mode:  perspectiveScale <= 1  OR  perspectiveForce == 0
-     * Perspective mode:   perspectiveScale >  1  AND perspectiveForce != 0
-     */
-    void constructRay(unsigned int h, unsigned int w, double step, point origin,
-                      vec3 xDir, vec3 yDir, vec3 rayDir,
-                      double perspectiveScale, double perspectiveForce)
+    traceStats stats;
+    rayCaster caster; // triangle kernel and mailboxing of the nearest-hit queries
+    unsigned int packetSize = 1; // side of the square ray packets, 1 traces single rays
+
+    // anti-aliasing only, empty otherwise: the index of the object each pixel shows after the
+    // primary rays (kNoObject on a miss) and the samples it ended with. Indices rather than views,
+    // the sceneView of a render is gone once it returns.
+    static constexpr std::uint32_t kNoObject = 0xffffffffu;
+    adaptiveSampling antialiasing;
+    vector<std::uint32_t> pixelObjects;
+    vector<std::uint8_t> sampleCounts;
+
+    static constexpr unsigned int kMaxSamples = 16;
+
+#ifdef RAYCAST_PROFILE
+    // work of every pixel in the last render through renderTile / refineTile
+    costMap costs;
+#endif
+
+    // nearest distance already found for pixel (i, j) whose ray is r
+    double hitDistance(unsigned int i, unsigned int j, const ray &r) const
     {
-        vec3 xd = gmath::normalize(xDir);
-        vec3 yd = gmath::normalize(yDir);
-        vec3 rd = gmath::normalize(rayDir);
-
-        // 1. Build base orthographic grid (near plane)
-        for (unsigned i = 0; i < h; ++i)
-        {
-            point row = origin + yd * (i * step);
-            for (unsigned j = 0; j < w; ++j)
-            {
-                point p = row + xd * (j * step);
-                gridRay[i][j] = ray(p, rd);
-            }
-        }
-
-        // 2. If perspective requested, converge rays toward a far plane
-        if (perspectiveScale > 1.0 && perspectiveForce != 0.0)
-        {
-            double sStep = step * perspectiveScale;
-
-            // Build scaled (far) plane origins
-            vector<vector<point>> scaled(h, vector<point>(w));
-            for (unsigned i = 0; i < h; ++i)
-            {
-                point row = origin + yd * (i * sStep);
-                for (unsigned j = 0; j < w; ++j)
-                {
-                    scaled[i][j] = row + xd * (j * sStep);
-                }
-            }
-
-            // Recenter scaled plane so both share the same center pixel
-            point cBase = gridRay[h / 2][w / 2].getOrigine();
-            point cScale = scaled[h / 2][w / 2];
-            vec3 shift = cBase - cScale;
-
-            for (unsigned i = 0; i < h; ++i)
-                for (unsigned j = 0; j < w; ++j)
-                    scaled[i][j] = scaled[i][j] + shift;
-
-            // Push far plane back along view direction
-            for (unsigned i = 0; i < h; ++i)
-                for (unsigned j = 0; j < w; ++j)
-                    scaled[i][j] = scaled[i][j] + rd * perspectiveForce;
+        if (analytic)
+            return depth.empty() ? std::numeric_limits<double>::infinity() : depth[static_cast<std::size_t>(i) * width + j];
+        return r.hasLastHit() ? r.getLastHitDistance() : std::numeric_limits<double>::infinity();
+    }
 
-            // Redirect each ray toward its corresponding far-plane point
-            for (unsigned i = 0; i < h; ++i)
-            {
-                for (unsigned j = 0; j < w; ++j)
-                {
-                    vec3 newDir = gmath::normalize(scaled[i][j] - gridRay[i][j].getOrigine());
-                    gridRay[i][j] = ray(gridRay[i][j].getOrigine(), newDir);
-                }
-            }
-        }
+    void recordHit(unsigned int i, unsigned int j, double distance)
+    {
+        if (!analytic)
+            gridRay[i][j].setLastHitDistance(distance);
+        else if (!depth.empty())
+            depth[static_cast<std::size_t>(i) * width + j] = distance;
     }
 
 public:
@@ -116,6 +173,8 @@ public:
      * @param rayDir           Base ray direction (view axis)
      * @param perspectiveScale Multiplier for step on the far plane (>1 = perspective)
      * @param perspectiveForce Distance to push the far plane along rayDir
+     * @param generation       analytic computes each ray when it is traced (no memory per
+     *                         pixel), stored fills the ray grid up front
      */
     camera(int h, int w,
            double step = 1.0,
@@ -124,7 +183,8 @@ public:
            vec3 yDir = vec3(0, 1, 0),
            vec3 rayDir = vec3(0, 0, -1),
            double perspectiveScale = 1.0,
-           double perspectiveForce = 0.0)
+           double perspectiveForce = 0.0,
+           rayGeneration generation = rayGeneration::analytic)
     {
         if (w <= 0 || h <= 0 || step <= 0)
         {
@@ -134,13 +194,17 @@ public:
         width = static_cast<unsigned int>(w);
         height = static_cast<unsigned int>(h);
 
-        gridRay.resize(height, vector<ray>(width));
-
-        constructRay(height, width, step, origin,
-                     xDir, yDir, rayDir,
-                     perspectiveScale, perspectiveForce);
+        model = rayModel(height, width, step, origin, xDir, yDir, rayDir, perspectiveScale, perspectiveForce);
+        analytic = generation == rayGeneration::analytic;
+        if (!analytic)
+        {
+            gridRay.resize(height, vector<ray>(width));
+            for (unsigned i = 0; i < height; ++i)
+                for (unsigned j = 0; j < width; ++j)
+                    gridRay[i][j] = model.at(i, j);
+        }
 
-        img = image(width, height);
+        img = image(height, width);
     }
 
     // Constructor from an existing ray grid
@@ -149,7 +213,7 @@ public:
           width(static_cast<unsigned int>(w)),
           height(static_cast<unsigned int>(h)),
           defaultColor(),
-          img(image(w, h))
+          img(image(h, w))
     {
         if (w <= 0 || h <= 0)
             throw std::invalid_argument("Camera width and height must be positive");
@@ -171,6 +235,12 @@ public:
             desiredCenter.get_y() - currentCenter.get_y(),
             desiredCenter.get_z() - currentCenter.get_z());
 
+        if (analytic)
+        {
+            model.offset = model.offset + offset;
+            return;
+        }
+
         for (unsigned i = 0; i < height; ++i)
         {
             for (unsigned j = 0; j < width; ++j)
@@ -195,10 +265,81 @@ public:
 
     unsigned int getwidth() const { return width; }
     unsigned int getheight() const { return height; }
-    image getimage() const { return img; }
+    const image &getimage() const { return img; }
+    const traceStats &getStats() const { return stats; }
+    void clearStats() { stats.clear(); }
+    triangleTest getTriangleTest() const { return caster.mode; }
+    void setTriangleTest(triangleTest mode) { caster.mode = mode; }
+    unsigned int getPacketSize() const { return packetSize; }
+    bool getMailboxing() const { return caster.mailboxing; }
+    void setMailboxing(bool enabled) { caster.mailboxing = enabled; }
+
+    // 2 traces 2x2 packets and 4 traces 4x4 packets, 1 goes back to single rays
+    void setPacketSize(unsigned int size)
+    {
+        if (size == 0 || size * size > boundingVolumeHierarchy::kMaxPacket)
+            throw std::invalid_argument("Camera::setPacketSize(): packet side must be between 1 and 4");
+        packetSize = size;
+    }
+
+    // Anti-aliasing of the next renders (see adaptiveSampling); sub-pixel rays need an analytic
+    // camera. Also forgets the pixel objects and sample counts of the previous render.
+    void setAntialiasing(const adaptiveSampling &settings)
+    {
+        if (settings.maxSamples != 1 && settings.maxSamples != 4 && settings.maxSamples != kMaxSamples)
+            throw std::invalid_argument("Camera::setAntialiasing(): maxSamples must be 1, 4 or 16");
+        if (settings.enabled() && !analytic)
+            throw std::logic_error("Camera::setAntialiasing(): sub-pixel samples need an analytic camera");
+
+        antialiasing = settings;
+        const std::size_t pixels = settings.enabled() ? static_cast<std::size_t>(width) * height : 0;
+        pixelObjects.assign(pixels, kNoObject);
+        sampleCounts.assign(pixels, 1);
+        if (!settings.enabled())
+        {
+            pixelObjects.shrink_to_fit();
+            sampleCounts.shrink_to_fit();
+        }
+    }
+    const adaptiveSampling &getAntialiasing() const { return antialiasing; }
+
+    // samples of every pixel in the last anti-aliased render as gray levels, black for 1 sample
+    // and white for 16 (all black when anti-aliasing is off)
+    image sampleCountImage() const
+    {
+        image counts(height, width);
+        for (unsigned i = 0; i < height && !sampleCounts.empty(); ++i)
+        {
+            for (unsigned j = 0; j < width; ++j)
+            {
+                const double level = 255.0 * (sampleCounts[static_cast<std::size_t>(i) * width + j] - 1) / (kMaxSamples - 1);
+                counts.set(i, j, color(level, level, level));
+            }
+        }
+        return counts;
+    }
+
+#ifdef RAYCAST_PROFILE
+    // per-pixel counters, cleared before each render (profiling builds only)
+    const costMap &getCostMap() const { return costs; }
+    void resetCostMap() { costs.reset(width, height); }
+#endif
 
-    vector<vector<ray>> getGridRay() { return gridRay; }
+    // the stored rays, empty for an analytic camera (use get())
+    const vector<vector<ray>> &getGridRay() const { return gridRay; }
+    bool isAnalytic() const { return analytic; }
+    const rayModel &getRayModel() const { return model; }
 
+    // heap bytes held for the primary rays: the stored grid, or the depth of an analytic camera
+    std::size_t rayBytes() const
+    {
+        std::size_t bytes = gridRay.capacity() * sizeof(vector<ray>) + depth.capacity() * sizeof(double);
+        for (const auto &row : gridRay)
+            bytes += row.capacity() * sizeof(ray);
+        return bytes;
+    }
+
+    // ray of column x, row y, generated on the fly by an analytic camera
     ray get(unsigned int x, unsigned int y) const
     {
         if (constrain(x, y))
@@ -207,7 +348,7 @@ public:
                 "Camera::get(): out of bounds. x: " + to_string(x) +
                 " | y: " + to_string(y));
         }
-        return gridRay[y][x];
+        return primaryRay(y, x);
     }
 
     void set(unsigned int x, unsigned int y, const ray &r)
@@ -218,6 +359,8 @@ public:
                 "Camera::set(): out of bounds. x: " + to_string(x) +
                 " | y: " + to_string(y));
         }
+        if (analytic)
+            throw std::logic_error("Camera::set(): an analytic camera has no stored ray, use setRay() for a custom grid");
         gridRay[y][x] = r;
     }
 
@@ -232,14 +375,29 @@ public:
         img.set(x, y, c);
     }
 
-    void setRay(vector<vector<ray>> g) { gridRay = std::move(g); }
+    // switches to a custom grid of stored rays
+    void setRay(vector<vector<ray>> g)
+    {
+        gridRay = std::move(g);
+        analytic = false;
+        depth.clear();
+        depth.shrink_to_fit();
+    }
     void setDefaultColor(const color &c) { defaultColor = c; }
 
+    // forgets the nearest hits of earlier renders (the depth of an analytic camera, the last hit of
+    // the stored rays), so the next render accepts every surface again
+    void resetDepth()
+    {
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<double>::infinity());
+        for (vector<ray> &row : gridRay)
+            for (ray &r : row)
+                r.clearLastHitDistance();
+    }
+
     void clear()
     {
-        for (unsigned i = 0; i < height; ++i)
-            for (unsigned j = 0; j < width; ++j)
-                img.set(i, j, defaultColor);
+        img.fill(defaultColor);
     }
 
     bool constrain(unsigned int x, unsigned int y) const
@@ -252,8 +410,10 @@ public:
         // Stub: original implementation was incomplete
         width = new_width;
         height = new_height;
-        gridRay.resize(height, vector<ray>(width));
-        img = image(width, height);
+        if (!analytic)
+            gridRay.resize(height, vector<ray>(width));
+        depth.clear();
+        img = image(height, width);
     }
 
     /* --------------------------------------------------------------
@@ -267,7 +427,7 @@ public:
         for (unsigned i = 0; i < c.getheight(); ++i)
         {
             for (unsigned j = 0; j < c.getwidth(); ++j)
-                os << c.gridRay[i][j] << " | ";
+                os << c.get(j, i) << " | ";
             os << "\n";
         }
         return os;
@@ -279,7 +439,7 @@ public:
             return false;
         for (unsigned i = 0; i < height; ++i)
             for (unsigned j = 0; j < width; ++j)
-                if (gridRay[i][j] != other.gridRay[i][j])
+                if (get(j, i) != other.get(j, i))
                     return false;
         return true;
     }
@@ -290,224 +450,408 @@ public:
        Rendering
        -------------------------------------------------------------- */
 
-    // In cameraToImage:
-    void cameraToImage(const object &obj)
+    // traces every pixel of the camera against one object
+    void cameraToImage(const object &o)
     {
-        for (unsigned i = 0; i < height; ++i)
+        const objectView obj(o);
+        if (analytic && depth.empty())
+            depth.assign(static_cast<std::size_t>(width) * height, std::numeric_limits<double>::infinity());
+        for (unsigned i = 0; i < height; i += packetSize)
         {
-            for (unsigned j = 0; j < width; ++j)
+            for (unsigned j = 0; j < width; j += packetSize)
             {
-                auto &ray = gridRay[i][j];
+                tracePacket(i, j, std::min(packetSize, height - i), std::min(packetSize, width - j), obj, stats);
+            }
+        }
+    }
 
-                if (!gmath::intersectRaySphere(ray, obj.center, obj.sphereRadius))
-                    continue;
+    // traces the pixels of one tile through the top-level hierarchy of the scene, the tile is the
+    // unit of work of the thread pool
+    void renderTile(const sceneView &scene, const tile &t, traceStats &counters)
+    {
+        for (unsigned i = t.y0; i < t.y1; i += packetSize)
+        {
+            for (unsigned j = t.x0; j < t.x1; j += packetSize)
+            {
+                const unsigned int rows = std::min(packetSize, t.y1 - i);
+                const unsigned int cols = std::min(packetSize, t.x1 - j);
+#ifdef RAYCAST_PROFILE
+                const traceStats before = counters;
+                tracePacket(i, j, rows, cols, scene, counters);
+                costs.add(i, j, rows, cols, before, counters);
+#else
+                tracePacket(i, j, rows, cols, scene, counters);
+#endif
+            }
+        }
+    }
 
-                double bestDist = ray.hasLastHit() ? ray.getLastHitDistance() : std::numeric_limits<double>::infinity();
+    // Progressive rendering: pass 0 traces every kCoarseStride-th pixel of every kCoarseStride-th
+    // row, each following pass halves the stride and traces the pixels it adds, the last one at 1.
+    static constexpr unsigned int kCoarseStride = 8;
+    static constexpr unsigned int kProgressivePasses = 4;
 
-                if (!obj.boundingGrid)
-                {
-                    bool hit = getPixelColor(i, j, obj, ray, bestDist);
-                    if (hit)
-                        ray.setLastHitDistance(bestDist);
+    // pixel spacing of progressive pass `pass`
+    static unsigned int passStride(unsigned int pass) { return kCoarseStride >> pass; }
+
+    // Traces the pixels of tile t that progressive pass `pass` adds, each one spread over the
+    // stride x stride block below and right of it until a finer pass replaces the rest of the block.
+    // The blocks of a pass don't overlap and never cover a pixel an earlier pass traced, so tiles
+    // can run concurrently. Returns the number of pixels traced.
+    std::size_t renderPassTile(const sceneView &scene, const tile &t, unsigned int pass, traceStats &counters)
+    {
+        const unsigned int stride = passStride(pass);
+        const unsigned int i0 = (t.y0 + stride - 1) / stride * stride;
+        const unsigned int j0 = (t.x0 + stride - 1) / stride * stride;
+        std::size_t traced = 0;
+        for (unsigned i = i0; i < t.y1; i += stride)
+        {
+            for (unsigned j = j0; j < t.x1; j += stride)
+            {
+                // already traced by the pass of twice the stride
+                if (pass > 0 && i % (2 * stride) == 0 && j % (2 * stride) == 0)
                     continue;
-                }
 
-                const auto &grid = *obj.boundingGrid;
+                // a miss leaves the background, not the block of the coarser pass
+                img.set(i, j, defaultColor);
+                tracePixel(i, j, scene, counters);
+                ++traced;
 
-                const auto visitedCubes = grid.TraverseRay(ray.getOrigine(), ray.getDirection());
-                bool hit = false;
-                for (const auto &[idx, cubeDist] : visitedCubes)
+                const color c = img.get(i, j);
+                const unsigned int blockEnd = std::min(j + stride, width);
+                for (unsigned bi = i; bi < std::min(i + stride, height); ++bi)
                 {
-                    if (cubeDist > bestDist)
-                        break;
-
-                    const auto &entry = grid.At(idx);
-                    if (entry.data.triples.empty())
-                        continue;
-
-                    hit = getPixelColor(i, j, obj, entry.data.triples, ray, bestDist) || hit;
+                    const rowSpan<color> row = img.row(bi);
+                    std::fill(row.begin() + j, row.begin() + blockEnd, c);
                 }
-
-                if (hit)
-                    ray.setLastHitDistance(bestDist);
             }
         }
+        return traced;
     }
 
-    /* --------------------------------------------------------------
-       Pixel helpers (private implementation)
-       -------------------------------------------------------------- */
-
-    // No-grid, full-object version that shares bestDist with the caller
-    bool getPixelColor(
-        unsigned int i,
-        unsigned int j,
-        object obj,
-        ray r1,
-        double &bestDist,
-        bool combine = false)
+    // Anti-aliasing, first step once every tile has its primary rays: flags the pixels of tile t
+    // that differ from a neighbour (sample count 0 until refineTile). Only reads the image, so
+    // all tiles are marked before any is refined.
+    void markEdges(const tile &t)
     {
-        bool hasTexture = !obj.tex.empty();
-        bool hit = false;
-
-        for (auto const &x : obj.colorMap)
+        const image &pixels = img;
+        for (unsigned i = t.y0; i < t.y1; ++i)
         {
-            std::array<point, 3> tri = {x.first[0], x.first[1], x.first[2]};
+            const rowSpan<const color> row = pixels.row(i);
+            const rowSpan<const color> above = i > 0 ? pixels.row(i - 1) : row;
+            const rowSpan<const color> below = i + 1 < height ? pixels.row(i + 1) : row;
+            for (unsigned j = t.x0; j < t.x1; ++j)
+            {
+                const std::size_t p = static_cast<std::size_t>(i) * width + j;
+                const bool edge = (i > 0 && differs(p, row[j], p - width, above[j])) ||
+                                  (i + 1 < height && differs(p, row[j], p + width, below[j])) ||
+                                  (j > 0 && differs(p, row[j], p - 1, row[j - 1])) ||
+                                  (j + 1 < width && differs(p, row[j], p + 1, row[j + 1]));
+                sampleCounts[p] = edge ? 0 : 1;
+            }
+        }
+    }
 
-            std::optional<point> val = gmath::intersectRayTriangle(r1, tri.data());
-            if (!val)
-                continue;
+    // Anti-aliasing, second step: the flagged pixels of tile t get 4 samples, then maxSamples when
+    // those disagree, and become their mean. Returns the samples traced.
+    std::size_t refineTile(const sceneView &scene, const tile &t, traceStats &counters)
+    {
+        std::size_t traced = 0;
+        for (unsigned i = t.y0; i < t.y1; ++i)
+        {
+            for (unsigned j = t.x0; j < t.x1; ++j)
+            {
+                std::uint8_t &count = sampleCounts[static_cast<std::size_t>(i) * width + j];
+                if (count != 0)
+                    continue;
+#ifdef RAYCAST_PROFILE
+                const traceStats before = counters;
+#endif
+
+                double sum[3] = {0, 0, 0}, squares[3] = {0, 0, 0};
+                const objectView *first = nullptr;
+                bool mixed = false;
+                unsigned int n = 0;
+                auto take = [&](unsigned int k)
+                {
+                    const objectView *hit = nullptr;
+                    const color c = samplePixel(i, j, k, scene, hit, counters);
+                    if (n == 0)
+                        first = hit;
+                    else if (hit != first)
+                        mixed = true;
+                    const double channels[3] = {c.x(), c.y(), c.z()};
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        sum[a] += channels[a];
+                        squares[a] += channels[a] * channels[a];
+                    }
+                    ++n;
+                };
+
+                for (unsigned int k = 0; k < 4; ++k)
+                    take(k);
+                double spread = 0;
+                for (int a = 0; a < 3; ++a)
+                    spread = std::max(spread, squares[a] / n - (sum[a] / n) * (sum[a] / n));
+                if (antialiasing.maxSamples > 4 && (mixed || spread > antialiasing.variance))
+                {
+                    for (unsigned int k = 4; k < antialiasing.maxSamples; ++k)
+                        take(k);
+                }
 
-            double d = gmath::distance(r1.getOrigine(), *val);
-            if (d >= bestDist)
-                continue;
+                img.set(i, j, color(sum[0] / n, sum[1] / n, sum[2] / n));
+                count = static_cast<std::uint8_t>(n);
+                traced += n;
+#ifdef RAYCAST_PROFILE
+                costs.add(i, j, 1, 1, before, counters);
+#endif
+            }
+        }
+        return traced;
+    }
 
-            hit = true;
-            bestDist = d;
+    // cuts the image into square tiles of tileSize pixels (smaller on the right/bottom border)
+    vector<tile> makeTiles(unsigned int tileSize) const
+    {
+        if (tileSize == 0)
+            throw std::invalid_argument("Camera::makeTiles(): tile size must be positive");
 
-            if (hasTexture)
-            {
-                color texel = obj.tex.get(i, j);
-                img.set(i, j, combine ? (x.second / 10 + texel / 2) : texel);
-            }
-            else
+        vector<tile> tiles;
+        for (unsigned y = 0; y < height; y += tileSize)
+        {
+            for (unsigned x = 0; x < width; x += tileSize)
             {
-                img.set(i, j, x.second);
+                tiles.push_back({x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)});
             }
         }
-
-        return hit;
+        return tiles;
     }
 
-    // Grid-cell version (already correct)
-    bool getPixelColor(
-        unsigned int i,
-        unsigned int j,
-        object obj,
-        const std::vector<std::array<point, 3>> &tris,
-        ray r1,
-        double &bestDist,
-        bool combine = false)
+    // Traces the rows x columns pixels starting at (i0, j0) against one object and keeps their
+    // nearest hit for the next object.
+    void tracePacket(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols,
+                     const objectView &obj, traceStats &counters)
     {
-        bool hasTexture = !obj.tex.empty();
-        bool hit = false;
+        ray rays[boundingVolumeHierarchy::kMaxPacket];
+        double bestDist[boundingVolumeHierarchy::kMaxPacket];
+        const std::size_t n = loadPacket(i0, j0, rows, cols, rays, bestDist);
+        double previous[boundingVolumeHierarchy::kMaxPacket];
+        std::copy(bestDist, bestDist + n, previous);
+
+        tracePacket(i0, j0, rows, cols, obj, rays, bestDist, counters);
+        storePacket(i0, j0, rows, cols, previous, bestDist);
+    }
 
-        for (const auto &tri : tris)
+    // Same block against the whole scene: the packet walks the top-level hierarchy once and every
+    // object it reaches is traced with the packet version below.
+    void tracePacket(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols,
+                     const sceneView &scene, traceStats &counters)
+    {
+        if (rows * cols <= 1)
         {
-            std::optional<point> val = gmath::intersectRayTriangle(r1, tri.data());
-            if (!val)
-                continue;
-
-            double d = gmath::distance(r1.getOrigine(), *val);
-            if (d >= bestDist)
-                continue;
+            for (unsigned i = i0; i < i0 + rows; ++i)
+                for (unsigned j = j0; j < j0 + cols; ++j)
+                    tracePixel(i, j, scene, counters);
+            return;
+        }
 
-            hit = true;
-            bestDist = d;
+        constexpr std::size_t kMax = sceneHierarchy::kMaxPacket;
+        ray rays[kMax];
+        double bestDist[kMax], previous[kMax];
+        const std::size_t n = loadPacket(i0, j0, rows, cols, rays, bestDist);
+        std::copy(bestDist, bestDist + n, previous);
+        const ray *pointers[kMax];
+        for (std::size_t k = 0; k < n; ++k)
+            pointers[k] = &rays[k];
+
+        scene.hierarchy().VisitPacket(pointers, n, bestDist, [&](std::size_t index)
+                                      { tracePacket(i0, j0, rows, cols, scene[index], rays, bestDist, counters); }, &counters);
+        storePacket(i0, j0, rows, cols, previous, bestDist);
+    }
 
-            if (hasTexture)
-            {
-                color texel = obj.tex.get(i, j);
-                img.set(i, j, combine ? (obj.colorMap.at(tri) / 10 + texel / 2) : texel);
-            }
-            else
-            {
-                 img.set(i, j, obj.colorMap.at(tri));
+    // row i, column j; keeps the nearest hit over successive objects
+    void tracePixel(unsigned int i, unsigned int j, const objectView &obj, traceStats &counters)
+    {
+        const ray r = primaryRay(i, j);
+        double bestDist = hitDistance(i, j, r);
+        if (tracePixel(i, j, obj, r, bestDist, counters))
+            recordHit(i, j, bestDist);
+    }
 
+    // row i, column j against the whole scene: one nearest-hit query through the top-level
+    // hierarchy, the pixel is written once with the winner
+    void tracePixel(unsigned int i, unsigned int j, const sceneView &scene, traceStats &counters)
+    {
+        const ray r = primaryRay(i, j);
 
-                /*
-                vec3 n = gmath::normalVector(tri[0], tri[1], tri[2]);
-                color c(0, 0, 0);
-                gmath::normalOrientationColor(n, c);
-                img.set(i, j, c);
-                */
-            }
-        }
+        double bestDist = hitDistance(i, j, r);
+        std::size_t nearestTri = 0;
+        const objectView *nearest = caster.intersectScene(r, scene, bestDist, nearestTri, counters);
+        if (!nearest)
+            return;
 
-        return hit;
+        recordHit(i, j, bestDist);
+        shadePixel(i, j, *nearest, nearestTri, false);
     }
+
     /* --------------------------------------------------------------
-       Split / Merge
+       Pixel helpers (private implementation)
        -------------------------------------------------------------- */
 
-public:
-    vector<camera> splitCamera(camera &c, const size_t split)
+    // primary ray of row i, column j
+    ray primaryRay(unsigned int i, unsigned int j) const
+    {
+        return analytic ? model.at(i, j) : gridRay[i][j];
+    }
+
+    // the rays and nearest distances of a block of pixels, row by row; returns their count
+    std::size_t loadPacket(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols, ray *rays, double *bestDist) const
     {
-        if (split <= 1 || c.getheight() == 0 || c.getwidth() == 0)
-            return {camera()};
+        std::size_t n = 0;
+        for (unsigned i = i0; i < i0 + rows; ++i)
+        {
+            for (unsigned j = j0; j < j0 + cols; ++j, ++n)
+            {
+                rays[n] = primaryRay(i, j);
+                bestDist[n] = hitDistance(i, j, rays[n]);
+            }
+        }
+        return n;
+    }
 
-        size_t total = c.getheight() * c.getwidth();
-        if (total <= split)
-            return {camera()};
+    // keeps the distances of the pixels of the block that found a nearer hit
+    void storePacket(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols, const double *previous, const double *bestDist)
+    {
+        std::size_t n = 0;
+        for (unsigned i = i0; i < i0 + rows; ++i)
+            for (unsigned j = j0; j < j0 + cols; ++j, ++n)
+                if (bestDist[n] < previous[n])
+                    recordHit(i, j, bestDist[n]);
+    }
 
-        vector<ray> linear;
-        linear.reserve(total);
-        for (auto const &row : c.gridRay)
-            linear.insert(linear.end(), row.begin(), row.end());
+    // Traces a block of pixels against one object, rays and bestDist holding the ray and the
+    // nearest distance of each pixel row by row. BVH objects are traced as one packet, everything
+    // else (and a packet of 1) falls back to single rays. Pixels hit nearer are shaded and their
+    // bestDist lowered.
+    void tracePacket(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols,
+                     const objectView &obj, const ray *rays, double *bestDist, traceStats &counters)
+    {
+        if (rows * cols <= 1 || obj.accel != acceleration::bvh || !obj.bvh)
+        {
+            std::size_t k = 0;
+            for (unsigned i = i0; i < i0 + rows; ++i)
+                for (unsigned j = j0; j < j0 + cols; ++j, ++k)
+                    tracePixel(i, j, obj, rays[k], bestDist[k], counters);
+            return;
+        }
 
-        size_t chunk = linear.size() / split;
-        if (chunk == 0)
-            return {camera()};
+        constexpr std::size_t kMax = boundingVolumeHierarchy::kMaxPacket;
+        rayQuery queries[kMax];
+        double localDist[kMax];
+        double scales[kMax]; // world to object distance, 1 unless obj is an instance
+        std::size_t triangles[kMax];
+        unsigned int rowOf[kMax], colOf[kMax];
+        std::size_t pixelOf[kMax];
+        std::size_t n = 0, k = 0;
 
-        vector<vector<ray>> splits;
-        vector<ray> temp;
-        for (size_t i = 0; i < linear.size(); ++i)
+        for (unsigned i = i0; i < i0 + rows; ++i)
         {
-            if (temp.size() >= chunk && splits.size() < split - 1)
+            for (unsigned j = j0; j < j0 + cols; ++j, ++k)
             {
-                splits.push_back(std::move(temp));
-                temp.clear();
+                const ray &r = rays[k];
+                if (!gmath::intersectRaySphere(r, obj.center, obj.radius))
+                    continue;
+
+                queries[n] = rayQuery(obj.localRay(r, scales[n]), caster.mode);
+                localDist[n] = bestDist[k] * scales[n];
+                rowOf[n] = i;
+                colOf[n] = j;
+                pixelOf[n] = k;
+                n++;
             }
-            temp.push_back(linear[i]);
         }
-        if (!temp.empty())
-            splits.push_back(std::move(temp));
+        if (n == 0)
+            return;
 
-        vector<camera> group;
-        for (auto &chunkRays : splits)
+        std::uint32_t hits = obj.bvh->IntersectPacket(*obj.mesh, queries, n, localDist, triangles, &counters);
+        for (std::size_t q = 0; hits; ++q, hits >>= 1)
         {
-            camera cam;
-            cam.width = static_cast<unsigned int>(chunkRays.size());
-            cam.height = 1;
-            cam.setRay({std::move(chunkRays)});
-            cam.img = image(cam.height, cam.width);
-            group.push_back(std::move(cam));
+            if ((hits & 1u) == 0)
+                continue;
+            bestDist[pixelOf[q]] = localDist[q] / scales[q];
+            shadePixel(rowOf[q], colOf[q], obj, triangles[q], false);
         }
-        return group;
     }
 
-    image construct_split(vector<camera> v, size_t h, size_t w)
+    // one pixel against one object; shades it and lowers bestDist on a nearer hit
+    bool tracePixel(unsigned int i, unsigned int j, const objectView &obj, const ray &r, double &bestDist, traceStats &counters)
     {
-        vector<color> linear;
-        for (auto const &cam : v)
-        {
-            auto px = cam.getimage().getPixels();
-            if (px.size() != 1)
-            {
-                cout << "this can only construct linear images" << endl;
-                return image();
-            }
-            linear.insert(linear.end(), px[0].begin(), px[0].end());
-        }
+        if (!gmath::intersectRaySphere(r, obj.center, obj.radius))
+            return false;
+
+        std::size_t tri = 0;
+        if (!caster.intersectObject(r, obj, bestDist, tri, counters))
+            return false;
+
+        shadePixel(i, j, obj, tri, false);
+        return true;
+    }
 
-        vector<vector<color>> finalImg;
-        vector<color> row;
-        for (auto const &c : linear)
+    // color of triangle tri (or the texture) at pixel (i, j)
+    color shade(unsigned int i, unsigned int j, const objectView &obj, std::size_t tri, bool combine) const
+    {
+        const color &c = obj.triangleColor(tri);
+        if (obj.hasTexture())
         {
-            if (row.size() >= w)
-            {
-                finalImg.push_back(std::move(row));
-                row.clear();
-            }
-            row.push_back(c);
+            const color &texel = obj.tex->get(i, j);
+            return combine ? (c / 10 + texel / 2) : texel;
         }
-        if (!row.empty())
-            finalImg.push_back(std::move(row));
+        return c;
+    }
 
-        if (finalImg.size() != h || finalImg.empty() || finalImg[0].size() != w)
-            return image();
+    // writes it to pixel (i, j), and the object the pixel shows when anti-aliasing
+    void shadePixel(unsigned int i, unsigned int j, const objectView &obj, std::size_t tri, bool combine)
+    {
+        img.set(i, j, shade(i, j, obj, tri, combine));
+        if (!pixelObjects.empty())
+            pixelObjects[static_cast<std::size_t>(i) * width + j] = obj.index;
+    }
 
-        return image(static_cast<unsigned int>(h), static_cast<unsigned int>(w), finalImg);
+    // pixels p and q (row-major indices, colors c and d) show another object, or a channel differs
+    // by more than the contrast
+    bool differs(std::size_t p, const color &c, std::size_t q, const color &d) const
+    {
+        if (pixelObjects[p] != pixelObjects[q])
+            return true;
+        return std::fabs(c.x() - d.x()) > antialiasing.contrast || std::fabs(c.y() - d.y()) > antialiasing.contrast ||
+               std::fabs(c.z() - d.z()) > antialiasing.contrast;
+    }
+
+    // 4x4 strata of a pixel, (row, column), in sample order: the first 4 are a rotated grid (one
+    // per quadrant, row and column), the other 12 complete the grid
+    static constexpr std::uint8_t kStrata[kMaxSamples][2] = {{0, 1}, {1, 3}, {2, 0}, {3, 2}, {0, 0}, {0, 2}, {0, 3}, {1, 0}, {1, 1}, {1, 2}, {2, 1}, {2, 2}, {2, 3}, {3, 0}, {3, 1}, {3, 3}};
+
+    // Sample k of pixel (i, j), jittered inside its stratum of the pixel square around the primary
+    // ray. The jitter is a hash of the pixel and k, so the image doesn't depend on the thread
+    // tracing it. hit gets the object the sample shows.
+    color samplePixel(unsigned int i, unsigned int j, unsigned int k, const sceneView &scene, const objectView *&hit,
+                      traceStats &counters) const
+    {
+        // splitmix64 finalizer
+        std::uint64_t bits = ((static_cast<std::uint64_t>(i) * width + j) * kMaxSamples + k) + 0x9e3779b97f4a7c15ull;
+        bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ull;
+        bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebull;
+        bits ^= bits >> 31;
+        const double u = static_cast<double>(bits >> 40) / 16777216.0;
+        const double v = static_cast<double>((bits >> 16) & 0xffffffu) / 16777216.0;
+
+        const ray r = model.at(i - 0.5 + (kStrata[k][0] + u) / 4.0, j - 0.5 + (kStrata[k][1] + v) / 4.0);
+        double dist = std::numeric_limits<double>::infinity();
+        std::size_t tri = 0;
+        const objectView *obj = caster.intersectScene(r, scene, dist, tri, counters);
+        hit = obj;
+        return obj ? shade(i, j, *obj, tri, false) : defaultColor;
     }
 };
 
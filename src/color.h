@@ -15,8 +15,8 @@
 class color : public vec3
 {
 private:
-    const int MIN = 0;
-    const int MAX = 255;
+    static constexpr int MIN = 0;
+    static constexpr int MAX = 255;
 
 public:
     // Default constructor
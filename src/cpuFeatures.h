@@ -0,0 +1,83 @@
+/**
+ * @file cpuFeatures.h
+ * @brief Runtime CPU feature detection and bit helpers shared by the SIMD kernels.
+ */
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RAYCAST_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC / Clang compile the AVX2 kernels with a function attribute so the rest of the program
+// keeps the default target; MSVC accepts the intrinsics without it
+#if defined(__GNUC__) || defined(__clang__)
+#define RAYCAST_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RAYCAST_TARGET_AVX2
+#endif
+
+namespace cpuFeatures
+{
+    // true when the CPU and the OS support AVX2, checked once
+    inline bool hasAVX2()
+    {
+#ifdef RAYCAST_X86
+        static const bool supported = []
+        {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+                return false; // the OS doesn't save the ymm registers
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }();
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    // index of the lowest set bit, mask must not be 0
+    inline int lowestBit(std::uint32_t mask)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    // number of set bits
+    inline int bitCount(std::uint32_t mask)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int count = 0;
+        for (; mask; mask &= mask - 1)
+            ++count;
+        return count;
+#else
+        return __builtin_popcount(mask);
+#endif
+    }
+}
+
+#endif // CPUFEATURES_H
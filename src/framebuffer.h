@@ -0,0 +1,258 @@
+/**
+ * @file framebuffer.h
+ * @brief Defines the pixel formats, the non-owning row / tile views and the contiguous aligned pixel buffer backing image.
+ */
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "color.h"
+
+// 8 bit pixels, as written by the encoders and the GUI blitter
+struct rgb8
+{
+    std::uint8_t r, g, b;
+};
+
+struct rgba8
+{
+    std::uint8_t r, g, b, a;
+};
+
+// float pixel on the scale of color (0-255), not clamped; laid out like color so the image buffer can be read as it
+struct rgb32f
+{
+    float r, g, b;
+};
+
+// accumulation pixel: weighted sum of the samples and the sum of the weights
+struct hdrPixel
+{
+    float r = 0, g = 0, b = 0, weight = 0;
+
+    void add(const color &c, float w = 1.0f)
+    {
+        r += static_cast<float>(c.x()) * w;
+        g += static_cast<float>(c.y()) * w;
+        b += static_cast<float>(c.z()) * w;
+        weight += w;
+    }
+
+    // weighted mean, black while nothing was accumulated
+    color resolve() const
+    {
+        if (weight <= 0.0f)
+            return color();
+        return color(r / weight, g / weight, b / weight);
+    }
+};
+
+enum class pixelFormat
+{
+    rgb8 = 0,
+    rgba8 = 1,
+    rgb32f = 2,
+    hdr = 3
+};
+
+// the image working format is color, which has to stay 3 packed floats for the rgb32f view
+static_assert(sizeof(color) == sizeof(rgb32f), "color must be laid out as 3 floats");
+static_assert(alignof(color) == alignof(rgb32f), "color must be laid out as 3 floats");
+
+// conversions from the working format; the 8 bit ones clamp to 0-255 (color getters) and truncate like the
+// old writers, the float one keeps the components as they are
+inline rgb8 toRGB8(const color &c)
+{
+    return {static_cast<std::uint8_t>(c.r()), static_cast<std::uint8_t>(c.g()), static_cast<std::uint8_t>(c.b())};
+}
+
+inline rgba8 toRGBA8(const color &c, std::uint8_t alpha = 255)
+{
+    return {static_cast<std::uint8_t>(c.r()), static_cast<std::uint8_t>(c.g()), static_cast<std::uint8_t>(c.b()), alpha};
+}
+
+inline rgb32f toRGB32F(const color &c)
+{
+    return {c.x(), c.y(), c.z()};
+}
+
+/**
+ * @class rowSpan
+ * @brief Pointer and length over one row of pixels; never owns them.
+ */
+template <typename T>
+class rowSpan
+{
+public:
+    rowSpan() = default;
+    rowSpan(T *data, std::size_t size) : m_data(data), m_size(size) {}
+
+    T *data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T *begin() const { return m_data; }
+    T *end() const { return m_data + m_size; }
+    T &operator[](std::size_t k) const { return m_data[k]; }
+
+private:
+    T *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+/**
+ * @class pixelView
+ * @brief Non-owning 2D view of row-major pixels; stride is the distance between two rows in pixels.
+ * x runs along the width and y along the height, like camera tiles.
+ */
+template <typename T>
+class pixelView
+{
+public:
+    pixelView() = default;
+    pixelView(T *data, unsigned int width, unsigned int height, std::size_t stride)
+        : m_data(data), m_width(width), m_height(height), m_stride(stride) {}
+
+    // a view of T converts to a view of const T
+    operator pixelView<const T>() const { return pixelView<const T>(m_data, m_width, m_height, m_stride); }
+
+    T *data() const { return m_data; }
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    std::size_t stride() const { return m_stride; }
+    bool empty() const { return m_width == 0 || m_height == 0; }
+
+    rowSpan<T> row(unsigned int y) const { return rowSpan<T>(m_data + y * m_stride, m_width); }
+    T &at(unsigned int x, unsigned int y) const { return m_data[y * m_stride + x]; }
+
+    // rectangle [x0, x0 + width) x [y0, y0 + height), shares the pixels and the stride
+    pixelView tile(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height) const
+    {
+        if (x0 + width > m_width || y0 + height > m_height)
+            throw std::out_of_range("pixelView::tile(): rectangle outside the view. x0: " + std::to_string(x0) +
+                                    " | y0: " + std::to_string(y0));
+        return pixelView(m_data + y0 * m_stride + x0, width, height, m_stride);
+    }
+
+private:
+    T *m_data = nullptr;
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+    std::size_t m_stride = 0;
+};
+
+// std allocator on over-aligned storage, so rows can be read with aligned vector loads
+template <typename T, std::size_t Alignment = 64>
+struct alignedAllocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = alignedAllocator<U, Alignment>;
+    };
+
+    alignedAllocator() = default;
+    template <typename U>
+    alignedAllocator(const alignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const alignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U>
+    bool operator!=(const alignedAllocator<U, Alignment> &) const { return false; }
+};
+
+/**
+ * @class framebuffer
+ * @brief Owns width x height pixels of one format in a single 64 byte aligned, row-major block.
+ * Rows are not padded, so stride == width and the whole buffer is one span.
+ */
+template <typename T>
+class framebuffer
+{
+public:
+    framebuffer() = default;
+    framebuffer(unsigned int width, unsigned int height, const T &fill = T())
+        : m_pixels(static_cast<std::size_t>(width) * height, fill), m_width(width), m_height(height) {}
+
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    std::size_t size() const { return m_pixels.size(); }
+    bool empty() const { return m_pixels.empty(); }
+
+    T *data() { return m_pixels.data(); }
+    const T *data() const { return m_pixels.data(); }
+
+    T &at(unsigned int x, unsigned int y) { return m_pixels[static_cast<std::size_t>(y) * m_width + x]; }
+    const T &at(unsigned int x, unsigned int y) const { return m_pixels[static_cast<std::size_t>(y) * m_width + x]; }
+
+    pixelView<T> view() { return pixelView<T>(data(), m_width, m_height, m_width); }
+    pixelView<const T> view() const { return pixelView<const T>(data(), m_width, m_height, m_width); }
+
+    rowSpan<T> row(unsigned int y) { return view().row(y); }
+    rowSpan<const T> row(unsigned int y) const { return view().row(y); }
+
+    pixelView<T> tile(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height)
+    {
+        return view().tile(x0, y0, width, height);
+    }
+    pixelView<const T> tile(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height) const
+    {
+        return view().tile(x0, y0, width, height);
+    }
+
+    void fill(const T &value) { std::fill(m_pixels.begin(), m_pixels.end(), value); }
+
+    // keeps the pixels of the overlapping rectangle, new pixels get fill
+    void resize(unsigned int width, unsigned int height, const T &fill = T())
+    {
+        if (width == m_width)
+        {
+            m_pixels.resize(static_cast<std::size_t>(width) * height, fill);
+            m_height = height;
+            return;
+        }
+        framebuffer resized(width, height, fill);
+        const unsigned int w = std::min(width, m_width), h = std::min(height, m_height);
+        for (unsigned int y = 0; y < h; ++y)
+            std::copy(row(y).begin(), row(y).begin() + w, resized.row(y).begin());
+        *this = std::move(resized);
+    }
+
+private:
+    std::vector<T, alignedAllocator<T>> m_pixels;
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+};
+
+// weighted means of an accumulation buffer, written into a view of the same size
+inline void resolveHDR(pixelView<const hdrPixel> src, pixelView<color> dst)
+{
+    if (src.width() != dst.width() || src.height() != dst.height())
+        throw std::invalid_argument("resolveHDR(): source and destination sizes differ");
+    for (unsigned int y = 0; y < src.height(); ++y)
+    {
+        const rowSpan<const hdrPixel> in = src.row(y);
+        const rowSpan<color> out = dst.row(y);
+        for (std::size_t x = 0; x < in.size(); ++x)
+            out[x] = in[x].resolve();
+    }
+}
+
+#endif // FRAMEBUFFER_H
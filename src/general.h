@@ -11,7 +11,38 @@ enum primitive
     torus = 4,
     cube = 5,
     sphere = 6,
-    suzane = 7
+    suzane = 7,
+    meshFile = 8 // mesh loaded from a file (Wavefront OBJ or the text format), needs a path
+};
+
+// acceleration structure used by an object when tracing its triangles
+enum class acceleration
+{
+    none = 0,
+    grid = 1,
+    bvh = 2,
+    octree = 3 // adaptive grid, cells split where the triangles are dense
+};
+
+// ray / triangle kernel used by the renderers
+enum class triangleTest
+{
+    mollerTrumbore = 0,
+    watertight = 1
+};
+
+// how a camera produces its primary rays
+enum class rayGeneration
+{
+    analytic = 0, // computed per pixel from the camera description when traced, nothing stored
+    stored = 1    // one ray kept per pixel (custom grids)
+};
+
+// how the grid and the octree decide which cells reference a triangle
+enum class cellBinning
+{
+    bounds = 0, // every cell the bounding box of the triangle touches
+    exact = 1   // only the cells the triangle itself crosses
 };
 
 #endif // GENERAL_H
\ No newline at end of file
@@ -559,6 +559,13 @@ vec3 *gmath::reflectorVector(const vec3 incoming, const vec3 normal)
     return new vec3(outgoing);
 }
 
+vec3 gmath::reflect(const vec3 &incoming, const vec3 &normal)
+{
+    vec3 n = normalize(normal);
+    // r=incoming-2(incoming.n)n with n unit length
+    return incoming - n * (2 * dot(incoming, n));
+}
+
 vec3 gmath::rotate(const vec3 &vec, const vec3 &axis, double angle)
 {
     double s = sin(angle);
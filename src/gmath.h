@@ -69,6 +69,8 @@ public:
     static double magnitude(const vec3);
 
     static vec3 *reflectorVector(const vec3 incoming, const vec3 normal);
+    // mirror of incoming about the plane of normal (any length), returned by value
+    static vec3 reflect(const vec3 &incoming, const vec3 &normal);
 
     // project 3d triangle into 2d triangle
     static std::vector<point> projectTriangle(const point &a, const point &b, const point &c);
@@ -26,16 +26,18 @@ HBITMAP imageToHBITMAP(const image &img)
     if (!pixels)
         return NULL;
 
+    // DIB rows are padded to 4 bytes and stored as BGR
+    const int stride = (width * 3 + 3) & ~3;
     unsigned char *dst = (unsigned char *)pixels;
     for (int y = 0; y < height; ++y)
     {
-        for (int x = 0; x < width; ++x)
+        unsigned char *out = dst + y * stride;
+        for (const color &c : img.row(y))
         {
-            const color &c = img.get(y, x);
-            int i = (y * width + x) * 3;
-            dst[i + 0] = c.b();
-            dst[i + 1] = c.g();
-            dst[i + 2] = c.r();
+            const rgb8 p = toRGB8(c);
+            *out++ = p.b;
+            *out++ = p.g;
+            *out++ = p.r;
         }
     }
 
@@ -5,16 +5,19 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <vector>  // Import the vector library
 #include "color.h" // Assuming vec3 is implemented in vec3.h
+#include "framebuffer.h"
 using namespace std;
 
 /**
  * @class image
  * @brief Represents an image in 2D space.
- * The image class encapsulates an image defined by a 2D array of pixels.
+ * The image class encapsulates an image defined by a 2D array of pixels, stored
+ * in one contiguous row-major framebuffer. Rows and tiles are handed out as views.
  * It provides methods to get and set these attributes, as well as to clear the image.
  * Inherits from color class.
  *
@@ -22,86 +25,40 @@ using namespace std;
 class image
 {
 private:
-    vector<vector<color>> pixels;
-    unsigned int width;
-    unsigned int height;
+    // row-major: pixel (x, y) of get/set is row x, column y of the buffer
+    framebuffer<color> pixels;
 
 public:
     // Default constructor
     image() : image(0, 0) {}
     image(const int h, const int w)
     {
-
         if (w < 0 || h < 0)
         {
             throw std::invalid_argument("Image Width and height must be non-negative");
         }
-        if (w == 0 && h == 0)
-        {
-            width = 0;
-            height = 0;
-            pixels = vector<vector<color>>();
-        }
-        else
-        {
-            this->width = static_cast<unsigned int>(w);
-            this->height = static_cast<unsigned int>(h);
-            pixels.resize(height);
-            for (unsigned int i = 0; i < height; ++i)
-            {
-                pixels[i].resize(width);
-            }
-        }
+        pixels = framebuffer<color>(static_cast<unsigned int>(w), static_cast<unsigned int>(h));
     }
-    image(const int h, const int w, vector<vector<color>> img)
+    image(const int h, const int w, const vector<vector<color>> &img) : image(h, w)
     {
-
-        if (w < 0 || h < 0)
+        for (unsigned int i = 0; i < getheight(); i++)
         {
-            throw std::invalid_argument("Image Width and height must be non-negative");
-        }
-        if (w == 0 && h == 0)
-        {
-            width = 0;
-            height = 0;
-            pixels = vector<vector<color>>();
-        }
-        else
-        {
-            this->width = static_cast<unsigned int>(w);
-            this->height = static_cast<unsigned int>(h);
-            pixels.resize(static_cast<size_t>(h));
-            for (unsigned int i = 0; i < height; ++i)
+            const vector<color> &src = img.at(i);
+            rowSpan<color> dst = pixels.row(i);
+            for (size_t j = 0; j < dst.size(); j++)
             {
-                // cout << i << endl ;
-                pixels[i].resize(width);
-            }
-            for (size_t i = 0; i < pixels.size(); i++)
-            {
-                for (size_t j = 0; j < pixels.at(i).size(); j++)
-                {
-                    pixels[i][j] = img.at(i).at(j);
-                }
+                dst[j] = src.at(j);
             }
         }
     }
-    image(const int h, const int w, vector<vector<image>> images) : image(w, h)
+    image(const int h, const int w, vector<vector<image>> images) : image(h, w)
     {
         imageConstruct(images);
     }
 
-    size_t size()
+    size_t size() const
     {
-        if ((width == 0 && height == 0) && pixels.size() == 0)
-        {
-            return 0;
-        }
-
-        if (pixels.empty() || pixels.at(0).empty() || pixels.size() * pixels.at(0).size() != width * height)
-        {
-            throw std::invalid_argument("size of pixels isn't the same as dimension: ");
-        }
-        return width * height;
+        return pixels.size();
     }
 
     // empty function
@@ -114,12 +71,10 @@ public:
     void imageConstruct(const vector<vector<image>> &images)
     {
         cout << "Image Construct" << endl;
-        vector<vector<color>> newpixels;
 
         // Calculate total height and width based on the input images
         unsigned int totalHeight = 0;
         unsigned int totalWidth = 0;
-        cout << 0 << endl;
 
         for (const auto &row : images)
         {
@@ -134,12 +89,9 @@ public:
             totalHeight += rowHeight;
         }
 
-        // Resize the newpixels vector
-        cout << 1 << endl;
-        newpixels.resize(totalHeight, vector<color>(totalWidth));
-        cout << 2 << endl;
+        framebuffer<color> newpixels(totalWidth, totalHeight);
 
-        // Construct the new image by placing sub-images at appropriate offsets
+        // Construct the new image by copying the rows of each sub-image at its offset
         unsigned int yOffset = 0;
 
         for (const auto &row : images)
@@ -149,12 +101,10 @@ public:
 
             for (const auto &img : row)
             {
-                for (size_t z = 0; z < img.getheight(); ++z)
+                pixelView<color> dst = newpixels.tile(xOffset, yOffset, img.getwidth(), img.getheight());
+                for (unsigned int z = 0; z < img.getheight(); ++z)
                 {
-                    for (size_t w = 0; w < img.getwidth(); ++w)
-                    {
-                        newpixels[yOffset + z][xOffset + w] = img.get(z, w);
-                    }
+                    std::copy(img.row(z).begin(), img.row(z).end(), dst.row(z).begin());
                 }
 
                 xOffset += img.getwidth(); // Shift X offset by the image width
@@ -163,10 +113,8 @@ public:
 
             yOffset += maxRowHeight; // Shift Y offset by the maximum row height
         }
-        cout << 3 << endl;
 
-        // Assign newpixels to the class member
-        pixels = newpixels;
+        pixels = std::move(newpixels);
 
         cout << "pixels size = " << pixels.size() << endl;
     }
@@ -174,31 +122,103 @@ public:
     // Get the width of the image
     unsigned int getwidth() const
     {
-        return width;
+        return pixels.width();
     }
 
     // Get the height of the image
     unsigned int getheight() const
     {
-        return height;
+        return pixels.height();
     }
 
-    // Get all the pixels
-    vector<vector<color>> getPixels() const
+    // View of all the pixels, without copying them
+    pixelView<const color> getPixels() const
     {
-        return pixels;
+        return pixels.view();
     }
+    pixelView<color> getPixels()
+    {
+        return pixels.view();
+    }
+
+    // Row x (the same x as get / set) and a rectangle of rows and columns, both sharing the pixels
+    rowSpan<const color> row(unsigned int x) const
+    {
+        return pixels.row(x);
+    }
+    rowSpan<color> row(unsigned int x)
+    {
+        return pixels.row(x);
+    }
+    pixelView<const color> tile(unsigned int x0, unsigned int y0, unsigned int rows, unsigned int cols) const
+    {
+        return pixels.tile(y0, x0, cols, rows);
+    }
+    pixelView<color> tile(unsigned int x0, unsigned int y0, unsigned int rows, unsigned int cols)
+    {
+        return pixels.tile(y0, x0, cols, rows);
+    }
+
+    // Writes row x in an 8 bit format into out (getwidth() pixels)
+    void rowRGB8(unsigned int x, rgb8 *out) const
+    {
+        for (const color &c : row(x))
+            *out++ = ::toRGB8(c);
+    }
+    void rowRGBA8(unsigned int x, rgba8 *out, std::uint8_t alpha = 255) const
+    {
+        for (const color &c : row(x))
+            *out++ = ::toRGBA8(c, alpha);
+    }
+
+    // The pixels read as rgb32f in place (same floats, not clamped), valid until the image is resized or destroyed
+    pixelView<const rgb32f> viewRGB32F() const
+    {
+        const pixelView<const color> v = pixels.view();
+        return pixelView<const rgb32f>(reinterpret_cast<const rgb32f *>(v.data()), v.width(), v.height(), v.stride());
+    }
+
+    // Copies of the image in another pixel format; the 8 bit formats can only be converted, see
+    // rowRGB8 / rowRGBA8 to fill a buffer of the caller row by row
+    framebuffer<rgb8> toRGB8() const
+    {
+        framebuffer<rgb8> out(getwidth(), getheight());
+        for (unsigned int i = 0; i < getheight(); ++i)
+            rowRGB8(i, out.row(i).data());
+        return out;
+    }
+    framebuffer<rgba8> toRGBA8(std::uint8_t alpha = 255) const
+    {
+        framebuffer<rgba8> out(getwidth(), getheight());
+        for (unsigned int i = 0; i < getheight(); ++i)
+            rowRGBA8(i, out.row(i).data(), alpha);
+        return out;
+    }
+    framebuffer<rgb32f> toRGB32F() const
+    {
+        framebuffer<rgb32f> out(getwidth(), getheight());
+        for (unsigned int i = 0; i < getheight(); ++i)
+            std::transform(row(i).begin(), row(i).end(), out.row(i).begin(), [](const color &c)
+                           { return ::toRGB32F(c); });
+        return out;
+    }
+
+    // Overwrites the image with the weighted means of an accumulation buffer of the same size
+    void resolve(const framebuffer<hdrPixel> &hdr)
+    {
+        resolveHDR(hdr.view(), pixels.view());
+    }
+
     // Get the color of a pixel
     const color &get(unsigned int x, unsigned int y) const
     {
-        // cout << " x :" << x << " y : "<< y << endl;
         if (constrain(x, y))
         {
             cout << "get(" << x << " , " << y << ")" << endl;
-            cout << "width : " << width << " | height : " << height << endl;
+            cout << "width : " << getwidth() << " | height : " << getheight() << endl;
             throw std::invalid_argument("image::get():Pixel coordinates out of bounds. x: " + std::to_string(x) + " | y: " + std::to_string(y));
         }
-        return pixels[x][y];
+        return pixels.at(y, x);
     }
 
     // Set the color of a pixel
@@ -210,55 +230,35 @@ public:
             cout << "set(" << x << " , " << y << " , " << c << ")" << endl;
             throw std::invalid_argument("image::set_Pixel():Pixel coordinates out of bounds. x: " + std::to_string(x) + " | y: " + std::to_string(y));
         }
-        pixels[x][y] = c;
+        pixels.at(y, x) = c;
     }
 
-    void setPixels()
-    {
-    }
     // Check if a pixel is out of bounds
-    bool constrain(unsigned int &x, unsigned int &y) const
+    bool constrain(unsigned int x, unsigned int y) const
     {
-        // std::cout << "constrain :" << std::endl;
-        // std::cout << "x : " << x << " y : " << y << std::endl;
-        // std::cout << "height : " << height << " width : " << width << std::endl;
+        return (x >= getheight() || y >= getwidth());
+    }
 
-        return (x >= height || y >= width || x < 0 || y < 0);
+    // Set every pixel to c
+    void fill(const color &c)
+    {
+        pixels.fill(c);
     }
 
     // Clear the image
     void clear()
     {
-        for (unsigned int i = 0; i < height; ++i)
-        {
-            for (unsigned int j = 0; j < width; ++j)
-            {
-                pixels[i][j].setblack();
-            }
-        }
+        pixels.fill(color());
     }
 
-    // Resize the image
+    // Resize the image, keeping the pixels that still fit
     void resize(unsigned int new_width, unsigned int new_height)
     {
         if (new_width == 0 || new_height == 0)
         {
             throw std::invalid_argument("Image New width and height must be non-zero");
         }
-        try
-        {
-            pixels.resize(new_height);
-            for (unsigned int i = 0; i < new_height; ++i)
-            {
-                pixels[i].resize(new_width);
-            }
-            width = new_width;
-            height = new_height;
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << e.what() << '\n';
-        }
+        pixels.resize(new_width, new_height);
     }
 
     // Overload operator<< for prunsigned inting
@@ -267,9 +267,9 @@ public:
         os << "Image(" << img.getwidth() << ", " << img.getheight() << ")\n";
         for (unsigned int i = 0; i < img.getheight(); ++i)
         {
-            for (unsigned int j = 0; j < img.getwidth(); ++j)
+            for (const color &c : img.row(i))
             {
-                os << img.pixels[i][j] << " | ";
+                os << c << " | ";
             }
             os << "\n";
         }
@@ -279,18 +279,15 @@ public:
     // Overload operator==
     bool operator==(const image &other) const
     {
-        if (width != other.width || height != other.height)
+        if (getwidth() != other.getwidth() || getheight() != other.getheight())
         {
             return false;
         }
-        for (unsigned int i = 0; i < height; ++i)
+        for (unsigned int i = 0; i < getheight(); ++i)
         {
-            for (unsigned int j = 0; j < width; ++j)
+            if (!std::equal(row(i).begin(), row(i).end(), other.row(i).begin()))
             {
-                if (pixels[i][j] != other.pixels[i][j])
-                {
-                    return false;
-                }
+                return false;
             }
         }
         return true;
@@ -301,8 +298,5 @@ public:
     {
         return !(*this == other);
     }
-    // Copy constructor
-    image(const image &other)
-        : pixels(other.pixels), width(other.width), height(other.height) {}
 };
-#endif // IMAGE_H
\ No newline at end of file
+#endif // IMAGE_H
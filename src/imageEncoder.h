@@ -0,0 +1,536 @@
+/**
+ * @file imageEncoder.h
+ * @brief Defines the imageEncoder class, the built-in binary PPM (P6), PNG and QOI encoders.
+ */
+#ifndef IMAGEENCODER_H
+#define IMAGEENCODER_H
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "image.h"
+
+enum class imageFormat
+{
+    ppm = 0, // binary P6
+    png = 1,
+    qoi = 2,
+    bmp = 3
+};
+
+// stored writes the PNG pixels as uncompressed deflate blocks, deflate runs a fixed-Huffman LZ77 pass
+enum class pngCompression
+{
+    stored = 0,
+    deflate = 1
+};
+
+/**
+ * @class imageEncoder
+ * @brief Encodes an image into a byte buffer in one pass over its rows.
+ * Rows are read straight from the framebuffer spans; bottomUp writes the last row
+ * first, which is the orientation ImageRenderer::renderToFile has always used.
+ */
+class imageEncoder
+{
+public:
+    // format from the file extension (.ppm, .png, .qoi, .bmp), throws on anything else
+    static imageFormat formatFromPath(const std::string &path)
+    {
+        const std::size_t dot = path.find_last_of('.');
+        std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+        for (char &c : ext)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+        if (ext == "ppm")
+            return imageFormat::ppm;
+        if (ext == "png")
+            return imageFormat::png;
+        if (ext == "qoi")
+            return imageFormat::qoi;
+        if (ext == "bmp")
+            return imageFormat::bmp;
+        throw std::invalid_argument("imageEncoder: unsupported image extension: " + path);
+    }
+
+    static void encodeP6(const image &img, std::vector<std::uint8_t> &out, bool bottomUp = false)
+    {
+        const std::string header = "P6\n" + std::to_string(img.getwidth()) + ' ' + std::to_string(img.getheight()) + "\n255\n";
+        const std::size_t rowBytes = static_cast<std::size_t>(img.getwidth()) * 3;
+        out.resize(header.size() + rowBytes * img.getheight());
+        std::copy(header.begin(), header.end(), out.begin());
+
+        std::uint8_t *dst = out.data() + header.size();
+        for (unsigned int k = 0; k < img.getheight(); ++k)
+        {
+            img.rowRGB8(rowIndex(img, k, bottomUp), reinterpret_cast<rgb8 *>(dst));
+            dst += rowBytes;
+        }
+    }
+
+    // 8 bit RGB PNG; each row gets the filter with the smallest sum of absolute residuals
+    static void encodePNG(const image &img, std::vector<std::uint8_t> &out, bool bottomUp = false,
+                          pngCompression mode = pngCompression::deflate)
+    {
+        const unsigned int width = img.getwidth(), height = img.getheight();
+        const std::size_t rowBytes = static_cast<std::size_t>(width) * 3;
+
+        // filtered scanlines: one filter byte followed by the row residuals
+        std::vector<std::uint8_t> raw((rowBytes + 1) * height);
+        std::vector<std::uint8_t> prev(rowBytes, 0), cur(rowBytes), trial(rowBytes);
+        for (unsigned int k = 0; k < height; ++k)
+        {
+            img.rowRGB8(rowIndex(img, k, bottomUp), reinterpret_cast<rgb8 *>(cur.data()));
+            std::uint8_t *line = raw.data() + k * (rowBytes + 1);
+
+            std::uint64_t bestScore = UINT64_MAX;
+            for (std::uint8_t filter = 0; filter < 5; ++filter)
+            {
+                const std::uint64_t score = filterRow(filter, cur.data(), prev.data(), trial.data(), rowBytes);
+                if (score < bestScore)
+                {
+                    bestScore = score;
+                    line[0] = filter;
+                    std::copy(trial.begin(), trial.end(), line + 1);
+                }
+            }
+            cur.swap(prev);
+        }
+
+        std::vector<std::uint8_t> idat;
+        zlibCompress(raw, idat, mode);
+
+        out.clear();
+        out.reserve(idat.size() + 64);
+        static const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        out.insert(out.end(), signature, signature + 8);
+
+        std::uint8_t ihdr[13];
+        putBE32(ihdr, width);
+        putBE32(ihdr + 4, height);
+        ihdr[8] = 8;  // bit depth
+        ihdr[9] = 2;  // color type RGB
+        ihdr[10] = 0; // deflate
+        ihdr[11] = 0; // adaptive filtering
+        ihdr[12] = 0; // no interlace
+        writeChunk(out, "IHDR", ihdr, sizeof(ihdr));
+        writeChunk(out, "IDAT", idat.data(), idat.size());
+        writeChunk(out, "IEND", nullptr, 0);
+    }
+
+    // "Quite OK Image" format, 3 channels, sRGB (https://qoiformat.org/qoi-specification.pdf)
+    static void encodeQOI(const image &img, std::vector<std::uint8_t> &out, bool bottomUp = false)
+    {
+        const unsigned int width = img.getwidth(), height = img.getheight();
+        out.clear();
+        out.reserve(14 + static_cast<std::size_t>(width) * height * 4 + 8);
+
+        const std::uint8_t magic[4] = {'q', 'o', 'i', 'f'};
+        out.insert(out.end(), magic, magic + 4);
+        std::uint8_t size[8];
+        putBE32(size, width);
+        putBE32(size + 4, height);
+        out.insert(out.end(), size, size + 8);
+        out.push_back(3); // channels
+        out.push_back(0); // sRGB with linear alpha
+
+        std::array<rgba8, 64> index{};
+        rgba8 prev{0, 0, 0, 255};
+        unsigned int run = 0;
+        std::vector<rgba8> row(width);
+
+        for (unsigned int k = 0; k < height; ++k)
+        {
+            img.rowRGBA8(rowIndex(img, k, bottomUp), row.data());
+            for (const rgba8 &px : row)
+            {
+                if (same(px, prev))
+                {
+                    if (++run == 62)
+                    {
+                        out.push_back(static_cast<std::uint8_t>(0xC0 | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0)
+                {
+                    out.push_back(static_cast<std::uint8_t>(0xC0 | (run - 1)));
+                    run = 0;
+                }
+
+                const unsigned int slot = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+                if (same(index[slot], px))
+                {
+                    out.push_back(static_cast<std::uint8_t>(slot));
+                }
+                else
+                {
+                    index[slot] = px;
+                    const int dr = static_cast<std::int8_t>(px.r - prev.r);
+                    const int dg = static_cast<std::int8_t>(px.g - prev.g);
+                    const int db = static_cast<std::int8_t>(px.b - prev.b);
+                    const int drg = dr - dg, dbg = db - dg;
+
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    {
+                        out.push_back(static_cast<std::uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    }
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                    {
+                        out.push_back(static_cast<std::uint8_t>(0x80 | (dg + 32)));
+                        out.push_back(static_cast<std::uint8_t>((drg + 8) << 4 | (dbg + 8)));
+                    }
+                    else
+                    {
+                        const std::uint8_t rgb[4] = {0xFE, px.r, px.g, px.b};
+                        out.insert(out.end(), rgb, rgb + 4);
+                    }
+                }
+                prev = px;
+            }
+        }
+        if (run > 0)
+            out.push_back(static_cast<std::uint8_t>(0xC0 | (run - 1)));
+
+        const std::uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        out.insert(out.end(), end, end + 8);
+    }
+
+    static std::uint32_t crc32(const std::uint8_t *data, std::size_t n, std::uint32_t crc = 0)
+    {
+        static const std::array<std::uint32_t, 256> table = []
+        {
+            std::array<std::uint32_t, 256> t{};
+            for (std::uint32_t i = 0; i < 256; ++i)
+            {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (std::size_t i = 0; i < n; ++i)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static std::uint32_t adler32(const std::uint8_t *data, std::size_t n)
+    {
+        std::uint32_t a = 1, b = 0;
+        while (n > 0)
+        {
+            // 5552 bytes is the most that can be summed before b overflows 32 bits
+            const std::size_t chunk = n < 5552 ? n : 5552;
+            for (std::size_t i = 0; i < chunk; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += chunk;
+            n -= chunk;
+        }
+        return (b << 16) | a;
+    }
+
+private:
+    static unsigned int rowIndex(const image &img, unsigned int k, bool bottomUp)
+    {
+        return bottomUp ? img.getheight() - 1 - k : k;
+    }
+
+    static bool same(const rgba8 &a, const rgba8 &b)
+    {
+        return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+    }
+
+    static void putBE32(std::uint8_t *p, std::uint32_t v)
+    {
+        p[0] = static_cast<std::uint8_t>(v >> 24);
+        p[1] = static_cast<std::uint8_t>(v >> 16);
+        p[2] = static_cast<std::uint8_t>(v >> 8);
+        p[3] = static_cast<std::uint8_t>(v);
+    }
+
+    static void writeChunk(std::vector<std::uint8_t> &out, const char type[4], const std::uint8_t *data, std::size_t n)
+    {
+        std::uint8_t head[8];
+        putBE32(head, static_cast<std::uint32_t>(n));
+        for (int k = 0; k < 4; ++k)
+            head[4 + k] = static_cast<std::uint8_t>(type[k]);
+        out.insert(out.end(), head, head + 8);
+        if (n)
+            out.insert(out.end(), data, data + n);
+
+        std::uint32_t crc = crc32(head + 4, 4);
+        crc = crc32(data, n, crc);
+        std::uint8_t tail[4];
+        putBE32(tail, crc);
+        out.insert(out.end(), tail, tail + 4);
+    }
+
+    static int paeth(int a, int b, int c)
+    {
+        const int p = a + b - c;
+        const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return a;
+        return pb <= pc ? b : c;
+    }
+
+    // PNG filter types 0-4 (none, sub, up, average, paeth) over 3 byte pixels; returns the
+    // sum of the residuals read as signed bytes, the usual heuristic to pick a filter
+    static std::uint64_t filterRow(std::uint8_t filter, const std::uint8_t *cur, const std::uint8_t *prev,
+                                   std::uint8_t *out, std::size_t n)
+    {
+        switch (filter)
+        {
+        case 1:
+            return filterWith(cur, prev, out, n, [](int a, int, int)
+                              { return a; });
+        case 2:
+            return filterWith(cur, prev, out, n, [](int, int b, int)
+                              { return b; });
+        case 3:
+            return filterWith(cur, prev, out, n, [](int a, int b, int)
+                              { return (a + b) / 2; });
+        case 4:
+            return filterWith(cur, prev, out, n, [](int a, int b, int c)
+                              { return paeth(a, b, c); });
+        default:
+            return filterWith(cur, prev, out, n, [](int, int, int)
+                              { return 0; });
+        }
+    }
+
+    template <typename Predictor>
+    static std::uint64_t filterWith(const std::uint8_t *cur, const std::uint8_t *prev, std::uint8_t *out,
+                                    std::size_t n, Predictor predict)
+    {
+        std::uint64_t score = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const int a = i >= 3 ? cur[i - 3] : 0;
+            const int c = i >= 3 ? prev[i - 3] : 0;
+            out[i] = static_cast<std::uint8_t>(cur[i] - predict(a, prev[i], c));
+            score += static_cast<std::uint64_t>(std::abs(static_cast<int>(static_cast<std::int8_t>(out[i]))));
+        }
+        return score;
+    }
+
+    // deflate writes its bits least significant first
+    struct bitWriter
+    {
+        std::vector<std::uint8_t> &out;
+        std::uint64_t buffer = 0;
+        int count = 0;
+
+        void put(std::uint32_t bits, int n)
+        {
+            buffer |= static_cast<std::uint64_t>(bits) << count;
+            count += n;
+            while (count >= 8)
+            {
+                out.push_back(static_cast<std::uint8_t>(buffer));
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes are defined most significant bit first
+        void putReversed(std::uint32_t code, int n)
+        {
+            std::uint32_t r = 0;
+            for (int k = 0; k < n; ++k)
+                r |= ((code >> k) & 1u) << (n - 1 - k);
+            put(r, n);
+        }
+
+        void flush()
+        {
+            if (count > 0)
+                out.push_back(static_cast<std::uint8_t>(buffer));
+            buffer = 0;
+            count = 0;
+        }
+    };
+
+    // fixed Huffman literal / length code (RFC 1951, 3.2.6), bit-reversed once into a table
+    static void putLiteral(bitWriter &bits, unsigned int symbol)
+    {
+        struct code
+        {
+            std::uint16_t bits;
+            std::uint8_t length;
+        };
+        static const std::array<code, 288> table = []
+        {
+            std::array<code, 288> t{};
+            for (unsigned int sym = 0; sym < 288; ++sym)
+            {
+                std::uint32_t c;
+                int n;
+                if (sym < 144)
+                    c = 0x30 + sym, n = 8;
+                else if (sym < 256)
+                    c = 0x190 + sym - 144, n = 9;
+                else if (sym < 280)
+                    c = sym - 256, n = 7;
+                else
+                    c = 0xC0 + sym - 280, n = 8;
+                std::uint32_t r = 0;
+                for (int k = 0; k < n; ++k)
+                    r |= ((c >> k) & 1u) << (n - 1 - k);
+                t[sym] = {static_cast<std::uint16_t>(r), static_cast<std::uint8_t>(n)};
+            }
+            return t;
+        }();
+        bits.put(table[symbol].bits, table[symbol].length);
+    }
+
+    static void putMatch(bitWriter &bits, unsigned int length, unsigned int distance)
+    {
+        static const unsigned short lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const unsigned char lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const unsigned short distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                    6145, 8193, 12289, 16385, 24577};
+        static const unsigned char distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int l = 28;
+        while (lengthBase[l] > length)
+            --l;
+        putLiteral(bits, 257 + l);
+        bits.put(length - lengthBase[l], lengthExtra[l]);
+
+        int d = 29;
+        while (distBase[d] > distance)
+            --d;
+        bits.putReversed(d, 5);
+        bits.put(distance - distBase[d], distExtra[d]);
+    }
+
+    // zlib stream (RFC 1950) around stored blocks or one fixed-Huffman block
+    static void zlibCompress(const std::vector<std::uint8_t> &data, std::vector<std::uint8_t> &out, pngCompression mode)
+    {
+        out.clear();
+        out.push_back(0x78);
+        out.push_back(0x01);
+
+        if (mode == pngCompression::stored)
+        {
+            std::size_t pos = 0;
+            do
+            {
+                const std::size_t n = std::min<std::size_t>(data.size() - pos, 65535);
+                const bool last = pos + n == data.size();
+                out.push_back(last ? 1 : 0);
+                out.push_back(static_cast<std::uint8_t>(n));
+                out.push_back(static_cast<std::uint8_t>(n >> 8));
+                out.push_back(static_cast<std::uint8_t>(~n));
+                out.push_back(static_cast<std::uint8_t>(~n >> 8));
+                out.insert(out.end(), data.begin() + pos, data.begin() + pos + n);
+                pos += n;
+            } while (pos < data.size());
+        }
+        else
+        {
+            deflateFixed(data, out);
+        }
+
+        std::uint8_t tail[4];
+        putBE32(tail, adler32(data.data(), data.size()));
+        out.insert(out.end(), tail, tail + 4);
+    }
+
+    // greedy LZ77 over a 32 KB window with hash chains, emitted as a single fixed-Huffman block
+    static void deflateFixed(const std::vector<std::uint8_t> &data, std::vector<std::uint8_t> &out)
+    {
+        constexpr std::size_t kWindow = 32768;
+        constexpr unsigned int kHashBits = 15;
+        constexpr int kMaxChain = 32;
+        constexpr unsigned int kMinMatch = 3, kMaxMatch = 258;
+
+        bitWriter bits{out};
+        bits.put(1, 1); // last block
+        bits.put(1, 2); // fixed Huffman
+
+        const std::size_t n = data.size();
+        std::vector<std::int32_t> head(std::size_t(1) << kHashBits, -1);
+        std::vector<std::int32_t> chain(kWindow, -1);
+        auto hashAt = [&](std::size_t i)
+        {
+            const std::uint32_t v = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+            return (v * 2654435761u) >> (32 - kHashBits);
+        };
+        auto insert = [&](std::size_t i)
+        {
+            if (i + kMinMatch > n)
+                return;
+            const std::uint32_t h = hashAt(i);
+            chain[i % kWindow] = head[h];
+            head[h] = static_cast<std::int32_t>(i);
+        };
+
+        std::size_t i = 0;
+        while (i < n)
+        {
+            unsigned int bestLen = 0;
+            std::size_t bestDist = 0;
+            if (i + kMinMatch <= n)
+            {
+                const std::size_t maxLen = std::min<std::size_t>(kMaxMatch, n - i);
+                std::int32_t cand = head[hashAt(i)];
+                for (int depth = 0; cand >= 0 && depth < kMaxChain; ++depth)
+                {
+                    const std::size_t dist = i - static_cast<std::size_t>(cand);
+                    if (dist > kWindow)
+                        break;
+                    unsigned int len = 0;
+                    while (len < maxLen && data[cand + len] == data[i + len])
+                        ++len;
+                    if (len > bestLen)
+                    {
+                        bestLen = len;
+                        bestDist = dist;
+                        if (len == maxLen)
+                            break;
+                    }
+                    cand = chain[static_cast<std::size_t>(cand) % kWindow];
+                }
+            }
+
+            if (bestLen >= kMinMatch)
+            {
+                putMatch(bits, bestLen, static_cast<unsigned int>(bestDist));
+                for (unsigned int k = 0; k < bestLen; ++k)
+                    insert(i + k);
+                i += bestLen;
+            }
+            else
+            {
+                putLiteral(bits, data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+
+        putLiteral(bits, 256); // end of block
+        bits.flush();
+    }
+};
+
+#endif // IMAGEENCODER_H
@@ -1,4 +1,5 @@
 #include "helper.cpp"
+#include "allocCounter.h"
 
 void scene_file(size_t pass)
 {
@@ -22,9 +23,429 @@ void test()
     s.launchThreadedCameraSplit();
 }
 
+// renders the same mesh with the uniform grid, the octree and the BVH and prints the traversal counters of each
+void acceleration_benchmark(const string &meshPath, size_t divisions, unsigned int resolution = 400)
+{
+    for (acceleration mode : {acceleration::grid, acceleration::octree, acceleration::bvh})
+    {
+        space s;
+        object obj;
+        obj.loadMesh(meshPath, 1, point(0, 0, 0));
+        obj.randomColoring();
+        s.addObject(obj);
+
+        s.enableAcceleration(mode, divisions);
+
+        // orthographic camera framing the bounding sphere, looking down -z
+        double r = obj.sphereRadius / 2;
+        point origin(obj.center.get_x() - r, obj.center.get_y() - r, obj.center.get_z() + 3 * r);
+        s.addCamera(camera(resolution, resolution, 2 * r / resolution, origin));
+
+        cout << (mode == acceleration::grid ? "grid" : (mode == acceleration::octree ? "octree" : "bvh")) << " build time: " << s.lastBuild.ms << " ms"
+             << " | memory: " << s.lastBuild.bytes / 1024 << " KiB" << endl;
+        s.launchThreadedCameraSplit();
+    }
+}
+
+// renders a scene file and prints the wall time and the heap allocations made by the render itself
+void scene_benchmark(const string &scenePath, size_t divisions)
+{
+    space s;
+    s.loadFromFile(scenePath);
+    s.enableGrid(divisions);
+
+    const auto before = allocCounter::now();
+    auto start = std::chrono::high_resolution_clock::now();
+    s.launchThreadedCamera();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    const auto after = allocCounter::now();
+
+    cout << "render time: " << elapsed.count() << " ms"
+         << " | allocations: " << after.allocations - before.allocations
+         << " | allocated bytes: " << after.bytes - before.bytes << endl;
+}
+
+// renders a scene file coarse to fine for at most budgetMs, writing the image after every pass
+void progressive_preview(const string &scenePath, size_t divisions, double budgetMs)
+{
+    space s;
+    s.loadFromFile(scenePath);
+    s.enableGrid(divisions);
+
+    space::renderBudget budget;
+    budget.ms = budgetMs;
+    s.launchProgressive(budget, "preview.png");
+}
+
+// renders a scene file with adaptive anti-aliasing (up to maxSamples per pixel) and saves the
+// samples each pixel took next to the image
+void antialiased_render(const string &scenePath, size_t divisions, unsigned int maxSamples = 16)
+{
+    space s;
+    s.loadFromFile(scenePath);
+    s.enableGrid(divisions);
+
+    adaptiveSampling settings;
+    settings.maxSamples = maxSamples;
+    s.setAntialiasing(settings);
+    s.launchThreadedCamera();
+
+    ImageRenderer::renderToFile(s.cameras.at(0).getimage(), "antialiased.png", false);
+    ImageRenderer::renderToFile(s.cameras.at(0).sampleCountImage(), "samples.png", false);
+}
+
+// renders a scene file and writes where the time goes: profile_nodes/tests/hits.png heatmaps and
+// profile.json (build with -DRAYCAST_PROFILE, the regular build doesn't count per pixel)
+void profile_render(const string &scenePath, size_t divisions)
+{
+    space s;
+    s.loadFromFile(scenePath);
+    s.enableGrid(divisions);
+    s.launchThreadedCamera();
+    s.saveProfile("profile");
+}
+
+// Checks the shadow / visibility queries against the nearest of every triangle on segments of many lengths, with
+// ray directions of several magnitudes (the distances must not depend on them), for the grid, the
+// octree and the BVH. Throws on the first disagreement.
+void occlusion_check()
+{
+    const point froms[] = {point(-0.3, 0.05, 0.05), point(0.05, -0.45, 0.02), point(-0.25, -0.2, -0.3)};
+    const point tos[] = {point(0.2, 0.05, 0.05), point(-0.15, 0.05, 0.05), point(1.5, 0.05, 0.05),
+                         point(0.05, 0.05, 0.02), point(0.05, 2.0, 0.02), point(0.3, 0.25, 0.3), point(-0.12, -0.1, -0.12)};
+    size_t segments = 0;
+    for (acceleration mode : {acceleration::grid, acceleration::octree, acceleration::bvh})
+    {
+        space s;
+        s.addObject(object(primitive::cube, 0.1));
+        if (mode == acceleration::grid)
+            s.enableGrid(4);
+        else if (mode == acceleration::octree)
+            s.enableOctree();
+        else
+            s.enableBVH();
+
+        const sceneView scene(s.obj);
+        rayCaster caster;
+        traceStats counters;
+        for (const point &from : froms)
+        {
+            for (const point &to : tos)
+            {
+                const vec3 d = to - from;
+                const double dist = gmath::magnitude(d);
+                double nearest = std::numeric_limits<double>::infinity();
+                size_t tri = 0;
+                // every triangle tested in turn, along the unit direction
+                const bool expected = rayCaster::nearestTriangle(s.obj[0].mesh, rayQuery(ray(from, gmath::normalize(d)), caster.mode), nearest, tri, counters) && nearest < dist;
+
+                bool agrees = caster.visible(from, to, scene, counters) == !expected;
+                for (double scale : {0.25, 1.0 / dist, 7.0})
+                    agrees = agrees && caster.occluded(ray(from, d * scale), scene, dist, counters) == expected;
+                if (!agrees)
+                {
+                    std::ostringstream segment;
+                    segment << from << " to " << to;
+                    throw std::logic_error("occlusion_check(): visible / occluded disagree with the nearest hit from " + segment.str());
+                }
+                ++segments;
+            }
+        }
+    }
+    cout << "occlusion check: " << segments << " segments ok" << endl;
+}
+
+// Traces the same rays through the grid and the octree of a mesh with their direction scaled by
+// several factors, and checks the nearest hits against every triangle tested in turn (the distance
+// is along the unit direction, whatever the length given). Throws on the first ray that differs.
+void nearest_hit_check(const string &meshPath = "Mesh/Suzane.txt", size_t divisions = 16)
+{
+    size_t rays = 0, mailboxSkips = 0;
+    for (acceleration mode : {acceleration::grid, acceleration::octree})
+    {
+        space s;
+        object obj;
+        obj.loadMesh(meshPath, 1, point(0, 0, 0));
+        s.addObject(obj);
+        if (mode == acceleration::grid)
+            s.enableGrid(divisions);
+        else
+            s.enableOctree();
+
+        const object &o = s.obj[0];
+        const sceneView scene(s.obj);
+        rayCaster caster;
+        traceStats counters;
+        const double r = o.sphereRadius;
+        const point froms[] = {o.center + vec3(0, 0, 3 * r), o.center + vec3(-2 * r, 1.5 * r, 2 * r), o.center + vec3(2.5 * r, -r, -1.5 * r)};
+        const int n = 12;
+        for (const point &from : froms)
+        {
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                    for (int k = 0; k < n; ++k)
+                    {
+                        const point to = o.center + vec3(2 * i - n + 1, 2 * j - n + 1, 2 * k - n + 1) * (r / n);
+                        const vec3 d = to - from;
+                        double expected = std::numeric_limits<double>::infinity();
+                        size_t tri = 0;
+                        rayCaster::nearestTriangle(o.mesh, rayQuery(ray(from, gmath::normalize(d)), caster.mode), expected, tri, counters);
+
+                        for (double scale : {0.05, 1.0, 7.0})
+                        {
+                            double nearest = std::numeric_limits<double>::infinity();
+                            caster.intersectObject(ray(from, d * scale), scene[0], nearest, tri, counters);
+                            if (std::isinf(nearest) != std::isinf(expected) ||
+                                (!std::isinf(expected) && std::abs(nearest - expected) > 1e-5 * std::max(1.0, expected)))
+                            {
+                                std::ostringstream query;
+                                query << from << " to " << to << " scaled by " << scale;
+                                throw std::logic_error("nearest_hit_check(): the nearest hit differs from the one found testing every triangle, ray from " + query.str());
+                            }
+                        }
+                        ++rays;
+                    }
+        }
+        mailboxSkips += counters.mailboxSkips;
+    }
+    // the default Möller–Trumbore blocks are mailboxed too, the skips are the tests saved
+    cout << "nearest hit check: " << rays << " rays ok | mailbox skips: " << mailboxSkips << endl;
+}
+
+// Runs a regular render, then a complete progressive one on the same camera, and checks they give
+// the same image: with an analytic camera after cameraToImage (depth kept per pixel) and with a
+// stored ray grid (last hit kept in the rays). Throws when they differ.
+void progressive_check()
+{
+    for (rayGeneration generation : {rayGeneration::analytic, rayGeneration::stored})
+    {
+        space s;
+        s.addObject(object(primitive::cube, 0.1));
+        s.enableBVH();
+        s.addCamera(camera(48, 40, 0.005, point(-0.1, -0.12, 1), vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, -1), 1.0, 0.0, generation));
+
+        if (generation == rayGeneration::analytic)
+            s.cameras[0].cameraToImage(s.obj[0]);
+        else
+            s.launchThreadedCamera();
+        const image regular = s.cameras[0].getimage();
+
+        s.cameras[0].clear();
+        const space::progressReport report = s.launchProgressive(space::renderBudget{});
+        if (!report.complete() || s.cameras[0].getimage() != regular)
+        {
+            throw std::logic_error(string("progressive_check(): the progressive render differs from the regular one (") +
+                                   (generation == rayGeneration::analytic ? "analytic" : "stored") + " camera)");
+        }
+    }
+    cout << "progressive check: ok" << endl;
+}
+
+// times the previous intersectRayTriangle routine against the Möller–Trumbore and watertight kernels,
+// every camera ray is tested against every triangle of the mesh
+void triangle_kernel_benchmark(const string &meshPath, unsigned int resolution = 64)
+{
+    object obj;
+    obj.loadMesh(meshPath, 1, point(0, 0, 0));
+    const triangleMesh &mesh = obj.mesh;
+
+    double r = obj.sphereRadius / 2;
+    point origin(obj.center.get_x() - r, obj.center.get_y() - r, obj.center.get_z() + 3 * r);
+    camera cam(resolution, resolution, 2 * r / resolution, origin);
+    const size_t tests = size_t(resolution) * resolution * mesh.triangleCount();
+
+    // nearest distance per ray, infinity on a miss
+    auto run = [&](const string &name, auto &&nearest)
+    {
+        vector<double> result;
+        result.reserve(size_t(resolution) * resolution);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned i = 0; i < resolution; ++i)
+            for (unsigned j = 0; j < resolution; ++j)
+                result.push_back(nearest(cam.get(j, i)));
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        size_t hits = 0;
+        for (double d : result)
+            hits += std::isinf(d) ? 0 : 1;
+        cout << name << ": " << elapsed.count() << " ms | " << elapsed.count() * 1e6 / tests << " ns/test | rays hit: " << hits << endl;
+        return result;
+    };
+
+    cout << meshPath << ": " << mesh.triangleCount() << " triangles, " << resolution << "x" << resolution << " rays" << endl;
+
+    const auto legacy = run("intersectRayTriangle", [&](const ray &rr)
+                            {
+        double best = std::numeric_limits<double>::infinity();
+        for (size_t t = 0; t < mesh.triangleCount(); ++t)
+        {
+            const auto tri = mesh.triangle(t);
+            if (auto p = gmath::intersectRayTriangle(rr, tri.data()))
+                best = std::min(best, gmath::distance(rr.getOrigine(), *p));
+        }
+        return best; });
+
+    for (triangleTest mode : {triangleTest::mollerTrumbore, triangleTest::watertight})
+    {
+        const auto result = run(mode == triangleTest::watertight ? "watertight" : "moller-trumbore", [&](const ray &rr)
+                                {
+            const rayQuery query(rr, mode);
+            double best = std::numeric_limits<double>::infinity();
+            triangleHit th;
+            for (size_t t = 0; t < mesh.triangleCount(); ++t)
+                if (query.intersect(mesh, t, th) && th.t < best)
+                    best = th.t;
+            return best; });
+
+        size_t differ = 0;
+        for (size_t k = 0; k < result.size(); ++k)
+            if (std::isinf(result[k]) != std::isinf(legacy[k]) || (!std::isinf(result[k]) && std::abs(result[k] - legacy[k]) > 1e-3))
+                differ++;
+        cout << "  rays differing from intersectRayTriangle: " << differ << endl;
+    }
+}
+
+// times the grid cell loop: one Möller–Trumbore test per triangle id against the 8-wide blocks,
+// with the scalar fallback and with AVX2 (when the CPU has it)
+void grid_kernel_benchmark(const string &meshPath, size_t divisions, unsigned int resolution = 128)
+{
+    object obj;
+    obj.loadMesh(meshPath, 1, point(0, 0, 0));
+    obj.enableGrid(divisions);
+    const triangleMesh &mesh = obj.mesh;
+    const sphereBoundingGrid &grid = *obj.boundingGrid;
+
+    double r = obj.sphereRadius / 2;
+    point origin(obj.center.get_x() - r, obj.center.get_y() - r, obj.center.get_z() + 3 * r);
+    camera cam(resolution, resolution, 2 * r / resolution, origin);
+
+    // the cells each ray crosses up to its nearest hit are collected once so only the cell tests are timed
+    vector<pair<rayQuery, vector<CubeData>>> work;
+    for (unsigned i = 0; i < resolution; ++i)
+        for (unsigned j = 0; j < resolution; ++j)
+        {
+            const ray &rr = cam.get(j, i);
+            vector<CubeData> cells;
+            grid.VisitRay(rr.getOrigine(), rr.getDirection(), [&](const CubeData &cube, double)
+                          {
+                cells.push_back(cube);
+                return true; });
+            work.push_back({rayQuery(rr), cells});
+        }
+
+    auto run = [&](const string &name, auto &&testCell)
+    {
+        double checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto &[query, cells] : work)
+        {
+            double best = std::numeric_limits<double>::infinity();
+            for (const CubeData &cell : cells)
+                testCell(query, cell, best);
+            checksum += std::isinf(best) ? 0 : best;
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        cout << name << ": " << elapsed.count() << " ms | checksum: " << checksum << endl;
+        return elapsed.count();
+    };
+
+    cout << meshPath << ": grid " << divisions << ", " << resolution << "x" << resolution << " rays" << endl;
+
+    const double perTriangle = run("per triangle", [&](const rayQuery &q, const CubeData &cell, double &best)
+                                   {
+        triangleHit th;
+        for (uint32_t k = 0; k < cell.triangleCount; ++k)
+            if (q.intersect(mesh, cell.triangles[k], th) && th.t < best)
+                best = th.t; });
+
+    auto blockRun = [&](const rayQuery &q, const CubeData &cell, double &best)
+    {
+        float tMax = static_cast<float>(best), t;
+        for (uint32_t k = 0; k < cell.blockCount; ++k)
+            if (triangleBlockKernel::intersect(q, cell.blocks[k], tMax, t) >= 0)
+                tMax = t;
+        best = tMax;
+    };
+
+    triangleBlockKernel::forceScalar(true);
+    const double scalar = run("blocks, scalar", blockRun);
+    triangleBlockKernel::forceScalar(false);
+    if (triangleBlockKernel::usesAVX2())
+    {
+        const double avx = run("blocks, AVX2", blockRun);
+        cout << "speedup per triangle -> AVX2: " << perTriangle / avx << "x | scalar blocks -> AVX2: " << scalar / avx << "x" << endl;
+    }
+    else
+    {
+        cout << "AVX2 not available, the scalar fallback is used" << endl;
+    }
+}
+
+// main              renders ../scene/scene_export.txt
+// main --check       runs the correctness checks, exit code 1 when one fails
+// main --bench [mesh] runs the acceleration, kernel and scene benchmarks (Mesh/Suzane.txt by default)
+// main --profile     renders the scene with the profile written to profile* (build with -DRAYCAST_PROFILE)
+// main --progressive [ms] renders the scene coarse to fine into preview.png within ms milliseconds (1000 by default)
+// main --antialias [n] renders the scene with up to n (1, 4 or 16) samples per pixel (16 by default) into antialiased.png,
+//                    samples.png shows how many each pixel took
+// --no-view may come first with any mode, the saved images are then not opened in a viewer
+// (the checks, benchmarks and profile never open one)
 int main(int argc, char const *argv[])
 {
-    scene_file(5);
+    vector<string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--no-view")
+    {
+        ImageRenderer::setViewerEnabled(false);
+        args.erase(args.begin());
+    }
+
+    const string mode = args.empty() ? "" : args[0];
+    const string scenePath = "../scene/scene_export.txt";
+    if (mode == "--check" || mode == "--bench" || mode == "--profile")
+        ImageRenderer::setViewerEnabled(false);
+    try
+    {
+        if (mode.empty())
+        {
+            scene_file(5);
+        }
+        else if (mode == "--check")
+        {
+            occlusion_check();
+            nearest_hit_check();
+            progressive_check();
+        }
+        else if (mode == "--bench")
+        {
+            const string meshPath = args.size() > 1 ? args[1] : "Mesh/Suzane.txt";
+            acceleration_benchmark(meshPath, 16);
+            triangle_kernel_benchmark(meshPath);
+            grid_kernel_benchmark(meshPath, 16);
+            scene_benchmark(scenePath, 5);
+        }
+        else if (mode == "--profile")
+        {
+            profile_render(scenePath, 5);
+        }
+        else if (mode == "--progressive")
+        {
+            progressive_preview(scenePath, 5, args.size() > 1 ? stod(args[1]) : 1000.0);
+        }
+        else if (mode == "--antialias")
+        {
+            antialiased_render(scenePath, 5, args.size() > 1 ? static_cast<unsigned int>(stoul(args[1])) : 16);
+        }
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--no-view] [--check | --bench [mesh] | --profile | --progressive [ms] | --antialias [samples]]" << endl;
+            return 2;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -40,8 +461,6 @@ int main(int argc, char const *argv[])
 -   camera rotaion
 -   optimisation
 -   splitting spaces
--   quad and polygones to triangles
--   obj support
 -   thread optimisation
 -   display and interact with a 3d space threw input control (walk around)
 -   coliision handeling
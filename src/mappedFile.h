@@ -0,0 +1,150 @@
+/**
+ * @file mappedFile.h
+ * @brief Defines the mappedFile class, a read-only memory mapping of a whole file (Windows and POSIX).
+ */
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+// pulled in ahead of the headers calling std::min / std::max / numeric_limits<>::max(), which the
+// min and max macros of windows.h would break; the lean set is all the mapping calls need
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @class mappedFile
+ * @brief Maps a file read-only for its whole lifetime; the bytes are used in place.
+ * Move-only. Throws std::runtime_error when the file can't be opened or mapped.
+ */
+class mappedFile
+{
+public:
+    mappedFile() = default;
+
+    explicit mappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("mappedFile: cannot open " + path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size))
+        {
+            close();
+            throw std::runtime_error("mappedFile: cannot read the size of " + path);
+        }
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        if (m_size > 0)
+        {
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping)
+                m_data = static_cast<const std::uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            throw std::runtime_error("mappedFile: cannot open " + path);
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0)
+        {
+            close();
+            throw std::runtime_error("mappedFile: cannot read the size of " + path);
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0)
+        {
+            void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (p != MAP_FAILED)
+                m_data = static_cast<const std::uint8_t *>(p);
+        }
+#endif
+        if (m_size > 0 && !m_data)
+        {
+            close();
+            throw std::runtime_error("mappedFile: cannot map " + path);
+        }
+    }
+
+    mappedFile(const mappedFile &) = delete;
+    mappedFile &operator=(const mappedFile &) = delete;
+
+    mappedFile(mappedFile &&other) noexcept { swap(other); }
+    mappedFile &operator=(mappedFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~mappedFile() { close(); }
+
+    const std::uint8_t *data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    const std::uint8_t *m_data = nullptr;
+    std::size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+
+    void swap(mappedFile &other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+#ifdef _WIN32
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+#else
+        std::swap(m_fd, other.m_fd);
+#endif
+    }
+
+    void close() noexcept
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data)
+            ::munmap(const_cast<std::uint8_t *>(m_data), m_size);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+};
+
+#endif // MAPPEDFILE_H
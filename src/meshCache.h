@@ -0,0 +1,384 @@
+/**
+ * @file meshCache.h
+ * @brief Defines the binary mesh cache: a versioned file generated once from a text mesh and mapped on load.
+ */
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "point.h"
+#include "MeshReader.h"
+#include "objReader.h"
+#include "triangleMesh.h"
+#include "boundingVolumeHierarchy.h"
+#include "mappedFile.h"
+
+/**
+ * Layout of a ".rcmesh" file (little endian, every section 16 byte aligned):
+ *
+ *   meshCacheHeader
+ *   positions    float[3] x positionCount
+ *   indices      uint32   x triangleCount * 3
+ *   colorIds     uint32   x triangleCount
+ *   palette      float[3] x paletteCount
+ *   nodes        meshCacheNode x nodeCount      (only with kHasHierarchy)
+ *   triangleIds  uint32   x triangleCount       (only with kHasHierarchy)
+ *
+ * The mesh is stored as read from the text file, before any scaling or rotation.
+ * The source size and write time are recorded so a cache older than its mesh is
+ * rebuilt; a different version or byte order is rebuilt too.
+ */
+struct meshCacheHeader
+{
+    char magic[8];           // "RCMESH\0\0"
+    std::uint32_t version;   // meshCache::kVersion
+    std::uint32_t byteOrder; // 0x01020304 as written
+    std::uint64_t sourceSize;
+    std::int64_t sourceTime; // source last write time, filesystem clock ticks
+    std::uint32_t positionCount;
+    std::uint32_t triangleCount;
+    std::uint32_t paletteCount;
+    std::uint32_t flags;
+    std::uint32_t nodeCount;
+    std::uint32_t leafSize;
+    float boundsMin[3];
+    float boundsMax[3];
+    std::uint64_t positionsOffset;
+    std::uint64_t indicesOffset;
+    std::uint64_t colorIdsOffset;
+    std::uint64_t paletteOffset;
+    std::uint64_t nodesOffset;
+    std::uint64_t triangleIdsOffset;
+};
+
+// BVHNode on disk
+struct meshCacheNode
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    std::uint32_t leftFirst;
+    std::uint32_t count;
+};
+
+// a mesh in its file coordinates and, when the cache has one, its hierarchy over the same coordinates
+struct cachedMesh
+{
+    std::shared_ptr<const triangleMesh> mesh;
+    std::shared_ptr<const boundingVolumeHierarchy> hierarchy;
+};
+
+/**
+ * @class meshCache
+ * @brief Loads text meshes through their binary cache.
+ * load() keeps every mesh it returned, so objects using the same file share one copy
+ * for the whole run. On a miss the "<mesh>.rcmesh" file next to the text mesh is
+ * mapped and used without parsing; if it is missing or stale the text is parsed once
+ * and the cache is written for the next run. ".obj" files are read as Wavefront OBJ,
+ * every other extension as the "(x,y,z);(x,y,z);(x,y,z)" format.
+ */
+class meshCache
+{
+public:
+    static constexpr std::uint32_t kVersion = 1;
+    static constexpr std::uint32_t kHasHierarchy = 1u << 0;
+    static constexpr std::size_t kLeafSize = 4; // leaf size of the stored hierarchy
+
+    static std::string cachePath(const std::string &meshPath) { return meshPath + ".rcmesh"; }
+
+    // pool parses a text mesh in parallel when it has to be read (see MeshReader::loadMesh)
+    static cachedMesh load(const std::string &meshPath, threadPool *pool = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        auto it = loaded().find(meshPath);
+        if (it != loaded().end())
+            return it->second;
+
+        cachedMesh result;
+        if (!tryRead(cachePath(meshPath), meshPath, result))
+        {
+            result = parseText(meshPath, pool);
+            if (!write(cachePath(meshPath), meshPath, *result.mesh, result.hierarchy.get()))
+                std::cerr << "Warning: could not write the mesh cache " << cachePath(meshPath) << std::endl;
+        }
+        loaded()[meshPath] = result;
+        return result;
+    }
+
+    // forgets the meshes kept by load(), the files are left alone
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        loaded().clear();
+    }
+
+    // Reads a cache file. Returns false when it is missing, stale (source given and newer) or
+    // written by another version, and with a warning when it is unreadable, truncated or corrupt,
+    // so that load() parses the source again and rewrites it.
+    static bool tryRead(const std::string &path, const std::string &sourcePath, cachedMesh &out)
+    {
+        try
+        {
+            return readFile(path, sourcePath, out);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Warning: " << e.what() << ", the mesh is read from its source again" << std::endl;
+            out = cachedMesh();
+            return false;
+        }
+    }
+
+    // Writes a cache file; the hierarchy is optional. Returns false if the file can't be written.
+    static bool write(const std::string &path, const std::string &sourcePath, const triangleMesh &mesh,
+                      const boundingVolumeHierarchy *hierarchy)
+    {
+        meshCacheHeader h{};
+        std::memcpy(h.magic, "RCMESH\0\0", 8);
+        h.version = kVersion;
+        h.byteOrder = 0x01020304u;
+        sourceStamp(sourcePath, h.sourceSize, h.sourceTime);
+        h.positionCount = static_cast<std::uint32_t>(mesh.positions.size());
+        h.triangleCount = static_cast<std::uint32_t>(mesh.triangleCount());
+        h.paletteCount = static_cast<std::uint32_t>(mesh.palette.size());
+        h.flags = hierarchy ? kHasHierarchy : 0;
+        h.nodeCount = hierarchy ? static_cast<std::uint32_t>(hierarchy->NodeCount()) : 0;
+        h.leafSize = hierarchy ? static_cast<std::uint32_t>(hierarchy->MaxLeafSize()) : 0;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            h.boundsMin[a] = mesh.positions.empty() ? 0.0f : std::numeric_limits<float>::max();
+            h.boundsMax[a] = mesh.positions.empty() ? 0.0f : -std::numeric_limits<float>::max();
+        }
+        std::vector<float> positions;
+        positions.reserve(mesh.positions.size() * 3);
+        for (const point &p : mesh.positions)
+        {
+            const float c[3] = {p.x(), p.y(), p.z()};
+            for (int a = 0; a < 3; ++a)
+            {
+                positions.push_back(c[a]);
+                h.boundsMin[a] = std::min(h.boundsMin[a], c[a]);
+                h.boundsMax[a] = std::max(h.boundsMax[a], c[a]);
+            }
+        }
+        std::vector<float> palette;
+        for (const color &c : mesh.palette)
+        {
+            palette.push_back(c.x());
+            palette.push_back(c.y());
+            palette.push_back(c.z());
+        }
+        std::vector<meshCacheNode> nodes;
+        if (hierarchy)
+        {
+            for (const BVHNode &n : hierarchy->Nodes())
+                nodes.push_back({{n.boundsMin.x(), n.boundsMin.y(), n.boundsMin.z()},
+                                 {n.boundsMax.x(), n.boundsMax.y(), n.boundsMax.z()},
+                                 n.leftFirst,
+                                 n.count});
+        }
+
+        std::uint64_t offset = align(sizeof(meshCacheHeader));
+        auto place = [&](std::uint64_t &field, std::uint64_t bytes)
+        {
+            field = offset;
+            offset = align(offset + bytes);
+        };
+        place(h.positionsOffset, positions.size() * sizeof(float));
+        place(h.indicesOffset, mesh.indices.size() * sizeof(std::uint32_t));
+        place(h.colorIdsOffset, mesh.colorIds.size() * sizeof(std::uint32_t));
+        place(h.paletteOffset, palette.size() * sizeof(float));
+        place(h.nodesOffset, nodes.size() * sizeof(meshCacheNode));
+        place(h.triangleIdsOffset, hierarchy ? hierarchy->TriangleIds().size() * sizeof(std::uint32_t) : 0);
+
+        std::vector<char> bytes(offset, 0);
+        auto put = [&](std::uint64_t at, const void *src, std::size_t n)
+        {
+            if (n)
+                std::memcpy(bytes.data() + at, src, n);
+        };
+        put(0, &h, sizeof(h));
+        put(h.positionsOffset, positions.data(), positions.size() * sizeof(float));
+        put(h.indicesOffset, mesh.indices.data(), mesh.indices.size() * sizeof(std::uint32_t));
+        put(h.colorIdsOffset, mesh.colorIds.data(), mesh.colorIds.size() * sizeof(std::uint32_t));
+        put(h.paletteOffset, palette.data(), palette.size() * sizeof(float));
+        put(h.nodesOffset, nodes.data(), nodes.size() * sizeof(meshCacheNode));
+        if (hierarchy)
+            put(h.triangleIdsOffset, hierarchy->TriangleIds().data(), hierarchy->TriangleIds().size() * sizeof(std::uint32_t));
+
+        // written next to the target and renamed, so a concurrent reader never maps half a file
+        const std::string temp = path + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            if (!out)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // tryRead() without the fallback: throws std::runtime_error when the file can't be mapped,
+    // is truncated or holds indices out of range
+    static bool readFile(const std::string &path, const std::string &sourcePath, cachedMesh &out)
+    {
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec))
+            return false;
+
+        mappedFile file(path);
+        if (file.size() < sizeof(meshCacheHeader))
+            return false;
+
+        meshCacheHeader h;
+        std::memcpy(&h, file.data(), sizeof(h));
+        if (std::memcmp(h.magic, "RCMESH\0\0", 8) != 0 || h.version != kVersion || h.byteOrder != 0x01020304u)
+            return false;
+        if (!sourcePath.empty())
+        {
+            std::uint64_t size;
+            std::int64_t time;
+            if (sourceStamp(sourcePath, size, time) && (size != h.sourceSize || time != h.sourceTime))
+                return false;
+        }
+
+        auto section = [&](std::uint64_t offset, std::uint64_t bytes) -> const std::uint8_t *
+        {
+            if (offset > file.size() || bytes > file.size() - offset)
+                throw std::runtime_error("meshCache: truncated cache file " + path);
+            return file.data() + offset;
+        };
+
+        auto mesh = std::make_shared<triangleMesh>();
+        const float *pos = reinterpret_cast<const float *>(section(h.positionsOffset, std::uint64_t(h.positionCount) * 12));
+        mesh->positions.reserve(h.positionCount);
+        for (std::uint32_t k = 0; k < h.positionCount; ++k)
+            mesh->positions.emplace_back(pos[3 * k], pos[3 * k + 1], pos[3 * k + 2]);
+
+        const std::uint32_t *idx = reinterpret_cast<const std::uint32_t *>(section(h.indicesOffset, std::uint64_t(h.triangleCount) * 12));
+        mesh->indices.assign(idx, idx + std::size_t(h.triangleCount) * 3);
+        for (std::uint32_t v : mesh->indices)
+            if (v >= h.positionCount)
+                throw std::runtime_error("meshCache: vertex index out of range in " + path);
+
+        const std::uint32_t *cid = reinterpret_cast<const std::uint32_t *>(section(h.colorIdsOffset, std::uint64_t(h.triangleCount) * 4));
+        mesh->colorIds.assign(cid, cid + h.triangleCount);
+
+        const float *pal = reinterpret_cast<const float *>(section(h.paletteOffset, std::uint64_t(h.paletteCount) * 12));
+        mesh->palette.reserve(h.paletteCount);
+        for (std::uint32_t k = 0; k < h.paletteCount; ++k)
+            mesh->palette.emplace_back(pal[3 * k], pal[3 * k + 1], pal[3 * k + 2]);
+        for (std::uint32_t c : mesh->colorIds)
+            if (c >= h.paletteCount)
+                throw std::runtime_error("meshCache: color id out of range in " + path);
+
+        mesh->computeRecords();
+        out.mesh = mesh;
+        out.hierarchy.reset();
+
+        if ((h.flags & kHasHierarchy) && h.nodeCount > 0)
+        {
+            const meshCacheNode *nodes = reinterpret_cast<const meshCacheNode *>(section(h.nodesOffset, std::uint64_t(h.nodeCount) * sizeof(meshCacheNode)));
+            std::vector<BVHNode> tree(h.nodeCount);
+            for (std::uint32_t k = 0; k < h.nodeCount; ++k)
+            {
+                tree[k].boundsMin = point(nodes[k].boundsMin[0], nodes[k].boundsMin[1], nodes[k].boundsMin[2]);
+                tree[k].boundsMax = point(nodes[k].boundsMax[0], nodes[k].boundsMax[1], nodes[k].boundsMax[2]);
+                tree[k].leftFirst = nodes[k].leftFirst;
+                tree[k].count = nodes[k].count;
+            }
+            const std::uint32_t *ids = reinterpret_cast<const std::uint32_t *>(section(h.triangleIdsOffset, std::uint64_t(h.triangleCount) * 4));
+            std::vector<std::uint32_t> order(ids, ids + h.triangleCount);
+            try
+            {
+                out.hierarchy = std::make_shared<const boundingVolumeHierarchy>(*mesh, std::move(tree), std::move(order), h.leafSize);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                throw std::runtime_error(std::string("meshCache: bad hierarchy in ") + path + ": " + e.what());
+            }
+        }
+        return true;
+    }
+
+    static std::mutex &mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::map<std::string, cachedMesh> &loaded()
+    {
+        static std::map<std::string, cachedMesh> meshes;
+        return meshes;
+    }
+
+    static std::uint64_t align(std::uint64_t offset) { return (offset + 15) & ~std::uint64_t(15); }
+
+    static bool sourceStamp(const std::string &sourcePath, std::uint64_t &size, std::int64_t &time)
+    {
+        std::error_code ec;
+        size = std::filesystem::file_size(sourcePath, ec);
+        if (ec)
+            return false;
+        auto stamp = std::filesystem::last_write_time(sourcePath, ec);
+        if (ec)
+            return false;
+        time = static_cast<std::int64_t>(stamp.time_since_epoch().count());
+        return true;
+    }
+
+    static bool isOBJ(const std::string &meshPath)
+    {
+        std::string extension = std::filesystem::path(meshPath).extension().string();
+        for (char &c : extension)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return extension == ".obj";
+    }
+
+    // the slow path: OBJ through objReader, anything else is the text format of MeshReader,
+    // the hierarchy is built over the file coordinates
+    static cachedMesh parseText(const std::string &meshPath, threadPool *pool)
+    {
+        std::shared_ptr<triangleMesh> mesh;
+        if (isOBJ(meshPath))
+        {
+            mesh = std::make_shared<triangleMesh>(std::move(objReader::load(meshPath).mesh));
+        }
+        else
+        {
+            MeshReader reader;
+            if (!reader.loadMesh(meshPath, pool) || reader.corners.empty())
+                throw std::runtime_error("meshCache: unable to load or convert the mesh from file: " + meshPath);
+            mesh = std::make_shared<triangleMesh>(triangleMesh::fromCorners(reader.corners));
+        }
+
+        cachedMesh result;
+        if (!mesh->empty())
+            result.hierarchy = std::make_shared<const boundingVolumeHierarchy>(*mesh, kLeafSize);
+        result.mesh = mesh;
+        return result;
+    }
+};
+
+#endif // MESHCACHE_H
@@ -0,0 +1,249 @@
+/**
+ * @file objReader.h
+ * @brief Defines the objReader class, a streaming Wavefront OBJ loader producing an indexed triangleMesh.
+ */
+#ifndef OBJREADER_H
+#define OBJREADER_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "point.h"
+#include "color.h"
+#include "triangleMesh.h"
+#include "mappedFile.h"
+
+using namespace std;
+
+// texture coordinate of a "vt" line
+struct objTexcoord
+{
+    float u = 0, v = 0;
+};
+
+/**
+ * Content of an OBJ file.
+ * mesh.positions are the "v" lines in file order, so vertices shared by faces stay shared;
+ * faces are fanned into triangles and each triangle's colorId is its usemtl group.
+ * normalIds / texcoordIds hold one entry per triangle corner, -1 where the face gave none.
+ */
+struct objMesh
+{
+    triangleMesh mesh;
+    vector<point> normals;
+    vector<objTexcoord> texcoords;
+    vector<int32_t> normalIds;
+    vector<int32_t> texcoordIds;
+    vector<string> materials; // usemtl name of every palette entry, "" for faces before the first usemtl
+};
+
+/**
+ * @class objReader
+ * @brief Reads v / vn / vt / f / usemtl from an OBJ file in one pass over the mapped bytes.
+ * Numbers are read with from_chars in place, no line or token is copied. Face indices may
+ * be negative (relative to the last vertex read) and polygons are fan triangulated around
+ * their first corner. Other statements (o, g, s, mtllib, l, p, ...) are skipped. A malformed
+ * line throws std::runtime_error with the file name and the line number.
+ */
+class objReader
+{
+public:
+    static objMesh load(const string &path)
+    {
+        mappedFile file(path);
+        const char *begin = reinterpret_cast<const char *>(file.data());
+        return parse(begin, begin + file.size(), path);
+    }
+
+    // name only appears in the error messages
+    static objMesh parse(const char *begin, const char *end, const string &name)
+    {
+        objMesh out;
+        map<string, uint32_t> groups;
+        uint32_t group = 0;
+        bool hasGroup = false;
+        vector<corner> face;
+
+        size_t lineNumber = 0;
+        for (const char *p = begin; p < end;)
+        {
+            const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+            if (!eol)
+                eol = end;
+            const char *last = eol;
+            if (last > p && last[-1] == '\r')
+                --last;
+            lineNumber++;
+
+            lineCursor line{skipBlanks(p, last), last, name, lineNumber};
+            p = eol + 1;
+            if (line.at == last || *line.at == '#')
+                continue;
+
+            const char *keyEnd = line.at;
+            while (keyEnd < last && *keyEnd != ' ' && *keyEnd != '\t')
+                ++keyEnd;
+            const size_t keyLength = keyEnd - line.at;
+            const char *key = line.at;
+            line.at = skipBlanks(keyEnd, last);
+
+            if (keyLength == 1 && key[0] == 'v')
+            {
+                const double x = line.number(), y = line.number(), z = line.number();
+                out.mesh.positions.push_back(point(x, y, z));
+            }
+            else if (keyLength == 2 && key[0] == 'v' && key[1] == 'n')
+            {
+                const double x = line.number(), y = line.number(), z = line.number();
+                out.normals.push_back(point(x, y, z));
+            }
+            else if (keyLength == 2 && key[0] == 'v' && key[1] == 't')
+            {
+                objTexcoord t;
+                t.u = static_cast<float>(line.number());
+                if (line.at < last)
+                    t.v = static_cast<float>(line.number());
+                out.texcoords.push_back(t);
+            }
+            else if (keyLength == 1 && key[0] == 'f')
+            {
+                face.clear();
+                while (line.at < last)
+                    face.push_back(readCorner(line, out));
+                if (face.size() < 3)
+                    line.fail("a face needs at least 3 vertices");
+
+                if (!hasGroup)
+                {
+                    group = materialGroup("", groups, out);
+                    hasGroup = true;
+                }
+                for (size_t k = 1; k + 1 < face.size(); ++k)
+                {
+                    for (const corner &c : {face[0], face[k], face[k + 1]})
+                    {
+                        out.mesh.indices.push_back(c.position);
+                        out.normalIds.push_back(c.normal);
+                        out.texcoordIds.push_back(c.texcoord);
+                    }
+                    out.mesh.colorIds.push_back(group);
+                }
+            }
+            else if (keyLength == 6 && memcmp(key, "usemtl", 6) == 0)
+            {
+                const char *nameEnd = last;
+                while (nameEnd > line.at && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t'))
+                    --nameEnd;
+                group = materialGroup(string(line.at, nameEnd), groups, out);
+                hasGroup = true;
+            }
+        }
+
+        if (out.mesh.palette.empty())
+            out.mesh.palette = {color()};
+        out.mesh.computeRecords();
+        return out;
+    }
+
+private:
+    struct corner
+    {
+        uint32_t position;
+        int32_t texcoord;
+        int32_t normal;
+    };
+
+    // the unread part of one line, with what the error messages need
+    struct lineCursor
+    {
+        const char *at;
+        const char *end;
+        const string &name;
+        size_t lineNumber;
+
+        [[noreturn]] void fail(const string &what) const
+        {
+            throw runtime_error("objReader: " + name + ":" + to_string(lineNumber) + ": " + what);
+        }
+
+        double number()
+        {
+            if (at < end && *at == '+')
+                ++at;
+            double value = 0;
+            auto [next, ec] = from_chars(at, end, value);
+            if (ec != errc())
+                fail("expected a number");
+            at = skipBlanks(next, end);
+            return value;
+        }
+
+        long index()
+        {
+            if (at < end && *at == '+')
+                ++at;
+            long value = 0;
+            auto [next, ec] = from_chars(at, end, value);
+            if (ec != errc())
+                fail("expected an index");
+            at = next;
+            return value;
+        }
+    };
+
+    static const char *skipBlanks(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        return p;
+    }
+
+    // 1 based, negative counts back from the last element read so far
+    static size_t resolve(long index, size_t count, lineCursor &line, const char *what)
+    {
+        long resolved = index > 0 ? index - 1 : static_cast<long>(count) + index;
+        if (index == 0 || resolved < 0 || static_cast<size_t>(resolved) >= count)
+            line.fail(string(what) + " index " + to_string(index) + " out of range");
+        return static_cast<size_t>(resolved);
+    }
+
+    // "v", "v/vt", "v//vn" or "v/vt/vn"
+    static corner readCorner(lineCursor &line, const objMesh &out)
+    {
+        corner c{0, -1, -1};
+        c.position = static_cast<uint32_t>(resolve(line.index(), out.mesh.positions.size(), line, "vertex"));
+        if (line.at < line.end && *line.at == '/')
+        {
+            ++line.at;
+            if (line.at < line.end && *line.at != '/')
+                c.texcoord = static_cast<int32_t>(resolve(line.index(), out.texcoords.size(), line, "texture coordinate"));
+            if (line.at < line.end && *line.at == '/')
+            {
+                ++line.at;
+                c.normal = static_cast<int32_t>(resolve(line.index(), out.normals.size(), line, "normal"));
+            }
+        }
+        if (line.at < line.end && *line.at != ' ' && *line.at != '\t')
+            line.fail("unexpected character in a face");
+        line.at = skipBlanks(line.at, line.end);
+        return c;
+    }
+
+    static uint32_t materialGroup(const string &material, map<string, uint32_t> &groups, objMesh &out)
+    {
+        auto it = groups.find(material);
+        if (it != groups.end())
+            return it->second;
+        const uint32_t id = static_cast<uint32_t>(out.mesh.palette.size());
+        groups.emplace(material, id);
+        out.mesh.palette.push_back(color());
+        out.materials.push_back(material);
+        return id;
+    }
+};
+
+#endif // OBJREADER_H
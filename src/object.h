@@ -9,6 +9,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <memory>
 #include "point.h"
 #include "color.h"
 #include "vec3.h"
@@ -16,14 +17,19 @@
 #include "texture.h"
 #include "general.h"
 #include "MeshReader.h"
+#include "triangleMesh.h"
 #include "sphereBoundingGrid.h"
+#include "boundingVolumeHierarchy.h"
+#include "sparseVoxelOctree.h"
+#include "meshCache.h"
+#include "affineTransform.h"
 using namespace std;
 
 /**
  * @class object
  * @brief Represent an obstract entity that holds the graphical data of an object.
- * The object class holds a 2D vector of pixels representing the object's graphical data.
- * and maps an array of 3 elements to a color. aka vertex color map.
+ * The object class holds an indexed triangle mesh: shared vertex positions,
+ * a triangle index buffer and a color id per triangle.
  */
 class object
 {
@@ -32,15 +38,28 @@ public:
     texture tex;
     double sphereRadius;
 
-    // 2D vector of pixels representing the object's graphical data.
-    vector<vector<point>> vertices;
-    // Dictionary to link an array of 3 elements to a color.
-    map<array<point, 3>, color> colorMap;
-
-    sphereBoundingGrid *boundingGrid = nullptr;
+    // indexed geometry and per triangle colors
+    triangleMesh mesh;
+
+    // built once and never modified, so copies of the object (vector growth, scene loading) can share
+    // them; enable* and MoveTo put a new one in place, the other copies keep the one they hold
+    std::shared_ptr<const sphereBoundingGrid> boundingGrid;
+    std::shared_ptr<const boundingVolumeHierarchy> boundingVolume;
+    std::shared_ptr<const sparseVoxelOctree> boundingOctree;
+    // tree of the cached mesh this object was loaded from, in file coordinates
+    std::shared_ptr<const boundingVolumeHierarchy> cachedHierarchy;
+
+    // An instance keeps its own mesh empty and renders the mesh and acceleration structures of
+    // its prototype (an object left at the identity placement) through toWorld / toObject.
+    std::shared_ptr<object> prototype;
+    affineTransform toWorld;
+    affineTransform toObject;
+    // colors of an instance of its own, indexed by the prototype's color ids; empty to use the prototype's
+    std::vector<color> instanceColors;
 
     bool isEmisive = false;
     bool gridEnabled = false;
+    acceleration accel = acceleration::none;
 
     // Create an enum variable and assign a value to it
 
@@ -51,7 +70,7 @@ public:
     }
     object(const vector<vector<point>> &v)
     {
-        vertices = v;
+        mesh = triangleMesh::fromTriangles(v);
         tex = texture();
     }
     object(primitive prim, double scale = 1, point offset = point(0, 0, 0), double angle = 0, vec3 axis = vec3(0, 0, 0))
@@ -80,12 +99,49 @@ public:
         case primitive::suzane:
             this->suzane(scale, offset, axis, angle);
             break;
+        case primitive::meshFile:
+            throw std::invalid_argument("meshFile objects are built from the path of their mesh");
         default:
             throw std::invalid_argument("Unknown primitive type");
         }
     }
-    // spatial grid optimisation
-    void enableGrid(std::size_t divisions)
+    // mesh read from a file, Wavefront OBJ (".obj") or the text format
+    object(const string &meshPath, double scale = 1, point offset = point(0, 0, 0), double angle = 0, vec3 axis = vec3(0, 0, 0),
+           threadPool *pool = nullptr)
+    {
+        this->meshFile(meshPath, scale, offset, axis, angle, pool);
+    }
+    // instance of proto placed like the loaders place a mesh: scaled, offset then rotated about the origin
+    static object instanceOf(const std::shared_ptr<object> &proto, double scale = 1, point offset = point(0, 0, 0), double angle = 0, vec3 axis = vec3(0, 0, 0))
+    {
+        if (!proto || proto->isInstance())
+            throw std::invalid_argument("object::instanceOf(): the prototype must be a plain object");
+
+        object o;
+        o.prototype = proto;
+        o.isEmisive = proto->isEmisive;
+        o.setTransform(affineTransform::placement(scale, offset, axis, angle));
+        return o;
+    }
+
+    bool isInstance() const { return prototype != nullptr; }
+
+    // the triangles this object renders, in its own space (the prototype's for an instance)
+    const triangleMesh &geometry() const { return prototype ? prototype->mesh : mesh; }
+
+    // places an instance, the bounding sphere follows the prototype's
+    void setTransform(const affineTransform &placement)
+    {
+        if (!prototype)
+            throw std::logic_error("object::setTransform(): only instances have a transform");
+        toWorld = placement;
+        toObject = placement.inverse();
+        center = toWorld.apply(prototype->center);
+        sphereRadius = prototype->sphereRadius * toWorld.maxScale();
+    }
+
+    // spatial grid optimisation, built on the workers of pool when one is given
+    void enableGrid(std::size_t divisions, threadPool *pool = nullptr, cellBinning binning = cellBinning::exact)
     {
         // Clamp divisions to a safe range [1, MAX_DIVISIONS]
         constexpr std::size_t MIN_DIVISIONS = 1;
@@ -93,14 +149,91 @@ public:
 
         divisions = std::clamp(divisions, MIN_DIVISIONS, MAX_DIVISIONS);
 
-        if (boundingGrid != nullptr)
+        // instances share the grid of the prototype, built by the first one that asks
+        if (prototype)
         {
-            delete boundingGrid; // Clean up existing grid if any
+            if (!prototype->boundingGrid || prototype->boundingGrid->Divisions() != divisions || prototype->boundingGrid->Binning() != binning)
+                prototype->enableGrid(divisions, pool, binning);
+            gridEnabled = true;
+            accel = acceleration::grid;
+            return;
         }
 
-        boundingGrid = new sphereBoundingGrid(center, sphereRadius, divisions, vertices);
-        boundingGrid->PrecomputeNeighbors();
+        boundingGrid = std::make_shared<sphereBoundingGrid>(center, sphereRadius, divisions, mesh, pool, binning);
         gridEnabled = true;
+        accel = acceleration::grid;
+    }
+
+    // bounding volume hierarchy optimisation (SAH built), replaces the grid when enabled
+    void enableBVH(std::size_t maxLeafSize = 4, threadPool *pool = nullptr)
+    {
+        // the hierarchy keeps at least one triangle per leaf
+        const std::size_t leafSize = std::max<std::size_t>(maxLeafSize, 1);
+        if (prototype)
+        {
+            if (!prototype->boundingVolume || prototype->boundingVolume->MaxLeafSize() != leafSize)
+                prototype->enableBVH(maxLeafSize, pool);
+            accel = acceleration::bvh;
+            return;
+        }
+
+        boundingVolume.reset();
+        accel = acceleration::bvh;
+
+        // nothing to build over (a mesh that failed to load), the casters test the empty mesh directly
+        if (mesh.empty())
+            return;
+
+        // a mesh loaded from a file comes with a tree built over the same triangles, only the boxes move
+        if (cachedHierarchy && cachedHierarchy->MaxLeafSize() == leafSize && cachedHierarchy->TriangleCount() == mesh.triangleCount())
+            boundingVolume = std::make_shared<boundingVolumeHierarchy>(mesh, cachedHierarchy->Nodes(), cachedHierarchy->TriangleIds(), maxLeafSize);
+        else
+            boundingVolume = std::make_shared<boundingVolumeHierarchy>(mesh, maxLeafSize, pool);
+    }
+
+    // adaptive grid optimisation: cubes split in 8 while they hold more than maxLeafTriangles
+    // triangles, up to maxDepth levels (a 2^maxDepth uniform grid at most)
+    void enableOctree(std::size_t maxLeafTriangles = 16, std::size_t maxDepth = 8, cellBinning binning = cellBinning::exact)
+    {
+        if (prototype)
+        {
+            if (!prototype->boundingOctree || prototype->boundingOctree->MaxLeafTriangles() != std::max<std::size_t>(maxLeafTriangles, 1) ||
+                prototype->boundingOctree->MaxDepth() != std::min(maxDepth, sparseVoxelOctree::kMaxDepth) ||
+                prototype->boundingOctree->Binning() != binning)
+                prototype->enableOctree(maxLeafTriangles, maxDepth, binning);
+            accel = acceleration::octree;
+            return;
+        }
+
+        boundingOctree = std::make_shared<sparseVoxelOctree>(center, sphereRadius, mesh, maxLeafTriangles, maxDepth, binning);
+        accel = acceleration::octree;
+    }
+
+    // select the acceleration structure, divisions is only used by the grid, binning by the grid and the octree
+    void enableAcceleration(acceleration mode, std::size_t divisions, threadPool *pool = nullptr, cellBinning binning = cellBinning::exact)
+    {
+        switch (mode)
+        {
+        case acceleration::grid:
+            enableGrid(divisions, pool, binning);
+            break;
+        case acceleration::bvh:
+            enableBVH(4, pool);
+            break;
+        case acceleration::octree:
+            enableOctree(16, 8, binning);
+            break;
+        default:
+            accel = acceleration::none;
+            break;
+        }
+    }
+
+    // heap bytes of the grid, hierarchy and octree this object owns, 0 for an instance (they are the prototype's)
+    std::size_t accelerationBytes() const
+    {
+        return (boundingGrid ? boundingGrid->MemoryBytes() : 0) + (boundingVolume ? boundingVolume->MemoryBytes() : 0) +
+               (boundingOctree ? boundingOctree->MemoryBytes() : 0);
     }
 
     void cube(double scaling, point offset, vec3 axis = vec3(0, 0, 0), double angle = 0)
@@ -134,72 +267,49 @@ public:
         }
         center /= cubeVertices.size();
 
-        // Create object vertices for two triangles in the z = 0 plane
-        const vector<vector<point>>
-            v = {
-                // Bottom face
-                {cubeVertices[0], cubeVertices[1], cubeVertices[2]},
-                {cubeVertices[0], cubeVertices[2], cubeVertices[3]},
-
-                // Top face
-                {cubeVertices[4], cubeVertices[5], cubeVertices[6]},
-                {cubeVertices[4], cubeVertices[6], cubeVertices[7]},
-
-                // Front face
-                {cubeVertices[0], cubeVertices[1], cubeVertices[5]},
-                {cubeVertices[0], cubeVertices[5], cubeVertices[4]},
-
-                // Back face
-                {cubeVertices[2], cubeVertices[3], cubeVertices[7]},
-                {cubeVertices[2], cubeVertices[7], cubeVertices[6]},
-
-                // Left face
-                {cubeVertices[0], cubeVertices[3], cubeVertices[7]},
-                {cubeVertices[0], cubeVertices[7], cubeVertices[4]},
-
-                // Right face
-                {cubeVertices[1], cubeVertices[2], cubeVertices[6]},
-                {cubeVertices[1], cubeVertices[6], cubeVertices[5]}};
-
-        colorMap[{cubeVertices[0], cubeVertices[1], cubeVertices[2]}] = color(255, 0, 0); // White
-        colorMap[{cubeVertices[0], cubeVertices[2], cubeVertices[3]}] = color(255, 0, 0); // White
+        // 12 triangles over the 8 shared corners, 2 per face
+        mesh = triangleMesh();
+        cachedHierarchy.reset();
+        mesh.positions = cubeVertices;
+        mesh.palette = {
+            color(255, 0, 0),   // Bottom & Top : Red
+            color(0, 0, 255),   // Front : Blue
+            color(0, 255, 255), // Back : Cyan
+            color(255, 255, 0), // Left : Yellow
+            color(0, 255, 0)};  // Right : Green
+
+        // Bottom face
+        mesh.addTriangle(0, 1, 2, 0);
+        mesh.addTriangle(0, 2, 3, 0);
 
         // Top face
-
-        colorMap[{cubeVertices[4], cubeVertices[5], cubeVertices[6]}] = color(255, 0, 0); // Red
-        colorMap[{cubeVertices[4], cubeVertices[6], cubeVertices[7]}] = color(255, 0, 0); // Red
+        mesh.addTriangle(4, 5, 6, 0);
+        mesh.addTriangle(4, 6, 7, 0);
 
         // Front face
-        colorMap[{cubeVertices[0], cubeVertices[1], cubeVertices[5]}] = color(0, 0, 255); // Blue
-        colorMap[{cubeVertices[0], cubeVertices[5], cubeVertices[4]}] = color(0, 0, 255); // Blue
+        mesh.addTriangle(0, 1, 5, 1);
+        mesh.addTriangle(0, 5, 4, 1);
 
         // Back face
-        colorMap[{cubeVertices[2], cubeVertices[3], cubeVertices[7]}] = color(0, 255, 255); // Cyan
-        colorMap[{cubeVertices[2], cubeVertices[7], cubeVertices[6]}] = color(0, 255, 255); // Cyan
+        mesh.addTriangle(2, 3, 7, 2);
+        mesh.addTriangle(2, 7, 6, 2);
 
         // Left face
-        colorMap[{cubeVertices[0], cubeVertices[3], cubeVertices[7]}] = color(255, 255, 0); // Yellow
-        colorMap[{cubeVertices[0], cubeVertices[7], cubeVertices[4]}] = color(255, 255, 0); // Yellow
+        mesh.addTriangle(0, 3, 7, 3);
+        mesh.addTriangle(0, 7, 4, 3);
 
         // Right face
-        colorMap[{cubeVertices[1], cubeVertices[2], cubeVertices[6]}] = color(0, 255, 0); // Green
-        colorMap[{cubeVertices[1], cubeVertices[6], cubeVertices[5]}] = color(0, 255, 0); // Green
-
-        vertices = v;
+        mesh.addTriangle(1, 2, 6, 4);
+        mesh.addTriangle(1, 6, 5, 4);
 
         sphereRadius = 0;
         // creating a relative sphere at with it center the center of the mesh and its radius the farthers point from that center
-        for (size_t i = 0; i < vertices.size(); i++)
+        for (const point &p : mesh.positions)
         {
-            for (size_t j = 0; j < vertices.at(i).size(); j++)
+            double tempdistance = gmath::distance(center, p);
+            if (tempdistance > sphereRadius)
             {
-                double tempdistance = gmath::distance(center, vertices[i][j]);
-                // cout << tempdistance;
-                if (tempdistance > sphereRadius)
-                {
-                    // sphereRadius = (tempdistance > sphereRadius) ? tempdistance : sphereRadius;
-                    sphereRadius = tempdistance;
-                }
+                sphereRadius = tempdistance;
             }
         }
         sphereRadius *= 2;
@@ -207,24 +317,35 @@ public:
 
     void MoveTo(point target)
     {
-        map<array<point, 3>, color> newcolorMap;
-        const point origin = center;
-        const vec3 translationDirection = target - origin;
-        for (size_t i = 0; i < vertices.size(); i++)
+        if (prototype)
         {
-            array<point, 3> triangle = {
-                vertices[i][0],
-                vertices[i][1],
-                vertices[i][2]};
+            const vec3 shift = target - center;
+            affineTransform moved = toWorld;
+            moved.translation[0] += shift.x();
+            moved.translation[1] += shift.y();
+            moved.translation[2] += shift.z();
+            setTransform(moved);
+            return;
+        }
 
-            array<point, 3> newTriangle = {
-                vertices[i][0] + translationDirection,
-                vertices[i][1] + translationDirection,
-                vertices[i][2] + translationDirection};
+        const point origin = center;
+        const vec3 translationDirection = target - origin;
+        mesh.translate(translationDirection);
+        center = target;
 
-            newcolorMap[newTriangle] = colorMap.at(triangle);
+        // the acceleration structures are built in world space, rebuild them at the new location
+        if (boundingGrid != nullptr)
+        {
+            enableGrid(boundingGrid->Divisions(), nullptr, boundingGrid->Binning());
+        }
+        if (boundingVolume != nullptr)
+        {
+            enableBVH(boundingVolume->MaxLeafSize());
+        }
+        if (boundingOctree != nullptr)
+        {
+            enableOctree(boundingOctree->MaxLeafTriangles(), boundingOctree->MaxDepth(), boundingOctree->Binning());
         }
-        colorMap = newcolorMap;
     }
 
     void sphere(double scaling, point offset, vec3 axis = vec3(0, 0, 0), double angle = 0)
@@ -257,85 +378,88 @@ public:
         loadMesh(".\\Mesh\\Suzane.txt", scaling, offset, axis, angle);
         randomColoring();
     }
+    // OBJ usemtl groups keep one color per group, meshes without groups get one per triangle
+    void meshFile(const string &path, double scaling, point offset, vec3 axis = vec3(0, 0, 0), double angle = 0, threadPool *pool = nullptr)
+    {
+        loadMesh(path, scaling, offset, axis, angle, pool);
+        if (mesh.palette.size() > 1)
+        {
+            for (color &c : mesh.palette)
+                c.randomColor();
+        }
+        else
+        {
+            randomColoring();
+        }
+    }
     void randomColoring()
     {
-        for (size_t i = 0; i < vertices.size(); i++)
+        // an instance recolors its own copy of the palette, the shared mesh keeps its colors
+        if (prototype)
         {
-            for (size_t j = 0; j < vertices[i].size(); j++)
-            {
-                color temp;
-                temp.randomColor(); // Generate random color
-                colorMap[{vertices[i][0], vertices[i][1], vertices[i][2]}] = temp;
-            }
+            instanceColors.resize(prototype->mesh.palette.size());
+            for (color &c : instanceColors)
+                c.randomColor();
+            return;
+        }
+        for (size_t i = 0; i < mesh.triangleCount(); i++)
+        {
+            color temp;
+            temp.randomColor(); // Generate random color
+            mesh.setTriangleColor(i, temp);
         }
     }
 
     void setColor(color c)
     {
-        for (size_t i = 0; i < vertices.size(); i++)
-        {
-            for (size_t j = 0; j < vertices[i].size(); j++)
-            {
-                colorMap[{vertices[i][0], vertices[i][1], vertices[i][2]}] = c;
-            }
-        }
+        mesh.setColor(c);
     }
-    void loadMesh(string mame, double scaling, point offset, vec3 axis = vec3(0, 0, 0), double angle = 0)
+    // pool parses a text mesh in parallel when it isn't cached yet
+    void loadMesh(string mame, double scaling, point offset, vec3 axis = vec3(0, 0, 0), double angle = 0, threadPool *pool = nullptr)
     {
         std::string filename = mame;
-        MeshReader reader(filename);
-        std::vector<std::vector<point>> ver;
-        if (!reader.convertMesh(&ver))
+        cachedMesh cached;
+        try
         {
-            std::cerr << "Error: Unable to load or convert the mesh from file: " << filename << std::endl;
+            cached = meshCache::load(filename, pool);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: Unable to load or convert the mesh from file: " << filename << " (" << e.what() << ")" << std::endl;
             return;
         }
 
-        vector<vector<point>> meshVertices;
-        size_t div = 0; // helps calculate the total number of verticies for a later use
-        center = vec3(0, 0, 0);
-
-        for (size_t i = 0; i < ver.size(); i++)
+        // the cached mesh is in file coordinates, each object places its own copy
+        mesh = *cached.mesh;
+        const bool rotate = !(angle == 0 || axis == vec3::zero() || (gmath::magnitude(axis) < 1e-6));
+        for (point &p : mesh.positions)
         {
-            vector<point> temp;
-            for (size_t j = 0; j < ver.at(i).size(); j++)
-            {
-                point unfilteredPosition = (ver.at(i).at(j) * scaling + offset);
-                point rotatedPosition = unfilteredPosition;
-                if (angle == 0 || axis == vec3::zero() || (gmath::magnitude(axis) < 1e-6))
-                {
-                    rotatedPosition = unfilteredPosition;
-                }
-                else
-                {
-                    rotatedPosition = quaternion::rotate(unfilteredPosition, angle, axis);
-                }
-
-                temp.push_back(rotatedPosition);
-                center += rotatedPosition; // sum all the positions
-                div++;                     // increment the div which is the total number of verticies
-            }
-            meshVertices.push_back(temp);
+            point unfilteredPosition = (p * scaling + offset);
+            p = rotate ? quaternion::rotate(unfilteredPosition, angle, axis) : unfilteredPosition;
         }
 
-        if (div == 0)
+        if (mesh.indices.empty())
         {
             throw std::runtime_error("Division by zero: no vertices were processed during mesh loading.");
         }
-        center /= div;
-        vertices = meshVertices;
+        // mean over the triangle corners, shared positions count once per use
+        center = vec3(0, 0, 0);
+        for (std::uint32_t v : mesh.indices)
+        {
+            center += mesh.positions[v];
+        }
+        center /= mesh.indices.size();
+        mesh.computeRecords();
+        cachedHierarchy = cached.hierarchy;
 
         sphereRadius = 0;
         // creating a relative sphere at with it center the center of the mesh and its radius the farthers point from that center
-        for (size_t i = 0; i < vertices.size(); i++)
+        for (const point &p : mesh.positions)
         {
-            for (size_t j = 0; j < vertices.at(i).size(); j++)
+            double tempdistance = gmath::distance(center, p);
+            if (tempdistance > sphereRadius)
             {
-                double tempdistance = gmath::distance(center, vertices[i][j]);
-                if (tempdistance > sphereRadius)
-                {
-                    sphereRadius = tempdistance;
-                }
+                sphereRadius = tempdistance;
             }
         }
         sphereRadius *= 2;
@@ -345,16 +469,16 @@ public:
     // output operator
     friend ostream &operator<<(ostream &os, const object &obj)
     {
-        os << "Object(" << obj.vertices.size() << " vertices)\n";
+        os << "Object(" << obj.mesh.triangleCount() << " triangles, " << obj.mesh.vertexCount() << " vertices)\n";
         os << "Center : " << obj.center << "\n";
         os << "Sphere Radius : " << obj.sphereRadius << "\n";
 
-        for (size_t i = 0; i < obj.vertices.size(); ++i)
+        for (size_t i = 0; i < obj.mesh.triangleCount(); ++i)
         {
             os << "  ";
-            for (size_t j = 0; j < obj.vertices[i].size(); ++j)
+            for (size_t j = 0; j < 3; ++j)
             {
-                os << obj.vertices[i][j] << " | ";
+                os << obj.mesh.vertex(i, j) << " | ";
             }
             os << "\n";
         }
@@ -364,19 +488,15 @@ public:
     // Equality operator
     bool operator==(const object &other) const
     {
-        if (vertices.size() != other.vertices.size())
+        if (mesh.triangleCount() != other.mesh.triangleCount())
         {
             return false;
         }
-        for (size_t i = 0; i < vertices.size(); ++i)
+        for (size_t i = 0; i < mesh.triangleCount(); ++i)
         {
-            if (vertices[i].size() != other.vertices[i].size())
-            {
-                return false;
-            }
-            for (size_t j = 0; j < vertices[i].size(); ++j)
+            for (size_t j = 0; j < 3; ++j)
             {
-                if (vertices[i][j] != other.vertices[i][j])
+                if (mesh.vertex(i, j) != other.mesh.vertex(i, j))
                 {
                     return false;
                 }
@@ -73,7 +73,7 @@ public:
 
     void Save()
     {
-        ImageRenderer::renderToFile(img, "perlin.ppm");
+        ImageRenderer::renderToFile(img, "perlin.png");
     }
 
     double get(double x, double y)
@@ -6,7 +6,7 @@ int main1() {
     image img(256, 256);
 
     // Output file path
-    std::string outputPath = "output.ppm";
+    std::string outputPath = "output.png";
 
     // Render the image and save it to the file
     ImageRenderer::renderToFile(img, outputPath);
@@ -0,0 +1,238 @@
+/**
+ * @file rayCaster.h
+ * @brief Defines the rayCaster class, the nearest-hit and occlusion queries shared by the cameras and the bounce tracer.
+ */
+#ifndef RAYCASTER_H
+#define RAYCASTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "ray.h"
+#include "gmath.h"
+#include "general.h"
+#include "sceneView.h"
+#include "traceStats.h"
+#include "triangleIntersection.h"
+#include "triangleBlock.h"
+#include "rayMailbox.h"
+
+/**
+ * @class rayCaster
+ * @brief Finds the nearest triangle a ray hits in one object or in the whole scene, or only whether
+ * anything blocks it before a distance, through the object's grid, octree or BVH (every triangle
+ * when it has none). Holds no state besides its two settings, so any number of threads can share one.
+ */
+class rayCaster
+{
+public:
+    triangleTest mode = triangleTest::mollerTrumbore;
+    bool mailboxing = true; // a triangle met again in a later grid / octree cell is not tested twice by a ray
+
+    // Nearest hit of r over the scene closer than bestDist, through the top-level hierarchy.
+    // Returns the object hit (nullptr on a miss), tri and bestDist are then its triangle and distance.
+    const objectView *intersectScene(const ray &r, const sceneView &scene, double &bestDist, std::size_t &tri, traceStats &counters) const
+    {
+        const objectView *nearest = nullptr;
+        scene.hierarchy().VisitRay(r, bestDist, [&](std::size_t index)
+                                   {
+            std::size_t objectTri = 0;
+            if (intersectObject(r, scene[index], bestDist, objectTri, counters))
+            {
+                nearest = &scene[index];
+                tri = objectTri;
+            } }, &counters);
+        return nearest;
+    }
+
+    // Nearest triangle of one object hit by r closer than bestDist (a world distance). Instances are
+    // traced in the space of their mesh and the distances converted back and forth.
+    bool intersectObject(const ray &r, const objectView &obj, double &bestDist, std::size_t &tri, traceStats &counters) const
+    {
+        double scale = 1;
+        const ray local = obj.localRay(r, scale);
+        double localDist = bestDist * scale;
+        const rayQuery query(local, mode);
+
+        bool hit = false;
+        if (obj.accel == acceleration::bvh && obj.bvh)
+        {
+            hit = obj.bvh->Intersect(*obj.mesh, query, localDist, tri, &counters);
+        }
+        else if (!obj.grid && !(obj.accel == acceleration::octree && obj.octree))
+        {
+            counters.rays++;
+            hit = nearestTriangle(*obj.mesh, query, localDist, tri, counters);
+        }
+        else
+        {
+            counters.rays++;
+            // the walk runs along the direction as given, whatever its length (instances rescale it too)
+            const double localLength = gmath::magnitude(local.getDirection());
+            // a triangle crossing several cells is referenced from each of them, the mailbox
+            // skips it in the later ones (lanes of a block included)
+            rayMailbox mailbox;
+            rayMailbox *tested = mailboxing ? &mailbox : nullptr;
+            // the grid and the octree hand the same cells over front to back
+            auto visitCell = [&](const CubeData &cube, double cubeDist)
+            {
+                // cubeDist runs along the unnormalized direction, localDist along the unit one
+                if (cubeDist * localLength > localDist)
+                    return false;
+
+                counters.nodesVisited++;
+
+                if (mode == triangleTest::mollerTrumbore && cube.blockCount)
+                    hit = nearestTriangle(cube.blocks, cube.blockCount, query, localDist, tri, counters, tested) || hit;
+                else
+                    hit = nearestTriangle(*obj.mesh, cube.triangles, cube.triangleCount, query, localDist, tri, counters, tested) || hit;
+                return true;
+            };
+            if (obj.accel == acceleration::octree && obj.octree)
+                obj.octree->VisitRay(local.getOrigine(), local.getDirection(), visitCell);
+            else
+                obj.grid->VisitRay(local.getOrigine(), local.getDirection(), visitCell);
+        }
+
+        if (hit)
+            bestDist = localDist / scale;
+        return hit;
+    }
+
+    // True when anything of the scene lies on r closer than maxDist (a world distance along r).
+    // Returns at the first triangle found in the first object that blocks, no nearest hit is kept.
+    bool occluded(const ray &r, const sceneView &scene, double maxDist, traceStats &counters) const
+    {
+        bool blocked = false;
+        double reach = maxDist;
+        scene.hierarchy().VisitRay(r, reach, [&](std::size_t index)
+                                   {
+            if (blocked || !occludedObject(r, scene[index], maxDist, counters))
+                return;
+            blocked = true;
+            reach = 0; // prunes every box left on the stack
+        }, &counters);
+        return blocked;
+    }
+
+    // nothing of the scene between the points from and to (shadow rays, light visibility)
+    bool visible(const point &from, const point &to, const sceneView &scene, traceStats &counters) const
+    {
+        const vec3 d = to - from;
+        const double dist = gmath::magnitude(d);
+        if (dist == 0)
+            return true;
+        return !occluded(ray(from, d), scene, dist, counters);
+    }
+
+    // any triangle of one object hit by r closer than maxDist, through its BVH, octree or grid
+    bool occludedObject(const ray &r, const objectView &obj, double maxDist, traceStats &counters) const
+    {
+        double scale = 1;
+        const rayQuery query(obj.localRay(r, scale), mode);
+        const double localDist = maxDist * scale;
+
+        if (obj.accel == acceleration::bvh && obj.bvh)
+            return obj.bvh->Occluded(*obj.mesh, query, localDist, &counters);
+
+        rayMailbox mailbox;
+        rayMailbox *tested = mailboxing ? &mailbox : nullptr;
+        if (obj.accel == acceleration::octree && obj.octree)
+            return obj.octree->Occluded(*obj.mesh, query, localDist, &counters, tested);
+        if (obj.grid)
+            return obj.grid->Occluded(*obj.mesh, query, localDist, &counters, tested);
+
+        counters.rays++;
+        for (std::size_t t = 0; t < obj.mesh->triangleCount(); ++t)
+        {
+            counters.triangleTests++;
+            if (query.occludes(*obj.mesh, t, localDist))
+            {
+                counters.hits++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // every triangle of the mesh
+    static bool nearestTriangle(const triangleMesh &mesh, const rayQuery &query, double &bestDist, std::size_t &tri,
+                                traceStats &counters)
+    {
+        bool hit = false;
+        triangleHit th;
+        for (std::size_t t = 0; t < mesh.triangleCount(); ++t)
+        {
+            counters.triangleTests++;
+            if (!query.intersect(mesh, t, th) || th.t >= bestDist)
+                continue;
+
+            hit = true;
+            bestDist = th.t;
+            tri = t;
+            counters.hits++;
+        }
+        return hit;
+    }
+
+    // the triangles of one grid cell, the ones in tested are skipped
+    static bool nearestTriangle(const triangleMesh &mesh, const std::uint32_t *tris, std::size_t count, const rayQuery &query,
+                                double &bestDist, std::size_t &tri, traceStats &counters, rayMailbox *tested)
+    {
+        bool hit = false;
+        triangleHit th;
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            const std::uint32_t t = tris[k];
+            if (tested && tested->testedBefore(t))
+            {
+                counters.mailboxSkips++;
+                continue;
+            }
+            counters.triangleTests++;
+            if (!query.intersect(mesh, t, th) || th.t >= bestDist)
+                continue;
+
+            hit = true;
+            bestDist = th.t;
+            tri = t;
+            counters.hits++;
+        }
+        return hit;
+    }
+
+    // the 8-wide blocks of one grid cell, the kernel returns the nearest lane of each block;
+    // lanes in tested are masked and a block with none left is skipped
+    static bool nearestTriangle(const triangleBlock *blocks, std::size_t count, const rayQuery &query, double &bestDist,
+                                std::size_t &tri, traceStats &counters, rayMailbox *tested = nullptr)
+    {
+        bool hit = false;
+        float tMax = static_cast<float>(bestDist);
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            const triangleBlock &block = blocks[k];
+            std::uint32_t lanes = triangleBlockKernel::kAllLanes;
+            if (tested)
+            {
+                lanes = tested->untestedLanes(block.ids, block.count);
+                counters.mailboxSkips += block.count - cpuFeatures::bitCount(lanes);
+                if (!lanes)
+                    continue;
+                tested->recordLanes(block.ids, block.count);
+            }
+            counters.triangleTests += tested ? cpuFeatures::bitCount(lanes) : block.count;
+            float t;
+            const int lane = triangleBlockKernel::intersect(query, block, tMax, t, lanes);
+            if (lane < 0)
+                continue;
+
+            hit = true;
+            tMax = t;
+            bestDist = t;
+            tri = block.ids[lane];
+            counters.hits++;
+        }
+        return hit;
+    }
+};
+
+#endif // RAYCASTER_H
@@ -0,0 +1,65 @@
+/**
+ * @file rayMailbox.h
+ * @brief Defines the rayMailbox class, the triangles one ray already tested while walking grid or octree cells.
+ */
+#ifndef RAYMAILBOX_H
+#define RAYMAILBOX_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class rayMailbox
+ * @brief Small cache of triangle ids, so a triangle referenced from several cells is intersected once per ray.
+ * Direct mapped on the low bits of the id: a collision evicts the older id, which is then
+ * only tested again, so the mailbox never changes a hit. One lives on the stack of each
+ * traced ray, there is no stamp to reset between rays and nothing shared between threads.
+ *
+ * The per-triangle loop asks for each id, the 8-wide block kernel masks the lanes already
+ * tested (untestedLanes) and records the block after testing it (recordLanes); a block
+ * with no lane left is not tested at all.
+ */
+class rayMailbox
+{
+public:
+    static constexpr std::size_t kSlots = 64;
+
+    rayMailbox()
+    {
+        for (std::size_t k = 0; k < kSlots; ++k)
+            slots[k] = kEmpty;
+    }
+
+    // true when this ray already tested triangle id, otherwise it is recorded as tested
+    bool testedBefore(std::uint32_t id)
+    {
+        std::uint32_t &slot = slots[id & (kSlots - 1)];
+        if (slot == id)
+            return true;
+        slot = id;
+        return false;
+    }
+
+    // bit k set when ids[k] (k < count) wasn't tested yet, nothing is recorded
+    std::uint32_t untestedLanes(const std::uint32_t *ids, std::uint32_t count) const
+    {
+        std::uint32_t lanes = 0;
+        for (std::uint32_t k = 0; k < count; ++k)
+            if (slots[ids[k] & (kSlots - 1)] != ids[k])
+                lanes |= 1u << k;
+        return lanes;
+    }
+
+    // records ids[0 .. count) as tested
+    void recordLanes(const std::uint32_t *ids, std::uint32_t count)
+    {
+        for (std::uint32_t k = 0; k < count; ++k)
+            slots[ids[k] & (kSlots - 1)] = ids[k];
+    }
+
+private:
+    static constexpr std::uint32_t kEmpty = 0xffffffffu;
+    std::uint32_t slots[kSlots];
+};
+
+#endif // RAYMAILBOX_H
@@ -0,0 +1,242 @@
+/**
+ * @file renderProfile.h
+ * @brief Defines the per-pixel cost map of a camera and the render profile written by space::saveProfile().
+ *
+ * Both are only filled in a build with RAYCAST_PROFILE defined (g++ -DRAYCAST_PROFILE ...). Without
+ * it the cameras neither snapshot their counters around each pixel nor keep a cost map, and the
+ * tiles are not timed, so a regular build pays nothing for the instrumentation.
+ */
+#ifndef RENDERPROFILE_H
+#define RENDERPROFILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "color.h"
+#include "image.h"
+#include "traceStats.h"
+
+// work of the rays of one pixel: grid cells / octree leaves / BVH nodes visited, triangle tests and new nearest hits
+struct pixelCost
+{
+    std::uint32_t nodes = 0;
+    std::uint32_t tests = 0;
+    std::uint32_t hits = 0;
+};
+
+enum class costField
+{
+    nodes,
+    tests,
+    hits
+};
+
+/**
+ * @class costMap
+ * @brief Traversal counters of every pixel of one camera, row by row. A block traced as one ray
+ * packet splits the work of the packet evenly between its pixels; anti-aliasing samples add to
+ * the pixel they refine.
+ */
+class costMap
+{
+public:
+    void reset(unsigned int w, unsigned int h)
+    {
+        width = w;
+        height = h;
+        costs.assign(static_cast<std::size_t>(w) * h, pixelCost());
+    }
+
+    bool empty() const { return costs.empty(); }
+    unsigned int getwidth() const { return width; }
+    unsigned int getheight() const { return height; }
+
+    // adds the work counted between before and after to the rows x cols block at row i0, column j0
+    void add(unsigned int i0, unsigned int j0, unsigned int rows, unsigned int cols, const traceStats &before, const traceStats &after)
+    {
+        const std::size_t n = static_cast<std::size_t>(rows) * cols;
+        const std::size_t nodes = after.nodesVisited - before.nodesVisited;
+        const std::size_t tests = after.triangleTests - before.triangleTests;
+        const std::size_t hits = after.hits - before.hits;
+
+        std::size_t k = 0;
+        for (unsigned i = i0; i < i0 + rows; ++i)
+        {
+            for (unsigned j = j0; j < j0 + cols; ++j, ++k)
+            {
+                pixelCost &c = costs[static_cast<std::size_t>(i) * width + j];
+                c.nodes += share(nodes, n, k);
+                c.tests += share(tests, n, k);
+                c.hits += share(hits, n, k);
+            }
+        }
+    }
+
+    std::uint32_t value(unsigned int i, unsigned int j, costField field) const
+    {
+        return pick(costs[static_cast<std::size_t>(i) * width + j], field);
+    }
+
+    // sum of one counter over the image
+    std::size_t total(costField field) const
+    {
+        std::size_t sum = 0;
+        for (const pixelCost &c : costs)
+            sum += pick(c, field);
+        return sum;
+    }
+
+    // q-quantile (0 to 1) of one counter over every pixel, nearest rank
+    std::uint32_t percentile(costField field, double q) const
+    {
+        if (costs.empty())
+            return 0;
+        std::vector<std::uint32_t> values(costs.size());
+        std::transform(costs.begin(), costs.end(), values.begin(), [&](const pixelCost &c)
+                       { return pick(c, field); });
+        const std::size_t rank = std::min(values.size() - 1, static_cast<std::size_t>(q * (values.size() - 1) + 0.5));
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+    // False-color image of one counter: black where the pixel cost nothing, then blue to red up
+    // to the 99th percentile, so a handful of extreme pixels doesn't flatten the rest (they saturate red).
+    image heatmap(costField field) const
+    {
+        image out(height, width);
+        const double scale = std::max<std::uint32_t>(1, percentile(field, 0.99));
+        for (unsigned i = 0; i < height; ++i)
+        {
+            for (unsigned j = 0; j < width; ++j)
+            {
+                const std::uint32_t v = value(i, j, field);
+                out.set(i, j, v == 0 ? color(0, 0, 0) : heatColor(v / scale));
+            }
+        }
+        return out;
+    }
+
+    // blue, cyan, green, yellow then red as t goes from 0 to 1
+    static color heatColor(double t)
+    {
+        static const double stops[5][3] = {{0, 0, 255}, {0, 255, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0}};
+        const double x = std::clamp(t, 0.0, 1.0) * 4;
+        const int k = std::min(3, static_cast<int>(x));
+        const double f = x - k;
+        return color(stops[k][0] + (stops[k + 1][0] - stops[k][0]) * f,
+                     stops[k][1] + (stops[k + 1][1] - stops[k][1]) * f,
+                     stops[k][2] + (stops[k + 1][2] - stops[k][2]) * f);
+    }
+
+    // {"width": .., "height": .., "nodes": {"mean", "p50", "p99", "max"}, "tests": {..}, "hits": {..}}
+    void writeJson(std::ostream &os) const
+    {
+        const std::size_t pixels = std::max<std::size_t>(1, costs.size());
+        os << "{\"width\": " << width << ", \"height\": " << height;
+        const char *names[3] = {"nodes", "tests", "hits"};
+        const costField fields[3] = {costField::nodes, costField::tests, costField::hits};
+        for (int f = 0; f < 3; ++f)
+        {
+            os << ", \"" << names[f] << "\": {\"mean\": " << static_cast<double>(total(fields[f])) / pixels
+               << ", \"p50\": " << percentile(fields[f], 0.5)
+               << ", \"p99\": " << percentile(fields[f], 0.99)
+               << ", \"max\": " << percentile(fields[f], 1.0) << "}";
+        }
+        os << "}";
+    }
+
+private:
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<pixelCost> costs;
+
+    static std::uint32_t pick(const pixelCost &c, costField field)
+    {
+        switch (field)
+        {
+        case costField::nodes:
+            return c.nodes;
+        case costField::tests:
+            return c.tests;
+        default:
+            return c.hits;
+        }
+    }
+
+    // part k of total split over n pixels, the remainder goes one each to the first pixels
+    static std::uint32_t share(std::size_t total, std::size_t n, std::size_t k)
+    {
+        return static_cast<std::uint32_t>(total / n + (k < total % n ? 1 : 0));
+    }
+};
+
+/**
+ * @struct renderProfile
+ * @brief Summary of one profiled render: totals, the counters and busy time of each worker of the
+ * thread pool, and the time of every tile.
+ */
+struct renderProfile
+{
+    double ms = 0;                        // wall time of the render
+    std::size_t cameraRays = 0;           // primary rays and anti-aliasing samples of every camera
+    traceStats total;                     // merged counters
+    std::vector<traceStats> workers;      // counters of each worker
+    std::vector<double> workerBusyMs;     // time each worker spent on tiles
+    std::vector<std::size_t> workerTasks; // tiles each worker ran, every stage counted
+    std::vector<double> tileMs;           // every tile, primary rays and refinement together
+
+    double raysPerSecond() const
+    {
+        return ms > 0 ? cameraRays / (ms / 1000.0) : 0.0;
+    }
+
+    // q-quantile (0 to 1) of the tile times, nearest rank
+    double tilePercentile(double q) const
+    {
+        if (tileMs.empty())
+            return 0;
+        std::vector<double> sorted = tileMs;
+        const std::size_t rank = std::min(sorted.size() - 1, static_cast<std::size_t>(q * (sorted.size() - 1) + 0.5));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+    // the summary and the per-pixel statistics of each camera as one JSON object
+    void writeJson(std::ostream &os, const std::vector<const costMap *> &cameras) const
+    {
+        const double perRay = cameraRays ? 1.0 / cameraRays : 0.0;
+        os << "{\n"
+           << "  \"elapsed_ms\": " << ms << ",\n"
+           << "  \"camera_rays\": " << cameraRays << ",\n"
+           << "  \"rays_per_second\": " << raysPerSecond() << ",\n"
+           << "  \"object_rays\": " << total.rays << ",\n"
+           << "  \"nodes_visited\": " << total.nodesVisited << ",\n"
+           << "  \"triangle_tests\": " << total.triangleTests << ",\n"
+           << "  \"hits\": " << total.hits << ",\n"
+           << "  \"nodes_per_ray\": " << total.nodesVisited * perRay << ",\n"
+           << "  \"tests_per_ray\": " << total.triangleTests * perRay << ",\n"
+           << "  \"tiles\": {\"count\": " << tileMs.size() << ", \"p50_ms\": " << tilePercentile(0.5)
+           << ", \"p99_ms\": " << tilePercentile(0.99) << ", \"max_ms\": " << tilePercentile(1.0) << "},\n"
+           << "  \"workers\": [";
+        for (std::size_t w = 0; w < workers.size(); ++w)
+        {
+            os << (w ? ",\n" : "\n") << "    {\"rays\": " << workers[w].rays
+               << ", \"nodes_visited\": " << workers[w].nodesVisited
+               << ", \"triangle_tests\": " << workers[w].triangleTests
+               << ", \"hits\": " << workers[w].hits
+               << ", \"busy_ms\": " << (w < workerBusyMs.size() ? workerBusyMs[w] : 0.0)
+               << ", \"tasks\": " << (w < workerTasks.size() ? workerTasks[w] : 0) << "}";
+        }
+        os << "\n  ],\n  \"cameras\": [";
+        for (std::size_t c = 0; c < cameras.size(); ++c)
+        {
+            os << (c ? ",\n    " : "\n    ");
+            cameras[c]->writeJson(os);
+        }
+        os << "\n  ]\n}\n";
+    }
+};
+
+#endif // RENDERPROFILE_H
@@ -0,0 +1,346 @@
+/**
+ * @file sceneHierarchy.h
+ * @brief Defines the sceneHierarchy class, the top-level BVH over the world bounds of the objects of a scene.
+ */
+#ifndef SCENEHIERARCHY_H
+#define SCENEHIERARCHY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "point.h"
+#include "ray.h"
+#include "traceStats.h"
+#include "boundingVolumeHierarchy.h"
+
+/**
+ * @class sceneHierarchy
+ * @brief Top level of the two-level scheme: leaves hold object indices, each object keeps its
+ * own grid / BVH below. A ray walks it near to far and only reaches the objects whose box it
+ * enters before its current nearest hit, so the cost grows with log(objects) instead of with
+ * the object count. Built with a full SAH sweep, object counts are small next to triangle counts.
+ */
+class sceneHierarchy
+{
+public:
+    static constexpr std::size_t kMaxLeafSize = 2;
+    static constexpr std::size_t kMaxDepth = 60;
+    static constexpr std::size_t kMaxPacket = boundingVolumeHierarchy::kMaxPacket;
+
+    sceneHierarchy() = default;
+
+    // boxes[k] is the world box of object k
+    explicit sceneHierarchy(const std::vector<std::pair<point, point>> &boxes)
+    {
+        if (boxes.empty())
+            return;
+
+        m_boxes.reserve(boxes.size());
+        for (const auto &b : boxes)
+        {
+            Box box;
+            box.Grow(b.first);
+            box.Grow(b.second);
+            m_boxes.push_back(box);
+        }
+        m_objects.resize(boxes.size());
+        for (std::size_t k = 0; k < boxes.size(); ++k)
+            m_objects[k] = static_cast<std::uint32_t>(k);
+
+        m_nodes.reserve(2 * boxes.size());
+        m_nodes.emplace_back();
+        Subdivide(0, 0, static_cast<std::uint32_t>(boxes.size()), 0);
+        m_boxes.clear();
+        m_boxes.shrink_to_fit();
+    }
+
+    bool Empty() const { return m_nodes.empty(); }
+    std::size_t NodeCount() const { return m_nodes.size(); }
+
+    // Calls visit(objectIndex) for every object whose box r enters before bestDist, nearest box
+    // first. visit may lower bestDist (a world distance along the unit direction of r), the remaining boxes are pruned with it.
+    template <typename Visitor>
+    void VisitRay(const ray &r, const double &bestDist, Visitor &&visit, traceStats *stats = nullptr) const
+    {
+        if (m_nodes.empty())
+            return;
+
+        const point o = r.getOrigine();
+        const double ros[3] = {o.get_x(), o.get_y(), o.get_z()};
+        double inv[3];
+        UnitInverse(r.getDirection(), inv);
+
+        std::pair<std::uint32_t, double> stack[kMaxDepth + 4];
+        std::size_t top = 0;
+        const double rootEntry = EntryDistance(m_nodes[0], ros, inv, bestDist);
+        if (rootEntry == kMiss)
+            return;
+        stack[top++] = {0, rootEntry};
+
+        while (top > 0)
+        {
+            const auto [nodeIdx, entry] = stack[--top];
+            if (entry >= bestDist)
+                continue;
+
+            const BVHNode &node = m_nodes[nodeIdx];
+            if (node.IsLeaf())
+            {
+                for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+                {
+                    if (stats)
+                        stats->objectTests++;
+                    visit(static_cast<std::size_t>(m_objects[k]));
+                }
+                continue;
+            }
+
+            std::uint32_t nearIdx = node.leftFirst;
+            std::uint32_t farIdx = node.leftFirst + 1;
+            double nearDist = EntryDistance(m_nodes[nearIdx], ros, inv, bestDist);
+            double farDist = EntryDistance(m_nodes[farIdx], ros, inv, bestDist);
+            if (farDist < nearDist)
+            {
+                std::swap(nearIdx, farIdx);
+                std::swap(nearDist, farDist);
+            }
+            // pushed far first so the near child is popped next
+            if (farDist != kMiss)
+                stack[top++] = {farIdx, farDist};
+            if (nearDist != kMiss)
+                stack[top++] = {nearIdx, nearDist};
+        }
+    }
+
+    // Packet version: an object is visited when at least one of the count rays enters its box
+    // before bestDist[ray]; visit(objectIndex) traces the whole packet and updates bestDist.
+    template <typename Visitor>
+    void VisitPacket(const ray *const *rays, std::size_t count, const double *bestDist, Visitor &&visit,
+                     traceStats *stats = nullptr) const
+    {
+        if (m_nodes.empty() || count == 0)
+            return;
+
+        count = std::min(count, kMaxPacket);
+        double ros[kMaxPacket][3], inv[kMaxPacket][3];
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            const point o = rays[k]->getOrigine();
+            ros[k][0] = o.get_x();
+            ros[k][1] = o.get_y();
+            ros[k][2] = o.get_z();
+            UnitInverse(rays[k]->getDirection(), inv[k]);
+        }
+
+        // nearest entry over the rays that still can find something closer in the node
+        auto packetEntry = [&](const BVHNode &node)
+        {
+            double nearest = kMiss;
+            for (std::size_t k = 0; k < count; ++k)
+            {
+                const double entry = EntryDistance(node, ros[k], inv[k], bestDist[k]);
+                if (entry < bestDist[k])
+                    nearest = std::min(nearest, entry);
+            }
+            return nearest;
+        };
+
+        std::pair<std::uint32_t, double> stack[kMaxDepth + 4];
+        std::size_t top = 0;
+        if (packetEntry(m_nodes[0]) == kMiss)
+            return;
+        stack[top++] = {0, 0.0};
+
+        while (top > 0)
+        {
+            const std::uint32_t nodeIdx = stack[--top].first;
+            const BVHNode &node = m_nodes[nodeIdx];
+            // the hits found since the push may have pruned the node for every ray
+            if (nodeIdx != 0 && packetEntry(node) == kMiss)
+                continue;
+
+            if (node.IsLeaf())
+            {
+                for (std::uint32_t k = node.leftFirst; k < node.leftFirst + node.count; ++k)
+                {
+                    if (stats)
+                        stats->objectTests++;
+                    visit(static_cast<std::size_t>(m_objects[k]));
+                }
+                continue;
+            }
+
+            std::uint32_t nearIdx = node.leftFirst;
+            std::uint32_t farIdx = node.leftFirst + 1;
+            double nearDist = packetEntry(m_nodes[nearIdx]);
+            double farDist = packetEntry(m_nodes[farIdx]);
+            if (farDist < nearDist)
+            {
+                std::swap(nearIdx, farIdx);
+                std::swap(nearDist, farDist);
+            }
+            if (farDist != kMiss)
+                stack[top++] = {farIdx, farDist};
+            if (nearDist != kMiss)
+                stack[top++] = {nearIdx, nearDist};
+        }
+    }
+
+private:
+    static constexpr double kMiss = std::numeric_limits<double>::infinity();
+
+    std::vector<BVHNode> m_nodes;
+    std::vector<std::uint32_t> m_objects; // leaf order
+
+    struct Box
+    {
+        double lo[3] = {kMiss, kMiss, kMiss};
+        double hi[3] = {-kMiss, -kMiss, -kMiss};
+
+        void Grow(const point &p)
+        {
+            const double v[3] = {p.get_x(), p.get_y(), p.get_z()};
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], v[a]);
+                hi[a] = std::max(hi[a], v[a]);
+            }
+        }
+
+        void Grow(const Box &b)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], b.lo[a]);
+                hi[a] = std::max(hi[a], b.hi[a]);
+            }
+        }
+
+        double Area() const
+        {
+            if (lo[0] > hi[0])
+                return 0.0;
+            const double ex = hi[0] - lo[0], ey = hi[1] - lo[1], ez = hi[2] - lo[2];
+            return 2.0 * (ex * ey + ey * ez + ez * ex);
+        }
+
+        double Centroid(int a) const { return 0.5 * (lo[a] + hi[a]); }
+    };
+
+    // build-time only, indexed by object
+    std::vector<Box> m_boxes;
+
+    static double SafeInverse(double d)
+    {
+        return std::fabs(d) > 1e-12 ? 1.0 / d : kMiss;
+    }
+
+    // Inverse of the unit direction of d: the entry distances then run along the unit direction like
+    // bestDist (rayQuery normalizes too), whatever the length of the ray's direction.
+    static void UnitInverse(const vec3 &d, double inv[3])
+    {
+        const double len = std::sqrt(d.x() * d.x() + d.y() * d.y() + d.z() * d.z());
+        const double scale = len > 0 ? 1.0 / len : 0.0;
+        inv[0] = SafeInverse(d.x() * scale);
+        inv[1] = SafeInverse(d.y() * scale);
+        inv[2] = SafeInverse(d.z() * scale);
+    }
+
+    // same slab test as boundingVolumeHierarchy
+    static double EntryDistance(const BVHNode &node, const double ros[3], const double inv[3], double maxDist)
+    {
+        const double lo[3] = {node.boundsMin.get_x(), node.boundsMin.get_y(), node.boundsMin.get_z()};
+        const double hi[3] = {node.boundsMax.get_x(), node.boundsMax.get_y(), node.boundsMax.get_z()};
+
+        double tEnter = 0.0;
+        double tExit = maxDist;
+        for (int a = 0; a < 3; ++a)
+        {
+            if (inv[a] == kMiss)
+            {
+                if (ros[a] < lo[a] || ros[a] > hi[a])
+                    return kMiss;
+                continue;
+            }
+            double t1 = (lo[a] - ros[a]) * inv[a];
+            double t2 = (hi[a] - ros[a]) * inv[a];
+            if (t1 > t2)
+                std::swap(t1, t2);
+            tEnter = std::max(tEnter, t1);
+            tExit = std::min(tExit, t2);
+            if (tEnter > tExit)
+                return kMiss;
+        }
+        return tEnter;
+    }
+
+    // node covers m_objects[first, first + count); the node's children are appended as a pair
+    void Subdivide(std::uint32_t nodeIdx, std::uint32_t first, std::uint32_t count, std::size_t depth)
+    {
+        Box bounds;
+        for (std::uint32_t k = first; k < first + count; ++k)
+            bounds.Grow(m_boxes[m_objects[k]]);
+
+        // boxes are stored in float, round outwards so the float box still holds the objects
+        m_nodes[nodeIdx].boundsMin = point(std::nextafter(static_cast<float>(bounds.lo[0]), -HUGE_VALF),
+                                           std::nextafter(static_cast<float>(bounds.lo[1]), -HUGE_VALF),
+                                           std::nextafter(static_cast<float>(bounds.lo[2]), -HUGE_VALF));
+        m_nodes[nodeIdx].boundsMax = point(std::nextafter(static_cast<float>(bounds.hi[0]), HUGE_VALF),
+                                           std::nextafter(static_cast<float>(bounds.hi[1]), HUGE_VALF),
+                                           std::nextafter(static_cast<float>(bounds.hi[2]), HUGE_VALF));
+        m_nodes[nodeIdx].leftFirst = first;
+        m_nodes[nodeIdx].count = count;
+
+        if (count <= kMaxLeafSize || depth >= kMaxDepth)
+            return;
+
+        // exact SAH: every split between sorted centroids on every axis
+        int bestAxis = -1;
+        std::uint32_t bestSplit = 0;
+        double bestCost = static_cast<double>(count) * bounds.Area();
+        std::vector<double> rightArea(count);
+        for (int a = 0; a < 3; ++a)
+        {
+            std::sort(m_objects.begin() + first, m_objects.begin() + first + count, [&](std::uint32_t x, std::uint32_t y)
+                      { return m_boxes[x].Centroid(a) < m_boxes[y].Centroid(a); });
+
+            Box right;
+            for (std::uint32_t k = count; k-- > 1;)
+            {
+                right.Grow(m_boxes[m_objects[first + k]]);
+                rightArea[k] = right.Area();
+            }
+            Box left;
+            for (std::uint32_t k = 1; k < count; ++k)
+            {
+                left.Grow(m_boxes[m_objects[first + k - 1]]);
+                const double cost = k * left.Area() + (count - k) * rightArea[k];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = k;
+                }
+            }
+        }
+        if (bestAxis < 0)
+            return;
+
+        std::sort(m_objects.begin() + first, m_objects.begin() + first + count, [&](std::uint32_t x, std::uint32_t y)
+                  { return m_boxes[x].Centroid(bestAxis) < m_boxes[y].Centroid(bestAxis); });
+
+        const std::uint32_t leftIdx = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+        m_nodes.emplace_back();
+        m_nodes[nodeIdx].leftFirst = leftIdx;
+        m_nodes[nodeIdx].count = 0;
+        Subdivide(leftIdx, first, bestSplit, depth + 1);
+        Subdivide(leftIdx + 1, first + bestSplit, count - bestSplit, depth + 1);
+    }
+};
+
+#endif // SCENEHIERARCHY_H
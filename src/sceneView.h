@@ -0,0 +1,171 @@
+/**
+ * @file sceneView.h
+ * @brief Defines the objectView and sceneView classes, read-only views of the objects used by the render kernels.
+ */
+#ifndef SCENEVIEW_H
+#define SCENEVIEW_H
+
+#include <map>
+#include <utility>
+#include <vector>
+#include "object.h"
+#include "sceneHierarchy.h"
+
+using namespace std;
+
+/**
+ * @struct objectView
+ * @brief Non-owning, read-only handle on the render data of an object.
+ * Copying it copies a few pointers, the mesh, texture and acceleration
+ * structures stay in the object, which must outlive the view.
+ * For an instance, mesh / grid / bvh / octree are the prototype's (object space) and
+ * toObject / toWorld are set; they stay null for objects baked in world space.
+ */
+struct objectView
+{
+    const triangleMesh *mesh = nullptr;
+    const color *palette = nullptr; // the instance's own colors, null to use the mesh's
+    const texture *tex = nullptr;
+    const sphereBoundingGrid *grid = nullptr;
+    const boundingVolumeHierarchy *bvh = nullptr;
+    const sparseVoxelOctree *octree = nullptr;
+    acceleration accel = acceleration::none;
+    const affineTransform *toObject = nullptr;
+    const affineTransform *toWorld = nullptr;
+    std::uint32_t index = 0; // position in the sceneView, the object's in the scene
+    point center;
+    double radius = 0;
+    bool emissive = false;
+
+    objectView() {}
+
+    explicit objectView(const object &o)
+        : mesh(&o.geometry()),
+          palette(o.instanceColors.empty() ? nullptr : o.instanceColors.data()),
+          tex(&o.tex),
+          grid(o.isInstance() ? o.prototype->boundingGrid.get() : o.boundingGrid.get()),
+          bvh(o.isInstance() ? o.prototype->boundingVolume.get() : o.boundingVolume.get()),
+          octree(o.isInstance() ? o.prototype->boundingOctree.get() : o.boundingOctree.get()),
+          accel(o.accel),
+          toObject(o.isInstance() ? &o.toObject : nullptr),
+          toWorld(o.isInstance() ? &o.toWorld : nullptr),
+          center(o.center),
+          radius(o.sphereRadius),
+          emissive(o.isEmisive)
+    {
+    }
+
+    bool hasTexture() const { return tex && !tex->empty(); }
+
+    const color &triangleColor(std::size_t tri) const
+    {
+        return palette ? palette[mesh->colorIds[tri]] : mesh->triangleColor(tri);
+    }
+
+    // r in the space of the mesh. distanceScale converts a distance along r into one along the
+    // returned ray (rayQuery normalizes directions), 1 when the object is baked in world space
+    ray localRay(const ray &r, double &distanceScale) const
+    {
+        if (!toObject)
+        {
+            distanceScale = 1;
+            return r;
+        }
+        const vec3 d = r.getDirection();
+        const vec3 local = toObject->applyVector(d);
+        const double length = gmath::magnitude(d);
+        distanceScale = length > 0 ? gmath::magnitude(local) / length : 1;
+        return ray(toObject->apply(r.getOrigine()), local);
+    }
+};
+
+/**
+ * @class sceneView
+ * @brief Views of every object of a scene, built once per render and shared by the workers.
+ * It also builds the top-level hierarchy over the world boxes of the objects.
+ * The objects must not be moved or modified while the view is in use.
+ */
+class sceneView
+{
+public:
+    sceneView() {}
+
+    explicit sceneView(const vector<object> &objects)
+    {
+        views.reserve(objects.size());
+        for (const auto &o : objects)
+        {
+            views.emplace_back(o);
+            views.back().index = static_cast<std::uint32_t>(views.size() - 1);
+        }
+
+        // instances of one prototype share its mesh box
+        map<const triangleMesh *, pair<point, point>> meshBoxes;
+        vector<pair<point, point>> boxes;
+        boxes.reserve(views.size());
+        for (const auto &v : views)
+        {
+            auto it = meshBoxes.find(v.mesh);
+            if (it == meshBoxes.end())
+                it = meshBoxes.emplace(v.mesh, meshBox(*v.mesh)).first;
+            boxes.push_back(v.toWorld ? worldBox(it->second, *v.toWorld) : it->second);
+        }
+        top = sceneHierarchy(boxes);
+    }
+
+    size_t size() const { return views.size(); }
+    bool empty() const { return views.empty(); }
+
+    const objectView &operator[](size_t index) const { return views[index]; }
+
+    vector<objectView>::const_iterator begin() const { return views.begin(); }
+    vector<objectView>::const_iterator end() const { return views.end(); }
+
+    const sceneHierarchy &hierarchy() const { return top; }
+
+private:
+    vector<objectView> views;
+    sceneHierarchy top;
+
+    static pair<point, point> meshBox(const triangleMesh &mesh)
+    {
+        if (mesh.positions.empty())
+            return {point(0, 0, 0), point(0, 0, 0)};
+        point lo = mesh.positions[0], hi = mesh.positions[0];
+        for (const point &p : mesh.positions)
+        {
+            lo = point(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+            hi = point(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+        }
+        return {lo, hi};
+    }
+
+    // box of the 8 transformed corners, widened a little: the instance is traced in its own
+    // space and the world box must not clip what that trace can hit
+    static pair<point, point> worldBox(const pair<point, point> &box, const affineTransform &toWorld)
+    {
+        double lo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, hi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+        for (int c = 0; c < 8; ++c)
+        {
+            const point corner((c & 1) ? box.second.x() : box.first.x(),
+                               (c & 2) ? box.second.y() : box.first.y(),
+                               (c & 4) ? box.second.z() : box.first.z());
+            const point p = toWorld.apply(corner);
+            const double v[3] = {p.x(), p.y(), p.z()};
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], v[a]);
+                hi[a] = std::max(hi[a], v[a]);
+            }
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            const double pad = 1e-5 * (hi[a] - lo[a] + 1.0);
+            lo[a] -= pad;
+            hi[a] += pad;
+        }
+        return {point(lo[0], lo[1], lo[2]), point(hi[0], hi[1], hi[2])};
+    }
+};
+
+#endif // SCENEVIEW_H
@@ -1,7 +1,12 @@
 #ifndef SPACE_H
 #define SPACE_H
 
+#include <filesystem>
+#include <fstream>
 #include <future>
+#include <map>
+#include <unordered_set>
+#include <atomic>
 #include <vector>
 #include <thread>
 #include <iostream>
@@ -9,6 +14,7 @@
 #include "camera.h"
 #include "ppm.cpp"
 #include "RayTrace.h"
+#include "threadPool.h"
 
 using namespace std;
 
@@ -24,6 +30,71 @@ class space
 public:
     vector<object> obj;
     vector<camera> cameras;
+    traceStats renderStats;
+    shared_ptr<threadPool> pool;
+
+    // side in pixels of the square tiles handed to the thread pool
+    unsigned int tileSize = 16;
+
+    // ray / triangle kernel used by the cameras and the ray tracer
+    triangleTest triangleMode = triangleTest::mollerTrumbore;
+
+    // side of the square ray packets traced by the cameras, 1 traces single rays
+    unsigned int packetSize = 1;
+
+    // adaptive anti-aliasing of the cameras, off by default (see adaptiveSampling)
+    adaptiveSampling antialiasing;
+
+    // scene files load repeated meshes as instances of one prototype instead of baked copies
+    bool instancing = true;
+
+    // rays skip the triangles they already tested in an earlier grid / octree cell
+    bool mailboxing = true;
+
+    // cells of the grids and octrees built next reference the triangles crossing them, or every triangle whose box touches them
+    cellBinning binning = cellBinning::exact;
+
+    // time and memory of the last acceleration structure build, reported apart from the render
+    struct buildReport
+    {
+        double ms = 0;
+        size_t structures = 0; // grids / hierarchies built, a prototype shared by instances counts once
+        size_t bytes = 0;      // heap held by them
+    };
+    buildReport lastBuild;
+
+    // what a progressive render may spend before it stops, 0 leaves a limit off
+    struct renderBudget
+    {
+        double ms = 0;   // wall clock of the passes
+        size_t rays = 0; // primary rays traced
+    };
+
+    // how far the last progressive render got
+    struct progressReport
+    {
+        unsigned int passes = 0; // passes finished
+        unsigned int stride = 0; // pixel spacing of the last finished pass, 1 when the image is complete
+        size_t rays = 0;
+        double ms = 0;        // wall clock of the whole call
+        double previewMs = 0; // of it, spent writing the previews
+
+        bool complete() const { return stride == 1; }
+
+        friend std::ostream &operator<<(std::ostream &os, const progressReport &r)
+        {
+            os << "passes: " << r.passes << " | stride: " << r.stride << " | rays: " << r.rays
+               << " | elapsed: " << r.ms << " ms";
+            if (r.previewMs > 0)
+                os << " | previews: " << r.previewMs << " ms";
+            os << (r.complete() ? " | complete" : " | stopped by the budget");
+            return os;
+        }
+    };
+    progressReport lastProgress;
+
+    // counters and timings of the last launchThreadedCamera, filled in a RAYCAST_PROFILE build only
+    renderProfile lastProfile;
 
     // Constructors and Destructor
     space() : obj(), cameras() {}
@@ -43,10 +114,113 @@ public:
 
     void enableGrid(std::size_t divisions)
     {
+        buildAcceleration([&](object &o, threadPool *workers)
+                          { o.enableGrid(divisions, workers, binning); });
+    }
+
+    void enableBVH(std::size_t maxLeafSize = 4)
+    {
+        buildAcceleration([&](object &o, threadPool *workers)
+                          { o.enableBVH(maxLeafSize, workers); });
+    }
+
+    void enableOctree(std::size_t maxLeafTriangles = 16, std::size_t maxDepth = 8)
+    {
+        buildAcceleration([&](object &o, threadPool *)
+                          { o.enableOctree(maxLeafTriangles, maxDepth, binning); });
+    }
+
+    void enableAcceleration(acceleration mode, std::size_t divisions)
+    {
+        buildAcceleration([&](object &o, threadPool *workers)
+                          { o.enableAcceleration(mode, divisions, workers, binning); });
+    }
+
+    // Runs enable(object, pool) for every object on the thread pool and fills lastBuild.
+    // Instances use their prototype's structure, so every prototype is built once before its
+    // instances are pointed at it. Large meshes are built one after the other with the whole
+    // pool working inside each; the small ones are built side by side, one per worker.
+    template <typename Enable>
+    void buildAcceleration(Enable &&enable)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        vector<object *> owners;
+        unordered_set<const object *> seen;
         for (auto &o : obj)
         {
-            o.enableGrid(divisions);
+            object *owner = o.isInstance() ? o.prototype.get() : &o;
+            if (seen.insert(owner).second)
+            {
+                owners.push_back(owner);
+            }
+        }
+
+        threadPool &workers = getThreadPool();
+        vector<object *> small;
+        for (object *o : owners)
+        {
+            if (o->geometry().triangleCount() >= boundingVolumeHierarchy::kParallelBuild)
+                enable(*o, &workers);
+            else
+                small.push_back(o);
+        }
+        workers.parallelFor(small.size(), [&](size_t k, size_t)
+                            { enable(*small[k], nullptr); });
+
+        // the prototypes are ready, instances only pick their structure up
+        for (auto &o : obj)
+        {
+            if (o.isInstance())
+                enable(o, nullptr);
+        }
+
+        lastBuild = buildReport();
+        lastBuild.structures = owners.size();
+        for (const object *o : owners)
+        {
+            lastBuild.bytes += o->accelerationBytes();
         }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        lastBuild.ms = elapsed.count();
+        std::cout << "acceleration build: " << lastBuild.ms << " ms | structures: " << lastBuild.structures
+                  << " | memory: " << lastBuild.bytes / 1024 << " KiB\n";
+    }
+
+    // false bakes every object of the next loaded scene into its own world space mesh
+    void setInstancing(bool enabled)
+    {
+        instancing = enabled;
+    }
+
+    // false tests a triangle again in every cell a ray meets it (to measure what the mailbox saves), applied at the next render
+    void setMailboxing(bool enabled)
+    {
+        mailboxing = enabled;
+    }
+
+    // cellBinning::bounds bins triangles by their bounding box (faster build, more references per cell)
+    void setCellBinning(cellBinning mode)
+    {
+        binning = mode;
+    }
+
+    // selects the ray / triangle kernel, applied to every camera at the next render
+    void setTriangleTest(triangleTest mode)
+    {
+        triangleMode = mode;
+    }
+
+    // 2 or 4 traces primary rays in 2x2 / 4x4 packets (BVH objects only), applied at the next render
+    void setPacketSize(unsigned int size)
+    {
+        packetSize = size;
+    }
+
+    // maxSamples 4 or 16 refines the edges found after the primary rays, applied at the next render
+    void setAntialiasing(const adaptiveSampling &settings)
+    {
+        antialiasing = settings;
     }
 
     // return the number of available threads on the system
@@ -57,90 +231,336 @@ public:
         return n > 0 ? n : 4; // 4 just in case it fails
     }
 
-    // trigger the camera ray behavior
+    // Traces every pixel of the camera through up to bounce reflections. The image is cut into
+    // tiles for the thread pool like launchThreadedCamera, each worker keeps its own counters.
     void triggerRayTrace(size_t bounce)
     {
+        if (bounce == 0 || bounce > RayTrace::kMaxBounce)
+        {
+            throw std::invalid_argument("space::triggerRayTrace(): bounce must be between 1 and " +
+                                        to_string(RayTrace::kMaxBounce) + ", got " + to_string(bounce));
+        }
+
         // for now it wil only support 1 camera
+        camera &cam = cameras.at(0);
+        auto start = std::chrono::high_resolution_clock::now();
 
-        vector<vector<RayTrace>> traceGrid;
+        const sceneView scene(obj);
+        rayCaster caster;
+        caster.mode = triangleMode;
+        caster.mailboxing = mailboxing;
+
+        const vector<tile> tiles = cam.makeTiles(tileSize);
+        threadPool &workers = getThreadPool();
+        vector<traceStats> counters(workers.size());
+        workers.parallelFor(tiles.size(), [&](size_t job, size_t worker)
+                            {
+            const tile &t = tiles[job];
+            for (unsigned y = t.y0; y < t.y1; ++y)
+            {
+                for (unsigned x = t.x0; x < t.x1; ++x)
+                {
+                    RayTrace trace(cam.get(x, y));
+                    trace.trace(bounce, scene, caster, counters[worker]);
+                    cam.setColor(y, x, trace.getPixelValue());
+                }
+            } });
+
+        renderStats.clear();
+        for (const auto &c : counters)
+        {
+            renderStats.merge(c);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> elapsed = end - start;
+        std::cout << "triggerRayTrace() elapsed time: " << elapsed.count() << " ms\n";
+        std::cout << renderStats << "\n";
+    }
+
+    // renders the single camera of the space through the tile scheduler and saves the image
+    void launchThreadedCameraSplit()
+    {
+        if (cameras.size() != 1)
+        {
+            throw std::runtime_error("launchThreadedCameraSplit() is only supported for a single camera in the space.");
+        }
+
+        launchThreadedCamera();
+
+        const encodeReport saved = ImageRenderer::renderToFile(cameras.at(0).getimage(), "stitched.png");
+        std::cout << "save " << saved << "\n";
+    }
+
+    // Renders every camera: each image is cut into tiles that the persistent thread pool
+    // works through, the workers write straight into the camera images.
+    void launchThreadedCamera()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
 
-        for (size_t i = 0; i < cameras.at(0).getwidth(); i++) // create a grid of raytracer rays of a size equivalent to the camera dimension
+        vector<pair<size_t, tile>> jobs;
+        for (size_t camIndex = 0; camIndex < cameras.size(); ++camIndex)
         {
-            vector<RayTrace> tempRow;
-            for (size_t j = 0; j < cameras.at(0).getheight(); j++)
+            cameras[camIndex].setTriangleTest(triangleMode);
+            cameras[camIndex].setPacketSize(packetSize);
+            cameras[camIndex].setMailboxing(mailboxing);
+            cameras[camIndex].setAntialiasing(antialiasing);
+            for (const tile &t : cameras[camIndex].makeTiles(tileSize))
             {
-                RayTrace newRay = RayTrace(cameras.at(0).getGridRay().at(i).at(j));
-                tempRow.push_back(newRay);
+                jobs.push_back({camIndex, t});
             }
-            traceGrid.push_back(tempRow);
         }
 
-        for (size_t i = 0; i < traceGrid.size(); i++) // trigger ray tracing one by one and assign a color in the image stored within the camera
+        const sceneView scene(obj);
+        threadPool &workers = getThreadPool();
+        vector<traceStats> counters(workers.size());
+#ifdef RAYCAST_PROFILE
+        lastProfile = renderProfile();
+        lastProfile.tileMs.assign(jobs.size(), 0.0);
+        lastProfile.workerBusyMs.assign(workers.size(), 0.0);
+        lastProfile.workerTasks.assign(workers.size(), 0);
+        for (camera &cam : cameras)
+        {
+            cam.resetCostMap();
+        }
+#endif
+        workers.parallelFor(jobs.size(), [&](size_t job, size_t worker)
+                            { timeTile(job, [&]
+                                       { cameras[jobs[job].first].renderTile(scene, jobs[job].second, counters[worker]); }); });
+        profileWorkers(workers);
+
+        // anti-aliasing: every edge is found on the finished images before any pixel is refined
+        size_t samples = 0;
+        if (antialiasing.enabled())
         {
-            for (size_t j = 0; j < traceGrid.at(i).size(); j++)
+            workers.parallelFor(jobs.size(), [&](size_t job, size_t)
+                                { timeTile(job, [&]
+                                           { cameras[jobs[job].first].markEdges(jobs[job].second); }); });
+            profileWorkers(workers);
+            vector<size_t> traced(workers.size(), 0);
+            workers.parallelFor(jobs.size(), [&](size_t job, size_t worker)
+                                { timeTile(job, [&]
+                                           { traced[worker] += cameras[jobs[job].first].refineTile(scene, jobs[job].second, counters[worker]); }); });
+            profileWorkers(workers);
+            for (size_t t : traced)
             {
-                //    void trace(const size_t Bounce, const vector<object> *objects)
-
-                traceGrid.at(i).at(j).trace(bounce, &obj);
-                // cout << traceGrid.at(i).at(j).getPixelValue() << endl;
-                cameras.at(0)
-                    .setColor(i, j, traceGrid.at(i).at(j).getPixelValue());
+                samples += t;
             }
         }
+
+        renderStats.clear();
+        for (const auto &c : counters)
+        {
+            renderStats.merge(c);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> elapsed = end - start;
+        std::cout << "test() elapsed time: " << elapsed.count() << " ms\n";
+        std::cout << renderStats << "\n";
+        if (antialiasing.enabled())
+        {
+            std::cout << "anti-aliasing samples: " << samples << "\n";
+        }
+        printWorkerTimings();
+
+#ifdef RAYCAST_PROFILE
+        lastProfile.ms = elapsed.count();
+        lastProfile.total = renderStats;
+        lastProfile.workers = counters;
+        lastProfile.cameraRays = samples;
+        for (const camera &cam : cameras)
+        {
+            lastProfile.cameraRays += static_cast<size_t>(cam.getwidth()) * cam.getheight();
+        }
+        std::cout << "profile: " << lastProfile.raysPerSecond() << " rays/s | tile p50: " << lastProfile.tilePercentile(0.5)
+                  << " ms | tile p99: " << lastProfile.tilePercentile(0.99) << " ms\n";
+#endif
     }
 
-    // This launches a thread for each camera
-    void launchThreadedCameraSplit()
+    // Writes the cost heatmaps of every camera after a launchThreadedCamera (prefix_nodes.png,
+    // prefix_tests.png and prefix_hits.png, numbered by camera when there are several) and the
+    // summary as prefix.json. Needs a build with RAYCAST_PROFILE defined.
+    void saveProfile(const string &prefix)
     {
+#ifdef RAYCAST_PROFILE
+        vector<const costMap *> maps;
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            const costMap &costs = cameras[i].getCostMap();
+            if (costs.empty())
+            {
+                throw std::logic_error("space::saveProfile(): no profiled render to save, call launchThreadedCamera() first");
+            }
+            maps.push_back(&costs);
+
+            const string base = cameras.size() > 1 ? prefix + "_" + to_string(i) : prefix;
+            ImageRenderer::renderToFile(costs.heatmap(costField::nodes), base + "_nodes.png", false);
+            ImageRenderer::renderToFile(costs.heatmap(costField::tests), base + "_tests.png", false);
+            ImageRenderer::renderToFile(costs.heatmap(costField::hits), base + "_hits.png", false);
+        }
 
-        // splits the camera
-        size_t originalH = 0;
-        size_t originalW = 0;
-        if (cameras.size() == 1)
+        std::ofstream json(prefix + ".json");
+        if (!json)
         {
+            throw std::runtime_error("space::saveProfile(): cannot write " + prefix + ".json");
+        }
+        lastProfile.writeJson(json, maps);
+#else
+        (void)prefix;
+        throw std::logic_error("space::saveProfile(): the costs are only counted in a build with RAYCAST_PROFILE defined");
+#endif
+    }
+
+    // Renders the cameras in coarse to fine passes (camera::renderPassTile) until the images are
+    // complete or the budget is spent. The budget is checked before each tile, so it is overshot
+    // by at most one tile per worker; an unfinished pass leaves the blocks of the previous one where
+    // it didn't reach. After every pass the images so far are written to previewPath (when set,
+    // numbered by camera when there are several); the time spent writing them is not charged to
+    // the budget, so a preview never cuts the tracing short.
+    progressReport launchProgressive(const renderBudget &budget, const string &previewPath = "")
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        auto elapsedMs = [&]()
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        };
 
-            originalH = cameras.at(0).getheight();
-            originalW = cameras.at(0).getwidth();
-            vector<camera> cam_list = cameras.at(0).splitCamera(cameras.at(0), getAvailableThreads());
-            cameras.clear();
-            cameras = cam_list;
+        vector<pair<size_t, tile>> jobs;
+        for (size_t camIndex = 0; camIndex < cameras.size(); ++camIndex)
+        {
+            cameras[camIndex].setTriangleTest(triangleMode);
+            cameras[camIndex].setMailboxing(mailboxing);
+            // every pass repaints its pixels, a hit kept from an earlier render would reject them
+            cameras[camIndex].resetDepth();
+            for (const tile &t : cameras[camIndex].makeTiles(tileSize))
+            {
+                jobs.push_back({camIndex, t});
+            }
         }
-        else
+
+        const sceneView scene(obj);
+        threadPool &workers = getThreadPool();
+        vector<traceStats> counters(workers.size());
+        std::atomic<size_t> traced{0};
+        std::atomic<bool> stopped{false};
+        progressReport report;
+        auto spent = [&]()
         {
-            throw std::runtime_error("launchThreadedCameraSplit() is only supported for a single camera in the space.");
+            return (budget.ms > 0 && elapsedMs() - report.previewMs >= budget.ms) ||
+                   (budget.rays > 0 && traced.load() >= budget.rays);
+        };
+
+        for (unsigned int pass = 0; pass < camera::kProgressivePasses && !stopped; ++pass)
+        {
+            workers.parallelFor(jobs.size(), [&](size_t job, size_t worker)
+                                {
+                if (stopped.load(std::memory_order_relaxed) || spent())
+                {
+                    stopped = true;
+                    return;
+                }
+                traced += cameras[jobs[job].first].renderPassTile(scene, jobs[job].second, pass, counters[worker]); });
+
+            if (!stopped)
+            {
+                report.passes = pass + 1;
+                report.stride = camera::passStride(pass);
+            }
+            if (!previewPath.empty())
+            {
+                const double before = elapsedMs();
+                savePreviews(previewPath);
+                report.previewMs += elapsedMs() - before;
+            }
         }
 
-        // launche the threads
-        launchThreadedCamera();
+        renderStats.clear();
+        for (const auto &c : counters)
+        {
+            renderStats.merge(c);
+        }
+        report.rays = traced;
+        report.ms = elapsedMs();
+        lastProgress = report;
 
-        // stitch the images back together
-        saveStitchedImage("stitched_output_", originalH, originalW);
+        std::cout << "launchProgressive() " << report << "\n";
+        std::cout << renderStats << "\n";
+        return report;
     }
 
-    // This launches a thread for each camera
-    void launchThreadedCamera()
+    // writes the image of every camera to path, numbered before the extension when there are several
+    void savePreviews(const string &path)
     {
-        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            std::filesystem::path p(path);
+            if (cameras.size() > 1)
+                p.replace_filename(p.stem().string() + "_" + to_string(i) + p.extension().string());
+            ImageRenderer::renderToFile(cameras[i].getimage(), p.string(), false);
+        }
+    }
 
-        std::vector<std::future<void>> futures;
+    // runs the work of tile job, timed into lastProfile in a profiling build
+    template <typename Work>
+    void timeTile(size_t job, Work &&work)
+    {
+#ifdef RAYCAST_PROFILE
+        const auto tileStart = std::chrono::high_resolution_clock::now();
+        work();
+        lastProfile.tileMs[job] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tileStart).count();
+#else
+        (void)job;
+        work();
+#endif
+    }
 
-        for (size_t camIndex = 0; camIndex < cameras.size(); ++camIndex)
+    // adds the busy time and tiles of each worker in the last parallelFor to lastProfile (profiling builds)
+    void profileWorkers(const threadPool &workers)
+    {
+#ifdef RAYCAST_PROFILE
+        const auto &timings = workers.lastTimings();
+        for (size_t w = 0; w < timings.size() && w < lastProfile.workerBusyMs.size(); ++w)
         {
-            futures.push_back(std::async(std::launch::async, [&, camIndex]()
-                                         {
-                for (auto& o : obj) {
-                    cameras[camIndex].cameraToImage(o);
-                } }));
+            lastProfile.workerBusyMs[w] += timings[w].busyMs;
+            lastProfile.workerTasks[w] += timings[w].tasks;
         }
+#else
+        (void)workers;
+#endif
+    }
 
-        for (auto &future : futures)
+    // busy / idle time of each worker during the last render
+    void printWorkerTimings()
+    {
+        if (!pool)
+            return;
+
+        const auto &timings = pool->lastTimings();
+        for (size_t w = 0; w < timings.size(); ++w)
         {
-            future.get();
+            std::cout << "worker " << w
+                      << " | busy: " << timings[w].busyMs << " ms"
+                      << " | idle: " << timings[w].idleMs << " ms"
+                      << " | tiles: " << timings[w].tasks
+                      << " | stolen: " << timings[w].stolen << "\n";
         }
+    }
 
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = end - start;
-        std::cout << "test() elapsed time: " << elapsed.count() << " ms\n";
+    // traversal counters of the last render
+    traceStats getStats() const
+    {
+        return renderStats;
+    }
+
+    // the pool is created on first use and kept for the following renders
+    threadPool &getThreadPool()
+    {
+        if (!pool)
+        {
+            pool = make_shared<threadPool>(getAvailableThreads());
+        }
+        return *pool;
     }
 
     // output the imges
@@ -155,30 +575,15 @@ public:
             saveImage(cameras[i], "output" + to_string(i));
         }
     }
-    void saveImage(camera c, string name = "output_")
+    void saveImage(const camera &c, string name = "output_", const string &extension = ".png")
     {
         if (name.empty() || name == "output_")
         {
             name = "output_" + to_string(chrono::high_resolution_clock::now().time_since_epoch().count());
         }
-        ImageRenderer::renderToFile(c.getimage(), name + ".ppm");
+        const encodeReport saved = ImageRenderer::renderToFile(c.getimage(), name + extension);
+        std::cout << "save " << saved << "\n";
     }
-    void saveStitchedImage(string name = "stitched_output_", size_t originalH = 0, size_t originalW = 0)
-    {
-        if (originalH == 0 || originalW == 0)
-        {
-            throw std::runtime_error("Original height and width must be provided for stitching.");
-        }
-
-        if (name.empty() || name == "stitched_output_")
-        {
-            name = "stitched_output_" + to_string(chrono::high_resolution_clock::now().time_since_epoch().count());
-        }
-        // stitch the images back together
-        image finalstitched = cameras.at(0).construct_split(cameras, originalH, originalW);
-        ImageRenderer::renderToFile(finalstitched, "stitched.ppm");
-    }
-
     // loading camera and objects from a scene file
     void loadFromFile(const string &path_to_scene)
     {
@@ -186,8 +591,8 @@ public:
         MeshReader reader;
         loadReader(path_to_scene, reader);
 
-        // Load objects
-        loadObjectFromFile(reader);
+        // Load objects, mesh paths are relative to the scene file
+        loadObjectFromFile(reader, std::filesystem::path(path_to_scene).parent_path().string());
 
         // Load camera
         loadCameraFromFile(reader);
@@ -264,8 +669,11 @@ public:
             addCamera(cam);
         }
     }
-    void loadObjectFromFile(const MeshReader &reader)
+    void loadObjectFromFile(const MeshReader &reader, const string &sceneDirectory = "")
     {
+        // one prototype per primitive type or mesh file, shared by all the instances placing it
+        map<string, shared_ptr<object>> prototypes;
+
         // Load objects
         for (const auto &objData : reader.sceneObjects)
         {
@@ -303,10 +711,46 @@ public:
                     (m10 - m01) / (2.0 * sinAngle));
             }
 
+            const point location(objData.location.x, objData.location.y, objData.location.z);
+            const primitive type = (primitive)objData.type;
+            string meshPath;
+            if (type == primitive::meshFile)
+            {
+                if (objData.path.empty())
+                {
+                    cerr << "Warning: mesh file object without a path, skipped" << endl;
+                    continue;
+                }
+                std::filesystem::path path(objData.path);
+                if (path.is_relative() && !sceneDirectory.empty())
+                    path = std::filesystem::path(sceneDirectory) / path;
+                meshPath = path.string();
+            }
+
+            if (instancing)
+            {
+                shared_ptr<object> &proto = prototypes[type == primitive::meshFile ? "file:" + meshPath : to_string(objData.type)];
+                if (!proto)
+                    proto = make_shared<object>(type == primitive::meshFile ? object(meshPath, 1, point(0, 0, 0), 0, vec3(0, 0, 0), &getThreadPool()) : object(type));
+                object instance = object::instanceOf(proto, avgScale, location, angleDeg, axis);
+                // colored on its own like a baked copy, the prototype's colors would be the same for every copy;
+                // a cube keeps its fixed face colors, baked cubes aren't recolored either
+                if (type != primitive::cube)
+                    instance.randomColoring();
+                addObject(instance);
+                continue;
+            }
+
+            if (type == primitive::meshFile)
+            {
+                addObject(object(meshPath, avgScale, location, angleDeg, axis, &getThreadPool()));
+                continue;
+            }
+
             object obj(
-                (primitive)objData.type,
+                type,
                 avgScale,
-                point(objData.location.x, objData.location.y, objData.location.z),
+                location,
                 angleDeg,
                 axis);
             addObject(obj);
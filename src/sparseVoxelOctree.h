@@ -0,0 +1,366 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include "point.h"
+#include "triangleMesh.h"
+#include "triangleBlock.h"
+#include "triangleBoxOverlap.h"
+#include "general.h"
+#include "sphereBoundingGrid.h"
+#include "cpuFeatures.h"
+
+// ---------------------------------------------------------------------
+// OctreeNode: one cube of the octree.
+//
+//   inner node : childMask != 0, bit k set when child k holds triangles; the
+//                children that exist are m_nodes[first ..] in increasing k
+//   leaf       : childMask == 0, its triangles are leaf first (see Leaf())
+//
+// Child k covers the half of its parent at +x when bit 0 of k is set, +y for
+// bit 1 and +z for bit 2, so k is the Morton code of the child. Siblings are
+// stored together and the tree is built depth first, which leaves the leaves
+// in Morton order. Empty children are not stored at all.
+// ---------------------------------------------------------------------
+struct OctreeNode
+{
+    std::uint32_t first = 0;
+    std::uint8_t childMask = 0;
+
+    bool IsLeaf() const { return childMask == 0; }
+};
+
+// Adaptive counterpart of sphereBoundingGrid over the same bounding cube: a
+// cube is only split in 8 while it holds more than maxLeafTriangles
+// triangles, so dense regions get small cells and empty space is skipped a
+// whole branch at a time. Leaves are stored as compressed rows like the grid
+// cells (triangle ids and 8-wide blocks) and VisitRay walks them front to back
+// with the grid's visitor signature.
+class sparseVoxelOctree
+{
+public:
+    static constexpr std::size_t kMaxDepth = 16; // bounds the traversal stack
+    static constexpr std::size_t kMaxDuplication = 3; // a split may reference a triangle in 3 children on average
+
+    // Triangles are referenced (by id) from every leaf they cross, or with cellBinning::bounds
+    // from every leaf their AABB touches. maxDepth caps the subdivision where triangles can't be
+    // separated (a vertex shared by many of them).
+    sparseVoxelOctree(const point &sphereCenter, double sphereRadius, const triangleMesh &mesh,
+                      std::size_t maxLeafTriangles = 16, std::size_t maxDepth = 8, cellBinning binning = cellBinning::exact)
+        : m_maxLeafTriangles(std::max<std::size_t>(maxLeafTriangles, 1)), m_maxDepth(std::min(maxDepth, kMaxDepth)), m_binning(binning)
+    {
+        if (sphereRadius <= 0.0)
+            throw std::invalid_argument("Sphere radius must be positive.");
+
+        m_origin = sphereCenter - point(sphereRadius, sphereRadius, sphereRadius);
+        m_size = sphereRadius * 2.0;
+
+        const std::array<double, 3> lo = {m_origin.get_x(), m_origin.get_y(), m_origin.get_z()};
+        m_triangleBounds.resize(mesh.triangleCount());
+        std::vector<std::uint32_t> ids;
+        ids.reserve(mesh.triangleCount());
+        for (std::size_t t = 0; t < mesh.triangleCount(); ++t)
+        {
+            Box &b = m_triangleBounds[t];
+            for (std::size_t c = 0; c < 3; ++c)
+                b.Grow(mesh.vertex(t, c));
+            if (b.Overlaps(lo, m_size))
+                ids.push_back(static_cast<std::uint32_t>(t));
+        }
+
+        m_scratch.resize(m_maxDepth + 1);
+        m_leafStart.push_back(0);
+        m_leafBlockStart.push_back(0);
+        m_nodes.emplace_back();
+        Build(mesh, 0, lo, m_size, ids, 0);
+
+        m_scratch.clear();
+        m_scratch.shrink_to_fit();
+        m_triangleBounds.clear();
+        m_triangleBounds.shrink_to_fit();
+        m_nodes.shrink_to_fit();
+        m_leafStart.shrink_to_fit();
+        m_leafBlockStart.shrink_to_fit();
+        m_triangles.shrink_to_fit();
+        m_blocks.shrink_to_fit();
+    }
+
+    std::size_t NodeCount() const { return m_nodes.size(); }
+    std::size_t LeafCount() const { return m_leafStart.size() - 1; }
+    std::size_t MaxLeafTriangles() const { return m_maxLeafTriangles; }
+    std::size_t MaxDepth() const { return m_maxDepth; }
+    cellBinning Binning() const { return m_binning; }
+    const std::vector<OctreeNode> &Nodes() const { return m_nodes; }
+
+    // the triangles of leaf index (OctreeNode::first of a leaf node)
+    CubeData Leaf(std::size_t index) const
+    {
+        CubeData leaf;
+        leaf.triangles = m_triangles.data() + m_leafStart[index];
+        leaf.triangleCount = m_leafStart[index + 1] - m_leafStart[index];
+        leaf.blocks = m_blocks.data() + m_leafBlockStart[index];
+        leaf.blockCount = m_leafBlockStart[index + 1] - m_leafBlockStart[index];
+        return leaf;
+    }
+
+    // triangle ids stored over all the leaves, a triangle counting once per leaf it is binned to
+    std::size_t TriangleReferences() const { return m_triangles.size(); }
+
+    // heap bytes held by the octree: the nodes, the offsets of the leaves, their triangle ids and blocks
+    std::size_t MemoryBytes() const
+    {
+        return m_nodes.capacity() * sizeof(OctreeNode) +
+               (m_leafStart.capacity() + m_leafBlockStart.capacity() + m_triangles.capacity()) * sizeof(std::uint32_t) +
+               m_blocks.capacity() * sizeof(triangleBlock);
+    }
+
+    // Walks the leaves pierced by the ray front to back and calls
+    // visit(const CubeData &cube, double cubeDist) for each, cubeDist being the distance
+    // (along rd, as for the grid) at which the ray enters it. The visitor returns false to
+    // stop the walk. Children of a cube are entered nearest first, empty ones never are.
+    template <typename Visitor>
+    void VisitRay(const point &ro, const point &rd, Visitor &&visit) const
+    {
+        const double o[3] = {ro.get_x(), ro.get_y(), ro.get_z()};
+        const double d[3] = {rd.get_x(), rd.get_y(), rd.get_z()};
+
+        struct Pending
+        {
+            std::uint32_t node;
+            double tEnter;
+            double lo[3];
+            double size;
+        };
+        Pending stack[8 * (kMaxDepth + 1)];
+        std::size_t top = 0;
+
+        Pending root{0, 0.0, {m_origin.get_x(), m_origin.get_y(), m_origin.get_z()}, m_size};
+        if (!Enter(o, d, root.lo, root.size, root.tEnter))
+            return;
+        stack[top++] = root;
+
+        while (top > 0)
+        {
+            const Pending cube = stack[--top];
+            const OctreeNode &node = m_nodes[cube.node];
+            if (node.IsLeaf())
+            {
+                const CubeData leaf = Leaf(node.first);
+                if (!leaf.Empty() && !visit(leaf, cube.tEnter))
+                    return;
+                continue;
+            }
+
+            // children the ray enters, pushed far to near so the nearest is popped first
+            Pending children[8];
+            std::size_t count = 0;
+            const double half = cube.size * 0.5;
+            std::uint32_t child = node.first;
+            for (int k = 0; k < 8; ++k)
+            {
+                if (!((node.childMask >> k) & 1u))
+                    continue;
+                Pending c{child++, 0.0, {cube.lo[0] + ((k & 1) ? half : 0.0), cube.lo[1] + ((k & 2) ? half : 0.0), cube.lo[2] + ((k & 4) ? half : 0.0)}, half};
+                if (!Enter(o, d, c.lo, c.size, c.tEnter))
+                    continue;
+
+                std::size_t at = count++;
+                for (; at > 0 && children[at - 1].tEnter < c.tEnter; --at)
+                    children[at] = children[at - 1];
+                children[at] = c;
+            }
+            for (std::size_t k = 0; k < count; ++k)
+                stack[top++] = children[k];
+        }
+    }
+
+    // Any hit closer than maxDist (shadow and visibility rays), the leaves walked like the
+    // grid's cubes in sphereBoundingGrid::Occluded.
+    bool Occluded(const triangleMesh &mesh, const rayQuery &query, double maxDist, traceStats *stats = nullptr,
+                  rayMailbox *tested = nullptr) const
+    {
+        if (stats)
+            stats->rays++;
+
+        bool blocked = false;
+        VisitRay(point(query.origin[0], query.origin[1], query.origin[2]),
+                 point(query.direction[0], query.direction[1], query.direction[2]),
+                 [&](const CubeData &leaf, double leafDist)
+                 {
+                     if (leafDist > maxDist)
+                         return false;
+                     if (stats)
+                         stats->nodesVisited++;
+                     blocked = leaf.Occludes(mesh, query, maxDist, tested, stats);
+                     return !blocked;
+                 });
+        if (blocked && stats)
+            stats->hits++;
+        return blocked;
+    }
+
+private:
+    struct Box
+    {
+        double lo[3] = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+        double hi[3] = {-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+
+        void Grow(const point &p)
+        {
+            const double v[3] = {p.get_x(), p.get_y(), p.get_z()};
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], v[a]);
+                hi[a] = std::max(hi[a], v[a]);
+            }
+        }
+
+        // touches the cube [cubeLo, cubeLo + size], boundaries included like the grid ranges
+        bool Overlaps(const std::array<double, 3> &cubeLo, double size) const
+        {
+            for (int a = 0; a < 3; ++a)
+                if (hi[a] < cubeLo[a] || lo[a] > cubeLo[a] + size)
+                    return false;
+            return true;
+        }
+    };
+
+    point m_origin;
+    double m_size = 0;
+    std::size_t m_maxLeafTriangles;
+    std::size_t m_maxDepth;
+    cellBinning m_binning;
+
+    std::vector<OctreeNode> m_nodes; // root first, siblings together
+
+    // compressed rows in Morton order: the ids of leaf i are m_triangles[m_leafStart[i] .. m_leafStart[i + 1]),
+    // its blocks m_blocks[m_leafBlockStart[i] .. m_leafBlockStart[i + 1])
+    std::vector<std::uint32_t> m_leafStart;
+    std::vector<std::uint32_t> m_leafBlockStart;
+    std::vector<std::uint32_t> m_triangles;
+    std::vector<triangleBlock> m_blocks;
+
+    // build-time only: box of every triangle, and the ids of the 8 children of the cube being
+    // split at each depth (reused from one cube to the next, so their storage is allocated once)
+    std::vector<Box> m_triangleBounds;
+    std::vector<std::array<std::vector<std::uint32_t>, 8>> m_scratch;
+
+    // lower corner of child k of the cube at lo, half being the side of the child
+    static std::array<double, 3> Corner(const std::array<double, 3> &lo, int k, double half)
+    {
+        return {lo[0] + ((k & 1) ? half : 0.0), lo[1] + ((k & 2) ? half : 0.0), lo[2] + ((k & 4) ? half : 0.0)};
+    }
+
+    // slab test against the cube [lo, lo + size]; tEnter is clamped to the ray origin
+    static bool Enter(const double o[3], const double d[3], const double lo[3], double size, double &tEnter)
+    {
+        tEnter = 0.0;
+        double tExit = std::numeric_limits<double>::infinity();
+        for (int a = 0; a < 3; ++a)
+        {
+            const double hi = lo[a] + size;
+            if (std::fabs(d[a]) < 1e-12)
+            {
+                if (o[a] < lo[a] || o[a] > hi)
+                    return false;
+                continue;
+            }
+            double t1 = (lo[a] - o[a]) / d[a];
+            double t2 = (hi - o[a]) / d[a];
+            if (t1 > t2)
+                std::swap(t1, t2);
+            tEnter = std::max(tEnter, t1);
+            tExit = std::min(tExit, t2);
+            if (tEnter > tExit)
+                return false;
+        }
+        return true;
+    }
+
+    // Splits the cube while it holds too many triangles and something can still be separated.
+    // The non-empty children are allocated together, then filled one after the other.
+    void Build(const triangleMesh &mesh, std::uint32_t nodeIdx, const std::array<double, 3> &lo, double size,
+               const std::vector<std::uint32_t> &ids, std::size_t depth)
+    {
+        std::array<std::vector<std::uint32_t>, 8> &childIds = m_scratch[depth];
+        for (auto &c : childIds)
+            c.clear();
+        std::uint8_t mask = 0;
+        const double half = size * 0.5;
+
+        if (ids.size() > m_maxLeafTriangles && depth < m_maxDepth)
+        {
+            // halves touched on each axis (bit 0 low, bit 1 high), the children are their combinations
+            const double mid[3] = {lo[0] + half, lo[1] + half, lo[2] + half};
+            std::size_t references = 0;
+            for (std::uint32_t t : ids)
+            {
+                const Box &b = m_triangleBounds[t];
+                unsigned halves[3];
+                for (int a = 0; a < 3; ++a)
+                    halves[a] = (b.lo[a] <= mid[a] ? 1u : 0u) | (b.hi[a] >= mid[a] ? 2u : 0u);
+                // a triangle inside one child crosses it, only the wider ones are tested
+                const bool test = m_binning == cellBinning::exact && (halves[0] == 3u || halves[1] == 3u || halves[2] == 3u);
+                for (int k = 0; k < 8; ++k)
+                {
+                    if (!((halves[0] & (1u << (k & 1))) && (halves[1] & (1u << ((k >> 1) & 1))) && (halves[2] & (1u << ((k >> 2) & 1)))))
+                        continue;
+                    if (test)
+                    {
+                        const std::array<double, 3> corner = Corner(lo, k, half);
+                        const double center[3] = {corner[0] + half * 0.5, corner[1] + half * 0.5, corner[2] + half * 0.5};
+                        if (!triangleBoxOverlap(mesh.triangle(t), center, half * 0.5))
+                            continue;
+                    }
+                    childIds[k].push_back(t);
+                    references++;
+                }
+            }
+            for (int k = 0; k < 8; ++k)
+                if (!childIds[k].empty())
+                    mask |= static_cast<std::uint8_t>(1u << k);
+
+            // triangles crossing the center (a fan around a shared vertex, faces larger than the
+            // cube) are copied in several children instead of being separated; past kMaxDuplication
+            // copies per triangle splitting further costs more memory than it saves tests
+            if (references > kMaxDuplication * ids.size())
+                mask = 0;
+        }
+
+        if (mask == 0)
+        {
+            const std::size_t firstBlock = m_blocks.size();
+            m_triangles.insert(m_triangles.end(), ids.begin(), ids.end());
+            m_blocks.resize(firstBlock + triangleBlockCount(ids.size()));
+            packTriangleBlocks(mesh, ids.data(), ids.size(), m_blocks.data() + firstBlock);
+            if (m_triangles.size() > std::numeric_limits<std::uint32_t>::max())
+                throw std::length_error("sparseVoxelOctree: more than 2^32 triangle references.");
+
+            m_nodes[nodeIdx].first = static_cast<std::uint32_t>(m_leafStart.size() - 1);
+            m_nodes[nodeIdx].childMask = 0;
+            m_leafStart.push_back(static_cast<std::uint32_t>(m_triangles.size()));
+            m_leafBlockStart.push_back(static_cast<std::uint32_t>(m_blocks.size()));
+            return;
+        }
+
+        const std::uint32_t first = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes[nodeIdx].first = first;
+        m_nodes[nodeIdx].childMask = mask;
+        m_nodes.resize(m_nodes.size() + static_cast<std::size_t>(cpuFeatures::bitCount(mask)));
+
+        std::uint32_t child = first;
+        for (int k = 0; k < 8; ++k)
+        {
+            if (!((mask >> k) & 1u))
+                continue;
+            Build(mesh, child++, Corner(lo, k, half), half, childIds[k], depth + 1);
+        }
+    }
+};
@@ -2,42 +2,95 @@
 
 #include <array>
 #include <vector>
-#include <unordered_map>
 #include <cstddef>
 #include <cmath>
 #include <stdexcept>
-#include <functional>
 #include <algorithm>
 #include <utility>
+#include <cstdint>
+#include <limits>
 #include "point.h"
 #include "Cube.h"
-
+#include "general.h"
+#include "triangleMesh.h"
+#include "triangleBlock.h"
+#include "triangleBoxOverlap.h"
+#include "triangleIntersection.h"
+#include "rayMailbox.h"
+#include "traceStats.h"
+#include "threadPool.h"
+
+// ---------------------------------------------------------------------
+// CubeData: the triangles of one cube, as handed to the ray visitors.
+//
+//   triangles[0 .. triangleCount)  ids into the object's triangleMesh
+//   blocks[0 .. blockCount)        the same triangles repacked 8 per block
+//
+// Both point into the flat arrays of the grid (or octree) owning the cube:
+// the ids of all its cubes follow each other in one array, cube i owning
+// [start[i], start[i + 1]) of it (compressed sparse rows), and the blocks
+// the same way. Nothing is allocated per cube.
+// ---------------------------------------------------------------------
 struct CubeData
 {
-    std::array<point, 4> bounds;
-    point origin;
-    std::vector<std::array<point, 3>> triples; // each entry is exactly 3 points
-    std::array<std::size_t, 6> neighbors;      // [left, right, front, back, bottom, top]
-};
+    const std::uint32_t *triangles = nullptr;
+    std::uint32_t triangleCount = 0;
+    const triangleBlock *blocks = nullptr;
+    std::uint32_t blockCount = 0;
+
+    bool Empty() const { return triangleCount == 0; }
+
+    // Any triangle of the cube hit closer than maxDist. The Möller–Trumbore blocks are tested
+    // 8 lanes at a time, the ids one by one with the watertight kernel; either way the
+    // triangles in tested are skipped.
+    bool Occludes(const triangleMesh &mesh, const rayQuery &query, double maxDist, rayMailbox *tested,
+                  traceStats *stats) const
+    {
+        if (query.mode == triangleTest::mollerTrumbore && blockCount)
+        {
+            const float tMax = static_cast<float>(maxDist);
+            for (std::uint32_t k = 0; k < blockCount; ++k)
+            {
+                const triangleBlock &block = blocks[k];
+                std::uint32_t lanes = triangleBlockKernel::kAllLanes;
+                if (tested)
+                {
+                    lanes = tested->untestedLanes(block.ids, block.count);
+                    if (stats)
+                        stats->mailboxSkips += block.count - cpuFeatures::bitCount(lanes);
+                    if (!lanes)
+                        continue;
+                    tested->recordLanes(block.ids, block.count);
+                }
+                if (stats)
+                    stats->triangleTests += tested ? cpuFeatures::bitCount(lanes) : block.count;
+                float t;
+                if (triangleBlockKernel::intersect(query, block, tMax, t, lanes) >= 0)
+                    return true;
+            }
+            return false;
+        }
 
-struct CubeEntry
-{
-    Cube cube;
-    CubeData data;
+        for (std::uint32_t k = 0; k < triangleCount; ++k)
+        {
+            if (tested && tested->testedBefore(triangles[k]))
+            {
+                if (stats)
+                    stats->mailboxSkips++;
+                continue;
+            }
+            if (stats)
+                stats->triangleTests++;
+            if (query.occludes(mesh, triangles[k], maxDist))
+                return true;
+        }
+        return false;
+    }
 };
 
 class sphereBoundingGrid
 {
 public:
-    // Empty-grid constructor.
-    sphereBoundingGrid(const point &sphereCenter, double sphereRadius, std::size_t divisions)
-        : m_center(sphereCenter), m_radius(sphereRadius), m_divisions(divisions)
-    {
-        Validate();
-        BuildBoundingCube();
-        Subdivide(nullptr, nullptr);
-    }
-
     // Returns the [min,max] cube index range along each axis that a triangle's AABB touches.
     bool TriangleCubeRange(const std::array<point, 3> &tri,
                            std::size_t &ixMin, std::size_t &ixMax,
@@ -82,63 +135,153 @@ public:
         return true;
     }
 
-    // Accelerated constructor: pass a vector of point-groups (no flattening).
-    // For each group:
-    //   - If all points in the group lie in the SAME cube AND group.size() >= 3,
-    //     that cube gets ALL possible triples from that group (triangle list: every 3 points).
-    //   - If the group's points span multiple cubes, or group.size() < 3,
-    //     the group is ignored (no partial assignment, no flattening).
+    // Every triangle of the mesh is referenced (by id) from each cube it crosses, or with
+    // cellBinning::bounds from each cube its AABB touches. Triangles whose first vertex lies
+    // outside the bounding cube are ignored.
+    // The cubes are stored as compressed rows: a count pass sizes every cube, a prefix sum turns
+    // the counts into offsets, then a fill pass writes the ids in place and the blocks are packed
+    // behind them. With a pool the cube ranges of the triangles are computed in parallel chunks
+    // and each worker counts, fills and packs the cubes of its own slabs of x, so no cube is
+    // shared. Triangle ids stay in ascending order in every cube, as in a serial build.
     sphereBoundingGrid(const point &sphereCenter, double sphereRadius, std::size_t divisions,
-                       const std::vector<std::vector<point>> &vertexGroups)
-        : m_center(sphereCenter), m_radius(sphereRadius), m_divisions(divisions)
+                       const triangleMesh &mesh, threadPool *pool = nullptr, cellBinning binning = cellBinning::exact)
+        : m_center(sphereCenter), m_radius(sphereRadius), m_divisions(divisions), m_binning(binning)
     {
         Validate();
         BuildBoundingCube();
 
-        std::unordered_map<std::size_t, std::vector<std::array<point, 3>>> cubeTriples;
-
-        for (const auto &group : vertexGroups)
+        // cube range of every triangle as {ixMin, ixMax, iyMin, iyMax, izMin, izMax}, ixMin > ixMax when ignored
+        const std::size_t n = mesh.triangleCount();
+        std::vector<std::array<std::uint32_t, 6>> ranges(n);
+        auto computeRanges = [&](std::size_t begin, std::size_t end)
         {
-            if (group.empty())
-                continue;
-
-            std::size_t firstIdx;
-            if (!TryIndexForPoint(group[0], firstIdx))
-                continue; // first point outside bounding cube -> ignore group
+            for (std::size_t t = begin; t < end; ++t)
+            {
+                std::size_t firstIdx, r[6];
+                if (!TryIndexForPoint(mesh.vertex(t, 0), firstIdx) ||
+                    !TriangleCubeRange(mesh.triangle(t), r[0], r[1], r[2], r[3], r[4], r[5]))
+                {
+                    ranges[t] = {1, 0, 0, 0, 0, 0};
+                    continue;
+                }
+                for (int k = 0; k < 6; ++k)
+                    ranges[t][k] = static_cast<std::uint32_t>(r[k]);
+            }
+        };
 
-            for (std::size_t i = 0; i + 2 < group.size(); i += 3)
+        // calls add(cube index, triangle) for every cube of the slabs [ixBegin, ixEnd) a triangle is binned to
+        const point origin = m_boundingCube.Origin();
+        const double lo[3] = {origin.get_x(), origin.get_y(), origin.get_z()};
+        const double cell = m_boundingCube.Size() / static_cast<double>(m_divisions);
+        auto binSlabs = [&](std::size_t ixBegin, std::size_t ixEnd, auto &&add)
+        {
+            for (std::size_t t = 0; t < n; ++t)
             {
-                std::array<point, 3> triple = {group[i], group[i + 1], group[i + 2]};
+                const auto &r = ranges[t];
+                const std::size_t xLo = std::max<std::size_t>(r[0], ixBegin);
+                const std::size_t xHi = std::min<std::size_t>(r[1] + std::size_t(1), ixEnd);
+                if (xLo >= xHi)
+                    continue;
+                // a triangle inside a single cube crosses it, only the wider ones are tested
+                const bool test = m_binning == cellBinning::exact && (r[0] != r[1] || r[2] != r[3] || r[4] != r[5]);
+                for (std::size_t ix = xLo; ix < xHi; ++ix)
+                    for (std::size_t iy = r[2]; iy <= r[3]; ++iy)
+                        for (std::size_t iz = r[4]; iz <= r[5]; ++iz)
+                        {
+                            if (test)
+                            {
+                                const double center[3] = {lo[0] + (ix + 0.5) * cell, lo[1] + (iy + 0.5) * cell, lo[2] + (iz + 0.5) * cell};
+                                if (!triangleBoxOverlap(mesh.triangle(t), center, cell * 0.5))
+                                    continue;
+                            }
+                            add(IndexOf(ix, iy, iz), static_cast<std::uint32_t>(t));
+                        }
+            }
+        };
 
-                std::size_t ixMin, ixMax, iyMin, iyMax, izMin, izMax;
-                if (!TriangleCubeRange(triple, ixMin, ixMax, iyMin, iyMax, izMin, izMax))
-                    continue; // fully outside bounding cube
+        // m_cellStart[idx + 1] counts the triangles of cube idx until the prefix sum
+        m_cellStart.assign(SubCubeCount() + 1, 0);
+        auto countSlabs = [&](std::size_t ixBegin, std::size_t ixEnd)
+        {
+            binSlabs(ixBegin, ixEnd, [&](std::size_t idx, std::uint32_t)
+                     { m_cellStart[idx + 1]++; });
+        };
+        auto fillSlabs = [&](std::size_t ixBegin, std::size_t ixEnd)
+        {
+            const std::size_t first = IndexOf(ixBegin, 0, 0), last = IndexOf(ixEnd, 0, 0);
+            std::vector<std::uint32_t> cursor(m_cellStart.begin() + first, m_cellStart.begin() + last);
+            binSlabs(ixBegin, ixEnd, [&](std::size_t idx, std::uint32_t t)
+                     { m_triangles[cursor[idx - first]++] = t; });
+            for (std::size_t idx = first; idx < last; ++idx)
+                packTriangleBlocks(mesh, m_triangles.data() + m_cellStart[idx], m_cellStart[idx + 1] - m_cellStart[idx],
+                                   m_blocks.data() + m_blockStart[idx]);
+        };
 
-                for (std::size_t ix = ixMin; ix <= ixMax; ++ix)
-                    for (std::size_t iy = iyMin; iy <= iyMax; ++iy)
-                        for (std::size_t iz = izMin; iz <= izMax; ++iz)
-                            cubeTriples[IndexOf(ix, iy, iz)].push_back(triple);
-            }
+        const std::size_t slabs = pool && pool->size() > 1 ? std::min(pool->size() * 2, m_divisions) : 1;
+        auto forSlabs = [&](auto &&fn)
+        {
+            if (slabs == 1)
+                fn(std::size_t(0), m_divisions);
+            else
+                pool->parallelFor(slabs, [&](std::size_t c, std::size_t)
+                                  { fn(c * m_divisions / slabs, (c + 1) * m_divisions / slabs); });
+        };
+
+        if (slabs > 1)
+        {
+            const std::size_t chunks = std::min(pool->size() * 4, std::max<std::size_t>(1, n / 4096));
+            pool->parallelFor(chunks, [&](std::size_t c, std::size_t)
+                              { computeRanges(c * n / chunks, (c + 1) * n / chunks); });
         }
+        else
+        {
+            computeRanges(0, n);
+        }
+        forSlabs(countSlabs);
 
-        SubdivideWithTriples(&cubeTriples, nullptr);
+        // counts to offsets, for the ids and for the blocks
+        m_blockStart.assign(SubCubeCount() + 1, 0);
+        m_occupancy.assign((SubCubeCount() + 63) / 64, 0);
+        std::uint64_t references = 0, blocks = 0;
+        for (std::size_t idx = 0; idx < SubCubeCount(); ++idx)
+        {
+            const std::uint32_t count = m_cellStart[idx + 1];
+            if (count)
+                m_occupancy[idx >> 6] |= std::uint64_t(1) << (idx & 63);
+            references += count;
+            blocks += triangleBlockCount(count);
+            if (references > std::numeric_limits<std::uint32_t>::max())
+                throw std::length_error("sphereBoundingGrid: more than 2^32 triangle references.");
+            m_cellStart[idx + 1] = static_cast<std::uint32_t>(references);
+            m_blockStart[idx + 1] = static_cast<std::uint32_t>(blocks);
+        }
+        m_triangles.resize(references);
+        m_blocks.resize(blocks);
+        forSlabs(fillSlabs);
     }
 
-    // Change these three functions:
-    const std::unordered_map<std::size_t, CubeEntry> &getCubes() const { return m_entries; }
-
-    const std::unordered_map<std::size_t, CubeEntry> &Entries() const { return m_entries; }
-    std::unordered_map<std::size_t, CubeEntry> &Entries() { return m_entries; }
+    // heap bytes held by the grid: the offsets of the cubes, the triangle ids and blocks, the occupancy bits
+    std::size_t MemoryBytes() const
+    {
+        return (m_cellStart.capacity() + m_blockStart.capacity() + m_triangles.capacity()) * sizeof(std::uint32_t) +
+               m_blocks.capacity() * sizeof(triangleBlock) + m_occupancy.capacity() * sizeof(std::uint64_t);
+    }
 
-    // Fix FindEntry to work with map iteration (entry is now a pair<key, value>)
-    CubeEntry *FindEntry(const std::function<bool(const CubeEntry &)> &predicate)
+    // the triangles of cube index, empty for an empty cube
+    CubeData Cell(std::size_t index) const
     {
-        for (auto &kv : m_entries)
-            if (predicate(kv.second))
-                return &kv.second;
-        return nullptr;
+        CubeData cube;
+        cube.triangles = m_triangles.data() + m_cellStart[index];
+        cube.triangleCount = m_cellStart[index + 1] - m_cellStart[index];
+        cube.blocks = m_blocks.data() + m_blockStart[index];
+        cube.blockCount = m_blockStart[index + 1] - m_blockStart[index];
+        return cube;
     }
 
+    // triangle ids stored over all the cubes, a triangle counting once per cube it is binned to
+    std::size_t TriangleReferences() const { return m_triangles.size(); }
+    cellBinning Binning() const { return m_binning; }
+
     std::size_t Divisions() const { return m_divisions; }
     std::size_t SubCubeCount() const { return m_divisions * m_divisions * m_divisions; }
 
@@ -181,13 +324,53 @@ public:
         return true;
     }
 
-    std::vector<std::pair<std::size_t, double>> TraverseRay(const point &ro, const point &rd) const
+    // Walks the cubes pierced by the ray front to back (3D DDA) and calls
+    // visit(const CubeData &cube, double cubeDist) for each non-empty one, cubeDist being
+    // the distance at which the ray enters it. The visitor returns false to stop the walk.
+    // Empty cubes are skipped on the occupancy bits, nothing is allocated.
+    template <typename Visitor>
+    void VisitRay(const point &ro, const point &rd, Visitor &&visit) const
     {
-        std::vector<std::pair<std::size_t, double>> visitedCubes;
+        WalkCells(ro, rd, [&](std::size_t index, double cubeDist)
+                  {
+            if (!Occupied(index))
+                return true;
+            return static_cast<bool>(visit(Cell(index), cubeDist)); });
+    }
 
+    // Any hit closer than maxDist (shadow and visibility rays): the cubes are walked along the
+    // unit direction of the query, so cube and triangle distances compare directly, and the walk
+    // stops at the first cube holding a hit or past maxDist.
+    bool Occluded(const triangleMesh &mesh, const rayQuery &query, double maxDist, traceStats *stats = nullptr,
+                  rayMailbox *tested = nullptr) const
+    {
+        if (stats)
+            stats->rays++;
+
+        bool blocked = false;
+        VisitRay(point(query.origin[0], query.origin[1], query.origin[2]),
+                 point(query.direction[0], query.direction[1], query.direction[2]),
+                 [&](const CubeData &cube, double cubeDist)
+                 {
+                     if (cubeDist > maxDist)
+                         return false;
+                     if (stats)
+                         stats->nodesVisited++;
+                     blocked = cube.Occludes(mesh, query, maxDist, tested, stats);
+                     return !blocked;
+                 });
+        if (blocked && stats)
+            stats->hits++;
+        return blocked;
+    }
+
+    // Same walk, calling visit(std::size_t index, double cubeDist) for every cube, empty or not.
+    template <typename Visitor>
+    void WalkCells(const point &ro, const point &rd, Visitor &&visit) const
+    {
         double tEnter, tExit;
         if (!RayGridRange(ro, rd, tEnter, tExit))
-            return visitedCubes;
+            return;
 
         const point o = m_boundingCube.Origin();
         const double cell = m_boundingCube.Size() / static_cast<double>(m_divisions);
@@ -228,80 +411,51 @@ public:
             }
         }
 
+        // flat index strides along x, y, z (see IndexOf)
+        const long stride[3] = {n * n, n, 1};
+        long flat = idx[0] * stride[0] + idx[1] * stride[1] + idx[2];
+
         double cubeDist = tEnter;
         for (;;)
         {
-            visitedCubes.emplace_back(IndexOf(
-                                          static_cast<std::size_t>(idx[0]),
-                                          static_cast<std::size_t>(idx[1]),
-                                          static_cast<std::size_t>(idx[2])),
-                                      cubeDist);
+            if (!visit(static_cast<std::size_t>(flat), cubeDist))
+                return;
 
             const int a = (tMax[0] < tMax[1])
                               ? (tMax[0] < tMax[2] ? 0 : 2)
                               : (tMax[1] < tMax[2] ? 1 : 2);
 
             if (step[a] == 0 || tMax[a] > tExit)
-                break;
+                return;
 
             idx[a] += step[a];
             if (idx[a] < 0 || idx[a] >= n)
-                break;
+                return;
+            flat += step[a] * stride[a];
 
             cubeDist = tMax[a];
             tMax[a] += tDelta[a];
         }
-
-        return visitedCubes;
     }
 
-    void PrecomputeNeighbors()
+    bool Occupied(std::size_t index) const
     {
-        constexpr std::size_t kInvalid = static_cast<std::size_t>(-1);
-
-        auto resolve = [&](bool inBounds, std::size_t candidate) -> std::size_t
-        {
-            if (!inBounds)
-                return kInvalid;
-
-            auto it = m_entries.find(candidate);
-            if (it == m_entries.end() || it->second.data.triples.empty())
-                return kInvalid; // skip empty/nonexistent neighbors
-
-            return candidate;
-        };
-
-        for (std::size_t ix = 0; ix < m_divisions; ++ix)
-            for (std::size_t iy = 0; iy < m_divisions; ++iy)
-                for (std::size_t iz = 0; iz < m_divisions; ++iz)
-                {
-                    std::size_t idx = IndexOf(ix, iy, iz);
-                    auto &entry = m_entries.at(idx);
-
-                    entry.data.neighbors[0] = resolve(ix > 0, (ix > 0) ? IndexOf(ix - 1, iy, iz) : 0);
-                    entry.data.neighbors[1] = resolve(ix < m_divisions - 1, (ix < m_divisions - 1) ? IndexOf(ix + 1, iy, iz) : 0);
-                    entry.data.neighbors[2] = resolve(iy > 0, (iy > 0) ? IndexOf(ix, iy - 1, iz) : 0);
-                    entry.data.neighbors[3] = resolve(iy < m_divisions - 1, (iy < m_divisions - 1) ? IndexOf(ix, iy + 1, iz) : 0);
-                    entry.data.neighbors[4] = resolve(iz > 0, (iz > 0) ? IndexOf(ix, iy, iz - 1) : 0);
-                    entry.data.neighbors[5] = resolve(iz < m_divisions - 1, (iz < m_divisions - 1) ? IndexOf(ix, iy, iz + 1) : 0);
-                }
-    }
-    CubeEntry &At(std::size_t index) { return m_entries.at(index); }
-    const CubeEntry &At(std::size_t index) const { return m_entries.at(index); }
-
-    void SetTriples(std::size_t index, std::vector<std::array<point, 3>> triples)
-    {
-        m_entries.at(index).data.triples = std::move(triples);
+        return (m_occupancy[index >> 6] >> (index & 63)) & 1u;
     }
 
-    void AddVertexTriple(std::size_t index, const point &p1, const point &p2, const point &p3)
+    // Face neighbour of a cube ([left, right, front, back, bottom, top]), kNoCube when it is
+    // out of the grid or empty. Read from the occupancy bits.
+    static constexpr std::size_t kNoCube = static_cast<std::size_t>(-1);
+    std::size_t Neighbor(std::size_t index, int face) const
     {
-        m_entries.at(index).data.triples.push_back({p1, p2, p3});
-    }
-
-    void AddVertexTriple(std::size_t index, std::array<point, 3> triple)
-    {
-        m_entries.at(index).data.triples.push_back(triple);
+        const std::size_t stride[3] = {m_divisions * m_divisions, m_divisions, 1};
+        const std::size_t axis = static_cast<std::size_t>(face / 2);
+        const std::size_t i = index / stride[axis] % m_divisions;
+        const bool inBounds = (face & 1) ? i + 1 < m_divisions : i > 0;
+        if (!inBounds)
+            return kNoCube;
+        const std::size_t candidate = (face & 1) ? index + stride[axis] : index - stride[axis];
+        return Occupied(candidate) ? candidate : kNoCube;
     }
 
     std::size_t IndexForPoint(const point &p) const
@@ -333,81 +487,22 @@ public:
         return true;
     }
 
-    std::vector<std::size_t> DistributeGroupsAsTriples(const std::vector<std::vector<point>> &vertexGroups,
-                                                       std::vector<std::size_t> *outRejectedGroups = nullptr)
-    {
-        std::unordered_map<std::size_t, std::vector<std::array<point, 3>>> cubeTriples;
-
-        for (const auto &group : vertexGroups)
-        {
-            if (group.empty())
-            {
-                if (outRejectedGroups)
-                    outRejectedGroups->push_back(0);
-                continue;
-            }
-
-            std::size_t firstIdx;
-            if (!TryIndexForPoint(group[0], firstIdx))
-            {
-                if (outRejectedGroups)
-                    outRejectedGroups->push_back(0);
-                continue;
-            }
-
-            bool allSame = true;
-            for (std::size_t i = 1; i < group.size(); ++i)
-            {
-                std::size_t idx;
-                if (!TryIndexForPoint(group[i], idx) || idx != firstIdx)
-                {
-                    allSame = false;
-                    break;
-                }
-            }
-
-            if (!allSame)
-            {
-                if (outRejectedGroups)
-                    outRejectedGroups->push_back(0);
-                continue;
-            }
-
-            if (group.size() >= 3)
-            {
-                std::array<point, 3> triple = {
-                    group[0],
-                    group[1],
-                    group[2]};
-                cubeTriples[firstIdx].push_back(triple);
-            }
-            else
-            {
-                if (outRejectedGroups)
-                    outRejectedGroups->push_back(0);
-            }
-        }
-
-        std::vector<std::size_t> touchedIndices;
-        touchedIndices.reserve(cubeTriples.size());
-
-        for (auto &kv : cubeTriples)
-        {
-            for (const auto &triple : kv.second)
-                AddVertexTriple(kv.first, triple);
-            touchedIndices.push_back(kv.first);
-        }
-
-        return touchedIndices;
-    }
-
 private:
     point m_center;
     double m_radius;
     std::size_t m_divisions;
 
+    cellBinning m_binning;
+
     Cube m_boundingCube;
-    std::unordered_map<std::size_t, CubeEntry> m_entries;
+
+    // compressed rows: the ids of cube i are m_triangles[m_cellStart[i] .. m_cellStart[i + 1]),
+    // its blocks m_blocks[m_blockStart[i] .. m_blockStart[i + 1]); one bit per non-empty cube
+    std::vector<std::uint32_t> m_cellStart;
+    std::vector<std::uint32_t> m_blockStart;
+    std::vector<std::uint32_t> m_triangles;
+    std::vector<triangleBlock> m_blocks;
+    std::vector<std::uint64_t> m_occupancy;
 
     void Validate() const
     {
@@ -423,57 +518,4 @@ private:
         double side = m_radius * 2.0;
         m_boundingCube = Cube(minCorner, side);
     }
-
-    void Subdivide(std::unordered_map<std::size_t, std::vector<std::array<point, 3>>> *prebucketedTriples,
-                   std::vector<std::size_t> *outTouchedIndices)
-    {
-        m_entries.clear();
-
-        const point origin = m_boundingCube.Origin();
-        const double fullSize = m_boundingCube.Size();
-        const double subSize = fullSize / static_cast<double>(m_divisions);
-
-        for (std::size_t ix = 0; ix < m_divisions; ++ix)
-        {
-            for (std::size_t iy = 0; iy < m_divisions; ++iy)
-            {
-                for (std::size_t iz = 0; iz < m_divisions; ++iz)
-                {
-                    point subOrigin = origin + point(
-                                                   subSize * static_cast<double>(ix),
-                                                   subSize * static_cast<double>(iy),
-                                                   subSize * static_cast<double>(iz));
-
-                    Cube subCube(subOrigin, subSize);
-
-                    CubeData data;
-                    data.bounds = subCube.Getpoints();
-                    data.origin = subCube.Origin();
-
-                    std::size_t idx = IndexOf(ix, iy, iz);
-
-                    if (prebucketedTriples)
-                    {
-                        auto it = prebucketedTriples->find(idx);
-                        if (it != prebucketedTriples->end())
-                        {
-                            data.triples = std::move(it->second);
-                            if (outTouchedIndices)
-                                outTouchedIndices->push_back(idx);
-                        }
-                    }
-
-                    // Always insert the cube (even if empty)
-                    m_entries[idx] = CubeEntry{std::move(subCube), std::move(data)};
-                }
-            }
-        }
-    }
-
-    // Convenience wrapper name used by the accelerated constructor.
-    void SubdivideWithTriples(std::unordered_map<std::size_t, std::vector<std::array<point, 3>>> *prebucketedTriples,
-                              std::vector<std::size_t> *outTouchedIndices)
-    {
-        Subdivide(prebucketedTriples, outTouchedIndices);
-    }
 };
\ No newline at end of file
@@ -0,0 +1,243 @@
+/**
+ * @file threadPool.h
+ * @brief Defines the threadPool class, a persistent pool of workers with work stealing.
+ */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @class threadPool
+ * @brief Persistent worker threads, each with its own task deque.
+ * parallelFor deals the task indices to the workers in contiguous blocks.
+ * A worker pops from the back of its own deque and, once it runs dry,
+ * steals from the front of the others, so uneven tasks (sky tiles vs mesh
+ * tiles) still keep every core busy. Threads sleep between batches.
+ */
+class threadPool
+{
+public:
+    // time split of one worker during the last parallelFor
+    struct workerTiming
+    {
+        double busyMs = 0;
+        double idleMs = 0;
+        size_t tasks = 0;
+        size_t stolen = 0;
+    };
+
+    explicit threadPool(size_t workers)
+    {
+        if (workers == 0)
+        {
+            workers = 1;
+        }
+        for (size_t i = 0; i < workers; ++i)
+        {
+            queues.push_back(make_unique<workerQueue>());
+        }
+        timings.resize(workers);
+        for (size_t i = 0; i < workers; ++i)
+        {
+            threads.emplace_back(&threadPool::workerLoop, this, i);
+        }
+    }
+
+    threadPool(const threadPool &) = delete;
+    threadPool &operator=(const threadPool &) = delete;
+
+    ~threadPool()
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    size_t size() const { return threads.size(); }
+
+    // timings of the last parallelFor, one entry per worker
+    const vector<workerTiming> &lastTimings() const { return timings; }
+
+    // runs task(index, worker) for every index in [0, count) and blocks until they are all done
+    void parallelFor(size_t count, const function<void(size_t, size_t)> &task)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        const size_t n = size();
+        for (size_t w = 0; w < n; ++w)
+        {
+            lock_guard<mutex> lock(queues[w]->lock);
+            queues[w]->tasks.clear();
+            for (size_t i = w * count / n; i < (w + 1) * count / n; ++i)
+            {
+                queues[w]->tasks.push_back(i);
+            }
+            timings[w] = workerTiming();
+        }
+
+        auto start = chrono::steady_clock::now();
+        {
+            lock_guard<mutex> lock(stateMutex);
+            current = &task;
+            failure = nullptr;
+            running = n;
+            generation++;
+        }
+        wake.notify_all();
+
+        {
+            unique_lock<mutex> lock(stateMutex);
+            done.wait(lock, [&]
+                      { return running == 0; });
+            current = nullptr;
+        }
+
+        chrono::duration<double, milli> wall = chrono::steady_clock::now() - start;
+        for (auto &t : timings)
+        {
+            t.idleMs = wall.count() > t.busyMs ? wall.count() - t.busyMs : 0;
+        }
+
+        if (failure)
+        {
+            rethrow_exception(failure);
+        }
+    }
+
+private:
+    struct workerQueue
+    {
+        deque<size_t> tasks;
+        mutex lock;
+    };
+
+    vector<unique_ptr<workerQueue>> queues;
+    vector<thread> threads;
+    vector<workerTiming> timings;
+
+    mutex stateMutex;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(size_t, size_t)> *current = nullptr;
+    exception_ptr failure = nullptr;
+    size_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+
+    bool popLocal(size_t id, size_t &task)
+    {
+        lock_guard<mutex> lock(queues[id]->lock);
+        if (queues[id]->tasks.empty())
+        {
+            return false;
+        }
+        task = queues[id]->tasks.back();
+        queues[id]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t id, size_t &task)
+    {
+        for (size_t k = 1; k < queues.size(); ++k)
+        {
+            workerQueue &victim = *queues[(id + k) % queues.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t id)
+    {
+        size_t seen = 0;
+        for (;;)
+        {
+            const function<void(size_t, size_t)> *task = nullptr;
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wake.wait(lock, [&]
+                          { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+                task = current;
+            }
+
+            // tasks are only added before the batch starts, so once nothing is left
+            // locally or to steal this worker is done for the batch
+            workerTiming &timing = timings[id];
+            size_t index = 0;
+            for (;;)
+            {
+                bool stolen = false;
+                if (!popLocal(id, index))
+                {
+                    if (!steal(id, index))
+                    {
+                        break;
+                    }
+                    stolen = true;
+                }
+
+                auto begin = chrono::steady_clock::now();
+                try
+                {
+                    (*task)(index, id);
+                }
+                catch (...)
+                {
+                    lock_guard<mutex> lock(stateMutex);
+                    if (!failure)
+                    {
+                        failure = current_exception();
+                    }
+                }
+                chrono::duration<double, milli> spent = chrono::steady_clock::now() - begin;
+                timing.busyMs += spent.count();
+                timing.tasks++;
+                if (stolen)
+                {
+                    timing.stolen++;
+                }
+            }
+
+            {
+                lock_guard<mutex> lock(stateMutex);
+                running--;
+                if (running == 0)
+                {
+                    done.notify_all();
+                }
+            }
+        }
+    }
+};
+
+#endif // THREADPOOL_H
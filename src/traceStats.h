@@ -0,0 +1,65 @@
+/**
+ * @file traceStats.h
+ * @brief Defines the traceStats struct used to count the work done by the acceleration structures.
+ */
+#ifndef TRACESTATS_H
+#define TRACESTATS_H
+
+#include <cstddef>
+#include <iostream>
+
+/**
+ * @struct traceStats
+ * @brief Counts the rays, visited cells/nodes and triangle tests of a render.
+ * Each camera owns one so the counters can be updated without synchronisation,
+ * the totals are merged once the threads are done.
+ */
+struct traceStats
+{
+    std::size_t rays = 0;          // rays that reached an acceleration structure (after the sphere test)
+    std::size_t nodesVisited = 0;  // non-empty grid cells or BVH nodes visited
+    std::size_t triangleTests = 0; // ray / triangle intersection tests
+    std::size_t hits = 0;          // tests that produced a new nearest hit
+    std::size_t packets = 0;       // ray packets traced together (packet mode only)
+    std::size_t objectTests = 0;   // objects reached through the top-level hierarchy
+    std::size_t mailboxSkips = 0;  // triangle tests skipped because the ray already made them in an earlier cell
+
+    void merge(const traceStats &other)
+    {
+        rays += other.rays;
+        nodesVisited += other.nodesVisited;
+        triangleTests += other.triangleTests;
+        hits += other.hits;
+        packets += other.packets;
+        objectTests += other.objectTests;
+        mailboxSkips += other.mailboxSkips;
+    }
+
+    void clear()
+    {
+        *this = traceStats();
+    }
+
+    double testsPerRay() const
+    {
+        return rays == 0 ? 0.0 : static_cast<double>(triangleTests) / static_cast<double>(rays);
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const traceStats &s)
+    {
+        os << "rays: " << s.rays
+           << " | nodes visited: " << s.nodesVisited
+           << " | triangle tests: " << s.triangleTests
+           << " | tests/ray: " << s.testsPerRay()
+           << " | hits: " << s.hits;
+        if (s.packets)
+            os << " | packets: " << s.packets;
+        if (s.objectTests)
+            os << " | object tests: " << s.objectTests;
+        if (s.mailboxSkips)
+            os << " | mailbox skips: " << s.mailboxSkips;
+        return os;
+    }
+};
+
+#endif // TRACESTATS_H
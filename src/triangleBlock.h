@@ -0,0 +1,227 @@
+/**
+ * @file triangleBlock.h
+ * @brief Defines the triangleBlock struct, 8 triangles in structure-of-arrays form, and the batch kernels testing one ray against a block.
+ */
+#ifndef TRIANGLEBLOCK_H
+#define TRIANGLEBLOCK_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "triangleMesh.h"
+#include "triangleIntersection.h"
+#include "cpuFeatures.h"
+
+/**
+ * @struct triangleBlock
+ * @brief Möller–Trumbore records of up to 8 triangles, one array per component.
+ * Unused lanes have null edges, so their determinant is 0 and they never hit.
+ */
+struct alignas(32) triangleBlock
+{
+    static constexpr int kWidth = 8;
+
+    float v0x[kWidth], v0y[kWidth], v0z[kWidth];
+    float e1x[kWidth], e1y[kWidth], e1z[kWidth];
+    float e2x[kWidth], e2y[kWidth], e2z[kWidth];
+    std::uint32_t ids[kWidth]; // mesh triangle ids
+    std::uint32_t count = 0;
+
+    triangleBlock()
+    {
+        for (int k = 0; k < kWidth; ++k)
+        {
+            v0x[k] = v0y[k] = v0z[k] = 0.0f;
+            e1x[k] = e1y[k] = e1z[k] = 0.0f;
+            e2x[k] = e2y[k] = e2z[k] = 0.0f;
+            ids[k] = 0;
+        }
+    }
+
+    void add(const triangleMesh &mesh, std::uint32_t tri)
+    {
+        const triangleRecord &r = mesh.records[tri];
+        const std::uint32_t k = count++;
+        v0x[k] = r.v0.x();
+        v0y[k] = r.v0.y();
+        v0z[k] = r.v0.z();
+        e1x[k] = r.e1.x();
+        e1y[k] = r.e1.y();
+        e1z[k] = r.e1.z();
+        e2x[k] = r.e2.x();
+        e2y[k] = r.e2.y();
+        e2z[k] = r.e2.z();
+        ids[k] = tri;
+    }
+};
+
+// blocks needed for count triangles
+inline std::size_t triangleBlockCount(std::size_t count)
+{
+    return (count + triangleBlock::kWidth - 1) / triangleBlock::kWidth;
+}
+
+// repacks count mesh triangles into the triangleBlockCount(count) empty blocks at out
+inline void packTriangleBlocks(const triangleMesh &mesh, const std::uint32_t *tris, std::size_t count, triangleBlock *out)
+{
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        out[k / triangleBlock::kWidth].add(mesh, tris[k]);
+    }
+}
+
+// repacks a list of mesh triangles into blocks of 8
+inline std::vector<triangleBlock> packTriangleBlocks(const triangleMesh &mesh, const std::vector<std::uint32_t> &tris)
+{
+    std::vector<triangleBlock> blocks(triangleBlockCount(tris.size()));
+    packTriangleBlocks(mesh, tris.data(), tris.size(), blocks.data());
+    return blocks;
+}
+
+/**
+ * @class triangleBlockKernel
+ * @brief Tests one ray against the 8 lanes of a block and returns the nearest lane closer than tMax.
+ * Only the lanes set in laneMask can hit (the mailbox masks the triangles a ray already tested).
+ * The AVX2 version is chosen once at startup when the CPU supports it, otherwise the
+ * scalar loop is used. Both evaluate the same float expressions in the same order,
+ * so they report the same hits.
+ */
+class triangleBlockKernel
+{
+public:
+    // lane of the nearest hit with t < tMax (t is returned in tHit), -1 on a miss
+    static int intersect(const rayQuery &q, const triangleBlock &b, float tMax, float &tHit, std::uint32_t laneMask = kAllLanes)
+    {
+        return selected()(q, b, tMax, tHit, laneMask);
+    }
+
+    static bool usesAVX2() { return selected() != &intersectScalar; }
+
+    // forces the scalar loop even on AVX2 hardware (to compare or debug), false restores the detected kernel
+    static void forceScalar(bool force)
+    {
+        selected() = force ? &intersectScalar : detect();
+    }
+
+    static constexpr std::uint32_t kAllLanes = (1u << triangleBlock::kWidth) - 1;
+
+    static int intersectScalar(const rayQuery &q, const triangleBlock &b, float tMax, float &tHit, std::uint32_t laneMask = kAllLanes)
+    {
+        const float ox = static_cast<float>(q.origin[0]), oy = static_cast<float>(q.origin[1]), oz = static_cast<float>(q.origin[2]);
+        const float dx = static_cast<float>(q.direction[0]), dy = static_cast<float>(q.direction[1]), dz = static_cast<float>(q.direction[2]);
+
+        int best = -1;
+        for (std::uint32_t k = 0; k < b.count; ++k)
+        {
+            if (!((laneMask >> k) & 1u))
+                continue;
+            const float px = dy * b.e2z[k] - dz * b.e2y[k];
+            const float py = dz * b.e2x[k] - dx * b.e2z[k];
+            const float pz = dx * b.e2y[k] - dy * b.e2x[k];
+            const float det = b.e1x[k] * px + b.e1y[k] * py + b.e1z[k] * pz;
+            if (det == 0.0f)
+                continue;
+            const float invDet = 1.0f / det;
+
+            const float sx = ox - b.v0x[k], sy = oy - b.v0y[k], sz = oz - b.v0z[k];
+            const float u = (sx * px + sy * py + sz * pz) * invDet;
+
+            const float qx = sy * b.e1z[k] - sz * b.e1y[k];
+            const float qy = sz * b.e1x[k] - sx * b.e1z[k];
+            const float qz = sx * b.e1y[k] - sy * b.e1x[k];
+            const float v = (dx * qx + dy * qy + dz * qz) * invDet;
+            const float t = (b.e2x[k] * qx + b.e2y[k] * qy + b.e2z[k] * qz) * invDet;
+
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < tMax)
+            {
+                tMax = t;
+                best = static_cast<int>(k);
+            }
+        }
+        if (best >= 0)
+            tHit = tMax;
+        return best;
+    }
+
+#ifdef RAYCAST_X86
+    RAYCAST_TARGET_AVX2
+    static int intersectAVX2(const rayQuery &q, const triangleBlock &b, float tMax, float &tHit, std::uint32_t laneMask = kAllLanes)
+    {
+        const __m256 ox = _mm256_set1_ps(static_cast<float>(q.origin[0]));
+        const __m256 oy = _mm256_set1_ps(static_cast<float>(q.origin[1]));
+        const __m256 oz = _mm256_set1_ps(static_cast<float>(q.origin[2]));
+        const __m256 dx = _mm256_set1_ps(static_cast<float>(q.direction[0]));
+        const __m256 dy = _mm256_set1_ps(static_cast<float>(q.direction[1]));
+        const __m256 dz = _mm256_set1_ps(static_cast<float>(q.direction[2]));
+
+        const __m256 e1x = _mm256_load_ps(b.e1x), e1y = _mm256_load_ps(b.e1y), e1z = _mm256_load_ps(b.e1z);
+        const __m256 e2x = _mm256_load_ps(b.e2x), e2y = _mm256_load_ps(b.e2y), e2z = _mm256_load_ps(b.e2z);
+
+        const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+        const __m256 sx = _mm256_sub_ps(ox, _mm256_load_ps(b.v0x));
+        const __m256 sy = _mm256_sub_ps(oy, _mm256_load_ps(b.v0y));
+        const __m256 sz = _mm256_sub_ps(oz, _mm256_load_ps(b.v0z));
+        const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+        const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+        int bits = _mm256_movemask_ps(mask) & static_cast<int>(laneMask);
+        if (bits == 0)
+            return -1;
+
+        // nearest of the hit lanes, the lowest lane wins ties like the scalar loop
+        alignas(32) float ts[triangleBlock::kWidth];
+        _mm256_store_ps(ts, t);
+        int best = -1;
+        while (bits)
+        {
+            const int k = cpuFeatures::lowestBit(static_cast<std::uint32_t>(bits));
+            bits &= bits - 1;
+            if (ts[k] < tMax)
+            {
+                tMax = ts[k];
+                best = k;
+            }
+        }
+        tHit = tMax;
+        return best;
+    }
+#endif
+
+private:
+    using kernelFn = int (*)(const rayQuery &, const triangleBlock &, float, float &, std::uint32_t);
+
+    static kernelFn &selected()
+    {
+        static kernelFn fn = detect();
+        return fn;
+    }
+
+    static kernelFn detect()
+    {
+#ifdef RAYCAST_X86
+        if (cpuFeatures::hasAVX2())
+            return &intersectAVX2;
+#endif
+        return &intersectScalar;
+    }
+};
+
+#endif // TRIANGLEBLOCK_H
@@ -0,0 +1,70 @@
+/**
+ * @file triangleBoxOverlap.h
+ * @brief Defines triangleBoxOverlap, the exact triangle / cube test used to bin triangles in the grid and octree cells.
+ */
+#ifndef TRIANGLEBOXOVERLAP_H
+#define TRIANGLEBOXOVERLAP_H
+
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include "point.h"
+
+/**
+ * Separating axis test of a triangle against the cube center +- halfSize (Akenine-Möller 2001):
+ * the 3 cube normals, the triangle normal and the 9 cross products of a cube normal with an edge.
+ * The cube is grown by a relative 1e-6 so a triangle lying on a face between two cells is kept
+ * in both, like the AABB ranges do; degenerate triangles pass the axes they can't decide.
+ */
+inline bool triangleBoxOverlap(const std::array<point, 3> &tri, const double center[3], double halfSize)
+{
+    const double h = halfSize * (1.0 + 1e-6);
+
+    double v[3][3];
+    for (int k = 0; k < 3; ++k)
+    {
+        v[k][0] = tri[k].get_x() - center[0];
+        v[k][1] = tri[k].get_y() - center[1];
+        v[k][2] = tri[k].get_z() - center[2];
+    }
+
+    // cube normals: the bounds of the triangle against the cube
+    for (int a = 0; a < 3; ++a)
+    {
+        if (std::min({v[0][a], v[1][a], v[2][a]}) > h || std::max({v[0][a], v[1][a], v[2][a]}) < -h)
+            return false;
+    }
+
+    // projections of the 3 vertices on axis, against the projected radius of the cube
+    auto separated = [&](const double axis[3])
+    {
+        const double p0 = v[0][0] * axis[0] + v[0][1] * axis[1] + v[0][2] * axis[2];
+        const double p1 = v[1][0] * axis[0] + v[1][1] * axis[1] + v[1][2] * axis[2];
+        const double p2 = v[2][0] * axis[0] + v[2][1] * axis[1] + v[2][2] * axis[2];
+        const double r = h * (std::fabs(axis[0]) + std::fabs(axis[1]) + std::fabs(axis[2]));
+        return std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r;
+    };
+
+    double e[3][3];
+    for (int k = 0; k < 3; ++k)
+        for (int a = 0; a < 3; ++a)
+            e[k][a] = v[(k + 1) % 3][a] - v[k][a];
+
+    // edge x cube normal
+    for (int k = 0; k < 3; ++k)
+    {
+        const double ax[3] = {0.0, -e[k][2], e[k][1]};
+        const double ay[3] = {e[k][2], 0.0, -e[k][0]};
+        const double az[3] = {-e[k][1], e[k][0], 0.0};
+        if (separated(ax) || separated(ay) || separated(az))
+            return false;
+    }
+
+    // plane of the triangle
+    const double n[3] = {e[0][1] * e[1][2] - e[0][2] * e[1][1],
+                         e[0][2] * e[1][0] - e[0][0] * e[1][2],
+                         e[0][0] * e[1][1] - e[0][1] * e[1][0]};
+    return !separated(n);
+}
+
+#endif // TRIANGLEBOXOVERLAP_H
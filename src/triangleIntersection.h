@@ -0,0 +1,186 @@
+/**
+ * @file triangleIntersection.h
+ * @brief Defines the rayQuery class, the single-pass ray / triangle intersection kernels.
+ */
+#ifndef TRIANGLEINTERSECTION_H
+#define TRIANGLEINTERSECTION_H
+
+#include <cmath>
+#include <utility>
+#include "ray.h"
+#include "general.h"
+#include "triangleMesh.h"
+
+// parametric hit: point = origin + direction * t = (1 - u - v) * A + u * B + v * C
+struct triangleHit
+{
+    double t = 0;
+    double u = 0;
+    double v = 0;
+};
+
+/**
+ * @class rayQuery
+ * @brief A ray prepared once for many triangle tests.
+ * The direction is normalized so t is directly the distance to the hit, no
+ * sqrt is needed per hit. In watertight mode the shear that maps the ray onto
+ * +z is also computed here (Woop, Benthin, Wald 2013).
+ *
+ * Both kernels are two-sided and keep the edge convention of the previous
+ * routine: u >= 0, v >= 0, u + v <= 1 and t >= 0.
+ */
+class rayQuery
+{
+public:
+    double origin[3];
+    double direction[3];
+    triangleTest mode;
+
+    // null query, hits nothing
+    rayQuery() : origin{0, 0, 0}, direction{0, 0, 0}, mode(triangleTest::mollerTrumbore), nullDirection(true) {}
+
+    explicit rayQuery(const ray &r, triangleTest kernel = triangleTest::mollerTrumbore)
+        : mode(kernel)
+    {
+        const point o = r.getOrigine();
+        const vec3 d = r.getDirection();
+        origin[0] = o.x();
+        origin[1] = o.y();
+        origin[2] = o.z();
+        direction[0] = d.x();
+        direction[1] = d.y();
+        direction[2] = d.z();
+
+        const double len = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+        if (len > 0)
+        {
+            for (double &c : direction)
+                c /= len;
+        }
+        else
+        {
+            nullDirection = true;
+        }
+
+        if (mode == triangleTest::watertight && !nullDirection)
+            prepareShear();
+    }
+
+    // tests triangle tri of the mesh with the selected kernel
+    bool intersect(const triangleMesh &mesh, std::size_t tri, triangleHit &hit) const
+    {
+        if (nullDirection)
+            return false;
+        if (mode == triangleTest::watertight)
+            return intersectWatertight(mesh.vertex(tri, 0), mesh.vertex(tri, 1), mesh.vertex(tri, 2), hit);
+        return intersectMollerTrumbore(mesh.records[tri], hit);
+    }
+
+    // any-hit test of shadow / visibility rays: triangle tri is hit closer than maxDist
+    bool occludes(const triangleMesh &mesh, std::size_t tri, double maxDist) const
+    {
+        triangleHit hit;
+        return intersect(mesh, tri, hit) && hit.t < maxDist;
+    }
+
+    point pointAt(double t) const
+    {
+        return point(origin[0] + direction[0] * t, origin[1] + direction[1] * t, origin[2] + direction[2] * t);
+    }
+
+    // Möller–Trumbore on the precomputed vertex A and edges B - A, C - A
+    bool intersectMollerTrumbore(const triangleRecord &rec, triangleHit &hit) const
+    {
+        const double e1[3] = {rec.e1.x(), rec.e1.y(), rec.e1.z()};
+        const double e2[3] = {rec.e2.x(), rec.e2.y(), rec.e2.z()};
+
+        // p = d x e2
+        const double p[3] = {direction[1] * e2[2] - direction[2] * e2[1],
+                             direction[2] * e2[0] - direction[0] * e2[2],
+                             direction[0] * e2[1] - direction[1] * e2[0]};
+        const double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (det == 0.0)
+            return false; // parallel to the plane or degenerate
+        const double invDet = 1.0 / det;
+
+        const double s[3] = {origin[0] - rec.v0.x(), origin[1] - rec.v0.y(), origin[2] - rec.v0.z()};
+        const double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+        if (u < 0.0 || u > 1.0)
+            return false;
+
+        // q = s x e1
+        const double q[3] = {s[1] * e1[2] - s[2] * e1[1],
+                             s[2] * e1[0] - s[0] * e1[2],
+                             s[0] * e1[1] - s[1] * e1[0]};
+        const double v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * invDet;
+        if (v < 0.0 || u + v > 1.0)
+            return false;
+
+        const double t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+        if (t < 0.0)
+            return false;
+
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+
+    // Watertight test on the shared vertex positions: neighbouring triangles evaluate the
+    // same edge function for their common edge, so a ray can't slip between them
+    bool intersectWatertight(const point &a, const point &b, const point &c, triangleHit &hit) const
+    {
+        const double A[3] = {a.x() - origin[0], a.y() - origin[1], a.z() - origin[2]};
+        const double B[3] = {b.x() - origin[0], b.y() - origin[1], b.z() - origin[2]};
+        const double C[3] = {c.x() - origin[0], c.y() - origin[1], c.z() - origin[2]};
+
+        const double ax = A[kx] - shearX * A[kz];
+        const double ay = A[ky] - shearY * A[kz];
+        const double bx = B[kx] - shearX * B[kz];
+        const double by = B[ky] - shearY * B[kz];
+        const double cx = C[kx] - shearX * C[kz];
+        const double cy = C[ky] - shearY * C[kz];
+
+        const double U = cx * by - cy * bx;
+        const double V = ax * cy - ay * cx;
+        const double W = bx * ay - by * ax;
+
+        if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0))
+            return false;
+
+        const double det = U + V + W;
+        if (det == 0.0)
+            return false;
+
+        const double T = shearZ * (U * A[kz] + V * B[kz] + W * C[kz]);
+        const double t = T / det;
+        if (t < 0.0)
+            return false;
+
+        hit.t = t;
+        hit.u = V / det;
+        hit.v = W / det;
+        return true;
+    }
+
+private:
+    bool nullDirection = false;
+    int kx = 0, ky = 1, kz = 2;
+    double shearX = 0, shearY = 0, shearZ = 1;
+
+    void prepareShear()
+    {
+        const double ad[3] = {std::abs(direction[0]), std::abs(direction[1]), std::abs(direction[2])};
+        kz = ad[0] > ad[1] ? (ad[0] > ad[2] ? 0 : 2) : (ad[1] > ad[2] ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (direction[kz] < 0.0)
+            std::swap(kx, ky); // keep the winding
+
+        shearX = direction[kx] / direction[kz];
+        shearY = direction[ky] / direction[kz];
+        shearZ = 1.0 / direction[kz];
+    }
+};
+
+#endif // TRIANGLEINTERSECTION_H
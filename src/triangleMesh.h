@@ -0,0 +1,207 @@
+/**
+ * @file triangleMesh.h
+ * @brief Defines the triangleMesh class, the indexed geometry of an object.
+ */
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include "point.h"
+#include "color.h"
+#include "vec3.h"
+
+// precomputed Möller–Trumbore data of one triangle
+struct triangleRecord
+{
+    point v0; // A
+    vec3 e1;  // B - A
+    vec3 e2;  // C - A
+};
+
+/**
+ * @class triangleMesh
+ * @brief Shared vertex positions, a triangle index buffer and per-triangle color ids.
+ * Each triangle t uses positions[indices[3t]], positions[indices[3t+1]], positions[indices[3t+2]]
+ * and is colored with palette[colorIds[t]]. A record with the first vertex and the two
+ * edges leaving it is precomputed per triangle so the intersection kernels don't
+ * gather the three corners and rebuild the edges per ray.
+ */
+class triangleMesh
+{
+public:
+    std::vector<point> positions;
+    std::vector<std::uint32_t> indices;
+    std::vector<std::uint32_t> colorIds;
+    std::vector<color> palette;
+    std::vector<triangleRecord> records;
+
+    triangleMesh() {}
+
+    // build from a triangle list (3 points per group), identical positions are shared
+    static triangleMesh fromTriangles(const std::vector<std::vector<point>> &groups)
+    {
+        triangleMesh m;
+        std::unordered_map<vertexKey, std::uint32_t, vertexKeyHash> lookup;
+        lookup.reserve(groups.size() * 3);
+        m.indices.reserve(groups.size() * 3);
+
+        for (const auto &group : groups)
+        {
+            for (std::size_t i = 0; i + 2 < group.size(); i += 3)
+            {
+                for (std::size_t k = 0; k < 3; ++k)
+                    m.indices.push_back(m.addSharedVertex(group[i + k], lookup));
+            }
+        }
+
+        m.colorIds.assign(m.triangleCount(), 0);
+        m.palette = {color()};
+        m.computeRecords();
+        m.positions.shrink_to_fit();
+        return m;
+    }
+
+    // build from a flat corner list, 3 consecutive points per triangle, identical positions are shared
+    static triangleMesh fromCorners(const std::vector<point> &corners)
+    {
+        triangleMesh m;
+        std::unordered_map<vertexKey, std::uint32_t, vertexKeyHash> lookup;
+        lookup.reserve(corners.size());
+        m.indices.reserve(corners.size() - corners.size() % 3);
+
+        for (std::size_t i = 0; i + 2 < corners.size(); i += 3)
+        {
+            for (std::size_t k = 0; k < 3; ++k)
+                m.indices.push_back(m.addSharedVertex(corners[i + k], lookup));
+        }
+
+        m.colorIds.assign(m.triangleCount(), 0);
+        m.palette = {color()};
+        m.computeRecords();
+        m.positions.shrink_to_fit();
+        return m;
+    }
+
+    std::size_t triangleCount() const { return indices.size() / 3; }
+    std::size_t vertexCount() const { return positions.size(); }
+    bool empty() const { return indices.empty(); }
+
+    const point &vertex(std::size_t tri, std::size_t corner) const
+    {
+        return positions[indices[tri * 3 + corner]];
+    }
+
+    std::array<point, 3> triangle(std::size_t tri) const
+    {
+        return {vertex(tri, 0), vertex(tri, 1), vertex(tri, 2)};
+    }
+
+    const color &triangleColor(std::size_t tri) const
+    {
+        return palette[colorIds[tri]];
+    }
+
+    // append a triangle referencing existing positions
+    void addTriangle(std::uint32_t a, std::uint32_t b, std::uint32_t c, std::uint32_t colorId = 0)
+    {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+        colorIds.push_back(colorId);
+        records.push_back({positions[a], positions[b] - positions[a], positions[c] - positions[a]});
+    }
+
+    // one palette entry per triangle
+    void setTriangleColor(std::size_t tri, const color &c)
+    {
+        if (palette.size() != triangleCount())
+        {
+            std::vector<color> expanded(triangleCount());
+            for (std::size_t t = 0; t < triangleCount(); ++t)
+                expanded[t] = triangleColor(t);
+            palette = expanded;
+            for (std::size_t t = 0; t < triangleCount(); ++t)
+                colorIds[t] = static_cast<std::uint32_t>(t);
+        }
+        palette[tri] = c;
+    }
+
+    // single palette entry shared by every triangle
+    void setColor(const color &c)
+    {
+        palette = {c};
+        colorIds.assign(triangleCount(), 0);
+    }
+
+    void translate(const vec3 &offset)
+    {
+        for (auto &p : positions)
+            p = p + offset;
+        for (auto &r : records)
+            r.v0 = r.v0 + offset; // edges are translation invariant
+    }
+
+    void computeRecords()
+    {
+        records.resize(triangleCount());
+        for (std::size_t t = 0; t < triangleCount(); ++t)
+        {
+            const point &a = vertex(t, 0);
+            records[t] = {a, vertex(t, 1) - a, vertex(t, 2) - a};
+        }
+    }
+
+    // heap bytes held by the mesh
+    std::size_t memoryBytes() const
+    {
+        return positions.capacity() * sizeof(point) +
+               indices.capacity() * sizeof(std::uint32_t) +
+               colorIds.capacity() * sizeof(std::uint32_t) +
+               palette.capacity() * sizeof(color) +
+               records.capacity() * sizeof(triangleRecord);
+    }
+
+private:
+    struct vertexKey
+    {
+        std::uint32_t bits[3];
+        bool operator==(const vertexKey &o) const
+        {
+            return bits[0] == o.bits[0] && bits[1] == o.bits[1] && bits[2] == o.bits[2];
+        }
+    };
+
+    struct vertexKeyHash
+    {
+        std::size_t operator()(const vertexKey &k) const
+        {
+            std::size_t h = k.bits[0];
+            h = h * 0x9E3779B1u ^ k.bits[1];
+            h = h * 0x9E3779B1u ^ k.bits[2];
+            return h;
+        }
+    };
+
+    std::uint32_t addSharedVertex(const point &p, std::unordered_map<vertexKey, std::uint32_t, vertexKeyHash> &lookup)
+    {
+        // -0.0f and 0.0f compare equal but have different bits, fold them together
+        const float coords[3] = {p.x() + 0.0f, p.y() + 0.0f, p.z() + 0.0f};
+        vertexKey key;
+        std::memcpy(key.bits, coords, sizeof(key.bits));
+
+        auto it = lookup.find(key);
+        if (it != lookup.end())
+            return it->second;
+
+        std::uint32_t idx = static_cast<std::uint32_t>(positions.size());
+        positions.push_back(p);
+        lookup.emplace(key, idx);
+        return idx;
+    }
+};
+
+#endif // TRIANGLEMESH_H